@@ -7,4 +7,7 @@
 rm md2info
 rm md2view
 rm md2demo
+rm md2bench
+rm md2skin
 rm *bmp
+rm model/*.md2c
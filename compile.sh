@@ -4,5 +4,7 @@
 # change it to make it work on your system
 # GNU GPL (c) 2005, Leander Seige
 
-gcc md2view.c -o md2view -lSDL $(sdl-config --libs --cflags) -lGL -lGLU -lglut -lSDL_image -lX11 -lXext -lXmu -lXi -lm -L/usr/X11R6/lib -w
-gcc md2info.c -o md2info -lGL -lSDL_image $(sdl-config --libs --cflags) -lm -w
+gcc md2view.c -o md2view -lSDL $(sdl-config --libs --cflags) -lGL -lGLU -lglut -lSDL_image -lX11 -lXext -lXmu -lXi -lm -lpthread -L/usr/X11R6/lib -w
+gcc md2info.c -o md2info -lGL -lSDL_image $(sdl-config --libs --cflags) -lm -lpthread -w
+gcc md2bench.c -o md2bench -O2 -lGL -lSDL_image $(sdl-config --libs --cflags) -lm -lpthread -w
+gcc md2skin.c -o md2skin -lGL -lSDL_image $(sdl-config --libs --cflags) -lm -lpthread -w
@@ -16,8 +16,33 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <math.h>
+#include <float.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MD2_X86
+#endif
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#ifdef __NR_io_uring_setup
+#define MD2_URING
+#endif
+#endif
+#define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
+#include <GL/glext.h>
 #include <SDL/SDL_image.h>
 
 
@@ -56,6 +81,9 @@
 #define MD2D_AVERAGENORMALS	4
 #define MD2D_WIREFRAME		8
 #define MD2D_POINTS		16
+#define MD2D_TABLENORMALS	32
+#define MD2D_BUFFERED		64	/* combined with one of the above: draw through a vertex buffer object */
+#define MD2D_SHADER		128	/* combined with one of the above: interpolate in a vertex shader */
 
 
 
@@ -70,6 +98,69 @@ GLubyte *MD2A_NAME[]={ "STAND", "RUN", "ATTACK", "PAIN_A", "PAIN_B", "PAIN_C", "
 
 
 
+/* the 162 precomputed normals of quake 2 (anorms.h), indexed by md2_vertex.normalidx */
+
+#define MD2_NUMNORMALS		162
+
+const GLfloat MD2_ANORMS[MD2_NUMNORMALS][3]={
+    {-0.525731, 0.000000, 0.850651}, {-0.442863, 0.238856, 0.864188}, {-0.295242, 0.000000, 0.955423},
+    {-0.309017, 0.500000, 0.809017}, {-0.162460, 0.262866, 0.951056}, {0.000000, 0.000000, 1.000000},
+    {0.000000, 0.850651, 0.525731}, {-0.147621, 0.716567, 0.681718}, {0.147621, 0.716567, 0.681718},
+    {0.000000, 0.525731, 0.850651}, {0.309017, 0.500000, 0.809017}, {0.525731, 0.000000, 0.850651},
+    {0.295242, 0.000000, 0.955423}, {0.442863, 0.238856, 0.864188}, {0.162460, 0.262866, 0.951056},
+    {-0.681718, 0.147621, 0.716567}, {-0.809017, 0.309017, 0.500000}, {-0.587785, 0.425325, 0.688191},
+    {-0.850651, 0.525731, 0.000000}, {-0.864188, 0.442863, 0.238856}, {-0.716567, 0.681718, 0.147621},
+    {-0.688191, 0.587785, 0.425325}, {-0.500000, 0.809017, 0.309017}, {-0.238856, 0.864188, 0.442863},
+    {-0.425325, 0.688191, 0.587785}, {-0.716567, 0.681718, -0.147621}, {-0.500000, 0.809017, -0.309017},
+    {-0.525731, 0.850651, 0.000000}, {0.000000, 0.850651, -0.525731}, {-0.238856, 0.864188, -0.442863},
+    {0.000000, 0.955423, -0.295242}, {-0.262866, 0.951056, -0.162460}, {0.000000, 1.000000, 0.000000},
+    {0.000000, 0.955423, 0.295242}, {-0.262866, 0.951056, 0.162460}, {0.238856, 0.864188, 0.442863},
+    {0.262866, 0.951056, 0.162460}, {0.500000, 0.809017, 0.309017}, {0.238856, 0.864188, -0.442863},
+    {0.262866, 0.951056, -0.162460}, {0.500000, 0.809017, -0.309017}, {0.850651, 0.525731, 0.000000},
+    {0.716567, 0.681718, 0.147621}, {0.716567, 0.681718, -0.147621}, {0.525731, 0.850651, 0.000000},
+    {0.425325, 0.688191, 0.587785}, {0.864188, 0.442863, 0.238856}, {0.688191, 0.587785, 0.425325},
+    {0.809017, 0.309017, 0.500000}, {0.681718, 0.147621, 0.716567}, {0.587785, 0.425325, 0.688191},
+    {0.955423, 0.295242, 0.000000}, {1.000000, 0.000000, 0.000000}, {0.951056, 0.162460, 0.262866},
+    {0.850651, -0.525731, 0.000000}, {0.955423, -0.295242, 0.000000}, {0.864188, -0.442863, 0.238856},
+    {0.951056, -0.162460, 0.262866}, {0.809017, -0.309017, 0.500000}, {0.681718, -0.147621, 0.716567},
+    {0.850651, 0.000000, 0.525731}, {0.864188, 0.442863, -0.238856}, {0.809017, 0.309017, -0.500000},
+    {0.951056, 0.162460, -0.262866}, {0.525731, 0.000000, -0.850651}, {0.681718, 0.147621, -0.716567},
+    {0.681718, -0.147621, -0.716567}, {0.850651, 0.000000, -0.525731}, {0.809017, -0.309017, -0.500000},
+    {0.864188, -0.442863, -0.238856}, {0.951056, -0.162460, -0.262866}, {0.147621, 0.716567, -0.681718},
+    {0.309017, 0.500000, -0.809017}, {0.425325, 0.688191, -0.587785}, {0.442863, 0.238856, -0.864188},
+    {0.587785, 0.425325, -0.688191}, {0.688191, 0.587785, -0.425325}, {-0.147621, 0.716567, -0.681718},
+    {-0.309017, 0.500000, -0.809017}, {0.000000, 0.525731, -0.850651}, {-0.525731, 0.000000, -0.850651},
+    {-0.442863, 0.238856, -0.864188}, {-0.295242, 0.000000, -0.955423}, {-0.162460, 0.262866, -0.951056},
+    {0.000000, 0.000000, -1.000000}, {0.295242, 0.000000, -0.955423}, {0.162460, 0.262866, -0.951056},
+    {-0.442863, -0.238856, -0.864188}, {-0.309017, -0.500000, -0.809017}, {-0.162460, -0.262866, -0.951056},
+    {0.000000, -0.850651, -0.525731}, {-0.147621, -0.716567, -0.681718}, {0.147621, -0.716567, -0.681718},
+    {0.000000, -0.525731, -0.850651}, {0.309017, -0.500000, -0.809017}, {0.442863, -0.238856, -0.864188},
+    {0.162460, -0.262866, -0.951056}, {0.238856, -0.864188, -0.442863}, {0.500000, -0.809017, -0.309017},
+    {0.425325, -0.688191, -0.587785}, {0.716567, -0.681718, -0.147621}, {0.688191, -0.587785, -0.425325},
+    {0.587785, -0.425325, -0.688191}, {0.000000, -0.955423, -0.295242}, {0.000000, -1.000000, 0.000000},
+    {0.262866, -0.951056, -0.162460}, {0.000000, -0.850651, 0.525731}, {0.000000, -0.955423, 0.295242},
+    {0.238856, -0.864188, 0.442863}, {0.262866, -0.951056, 0.162460}, {0.500000, -0.809017, 0.309017},
+    {0.716567, -0.681718, 0.147621}, {0.525731, -0.850651, 0.000000}, {-0.238856, -0.864188, -0.442863},
+    {-0.500000, -0.809017, -0.309017}, {-0.262866, -0.951056, -0.162460}, {-0.850651, -0.525731, 0.000000},
+    {-0.716567, -0.681718, -0.147621}, {-0.716567, -0.681718, 0.147621}, {-0.525731, -0.850651, 0.000000},
+    {-0.500000, -0.809017, 0.309017}, {-0.238856, -0.864188, 0.442863}, {-0.262866, -0.951056, 0.162460},
+    {-0.864188, -0.442863, 0.238856}, {-0.809017, -0.309017, 0.500000}, {-0.688191, -0.587785, 0.425325},
+    {-0.681718, -0.147621, 0.716567}, {-0.442863, -0.238856, 0.864188}, {-0.587785, -0.425325, 0.688191},
+    {-0.309017, -0.500000, 0.809017}, {-0.147621, -0.716567, 0.681718}, {-0.425325, -0.688191, 0.587785},
+    {-0.162460, -0.262866, 0.951056}, {0.442863, -0.238856, 0.864188}, {0.162460, -0.262866, 0.951056},
+    {0.309017, -0.500000, 0.809017}, {0.147621, -0.716567, 0.681718}, {0.000000, -0.525731, 0.850651},
+    {0.425325, -0.688191, 0.587785}, {0.587785, -0.425325, 0.688191}, {0.688191, -0.587785, 0.425325},
+    {-0.955423, 0.295242, 0.000000}, {-0.951056, 0.162460, 0.262866}, {-1.000000, 0.000000, 0.000000},
+    {-0.850651, 0.000000, 0.525731}, {-0.955423, -0.295242, 0.000000}, {-0.951056, -0.162460, 0.262866},
+    {-0.864188, 0.442863, -0.238856}, {-0.951056, 0.162460, -0.262866}, {-0.809017, 0.309017, -0.500000},
+    {-0.864188, -0.442863, -0.238856}, {-0.951056, -0.162460, -0.262866}, {-0.809017, -0.309017, -0.500000},
+    {-0.681718, 0.147621, -0.716567}, {-0.681718, -0.147621, -0.716567}, {-0.850651, 0.000000, -0.525731},
+    {-0.688191, 0.587785, -0.425325}, {-0.587785, 0.425325, -0.688191}, {-0.425325, 0.688191, -0.587785},
+    {-0.425325, -0.688191, -0.587785}, {-0.587785, -0.425325, -0.688191}, {-0.688191, -0.587785, -0.425325}
+};
+
+
+
 /* some structures :) */
 
 struct md2_uv { GLushort u,v; } ;
@@ -115,11 +206,490 @@ struct md2_model {
     GLuint *			GLCmds;
     struct md2_vertexd * 	VNormal;
     struct md2_vertexd * 	FNormal;
+    GLuint *			AdjIndex;
+    GLuint *			AdjFaces;
+    GLubyte *			Map;
+    size_t			MapSize;
+    GLint			Precision;
+    GLfloat *			VertexF;
+    GLfloat *			VNormalF;
+    GLfloat *			FNormalF;
+    GLshort *			VNormalS;
+    GLshort *			FNormalS;
+    GLint			Flags;
+    GLubyte *			NormalIdx;
+    struct md2_normalcache *	NCache;
+    struct md2_weld *		Weld;
+    GLfloat *			Arrays;		/* welded vertices of the immediate glcommand path */
+    struct md2_buffer *		Buffer;
+    struct md2_gpu *		GPU;
+    GLfloat *			Pose;
+    struct md2_boundingbox *	FrameBB;
+    struct md2_boundingbox	AnimBB[MD2A_MAXANIMATIONS];
+    GLubyte *			CacheMap;	/* the derived arrays are views into it when loaded from a cache file */
+    size_t			CacheMapSize;
+    struct md2_deltaframes *	Delta;		/* MD2L_DELTAFRAMES: the compressed positions, Vertex and VertexF are NULL */
+    struct md2_paging *		Paging;		/* MD2L_PAGED: the frame arrays are views into its region */
+    struct md2_arena *		Arena;		/* holds the model itself, see MD2_arena_create */
+};
+
+/* storage precision of the expanded frames. MD2P_DOUBLE fills Vertex, VNormal and FNormal,
+   the compact modes fill VertexF and VNormalF/FNormalF or VNormalS/FNormalS instead.
+   compact arrays are SoA per frame: all x, then all y, then all z of one keyframe */
+
+#define MD2P_DOUBLE		0	/* 24 bytes per position and normal */
+#define MD2P_FLOAT		1	/* 12 bytes per position and normal */
+#define MD2P_SNORM16		2	/* float positions, normals as 16 bit signed normalized, 6 bytes */
+
+/* size of the header as stored in the file, the rest of md2_model is filled in by the loader */
+
+#define MD2_HEADERSIZE		(17*sizeof(GLuint))
+#define MD2_IDENT		0x32504449
+#define MD2_VERSION		8
+#define MD2_MAXVERTICES		2048
+#define MD2_MAXFACES		4096
+
+/* the memory of a model: one block sized from the header for the model, the file sections,
+   the welded glcommands and the expanded frames, each MD2_ARENAALIGN aligned. whatever does
+   not fit later, e.g. the frames after a miss of the cache file, gets a block of its own */
+
+#define MD2_ARENAALIGN		64
+#define MD2_ALIGNUP(n)		(((size_t)(n)+MD2_ARENAALIGN-1)&~(size_t)(MD2_ARENAALIGN-1))
+
+struct md2_allocator {
+    void *		(*alloc)(size_t size, size_t align, void * user);	/* size is a multiple of align */
+    void		(*release)(void * p, void * user);
+    void *		user;
+};
+
+struct md2_arena {
+    struct md2_arena *	Next;		/* further blocks */
+    size_t		Size;		/* of the block including this header */
+    size_t		Used;
+    struct md2_allocator	Allocator;	/* alloc NULL: aligned_alloc and free */
+};
+
+/* normals of recently used frames for models loaded with MD2L_LAZYNORMALS, least recently used
+   slots are reused first. a slot holds the vertex normals followed by the face normals of one
+   frame in the precision of the model */
+
+struct md2_normalcache {
+    GLint		nSlots;
+    GLint *		Slot;		/* per frame, -1 if not cached */
+    GLint *		Frame;		/* per slot, -1 if free */
+    GLuint *		Stamp;		/* per slot, time of last use */
+    GLuint		Clock;
+    size_t		SlotSize;
+    GLubyte *		Data;
+    struct md2_vertexd *	Scratch;
+    pthread_mutex_t	Lock;
+    GLuint		Hits;
+    GLuint		Misses;
+};
+
+/* positions of models loaded with MD2L_DELTAFRAMES. the frames are cut into sequences by
+   their names without the trailing digits. a sequence keeps a float reference frame, the
+   middle of the range every vertex moves in, and per frame codes of 8 bit if the error bound
+   allows it, else 16 bit: position = Ref + Step * code, both SoA like the compact frames */
+
+struct md2_deltaseq {
+    GLint		First;		/* frame */
+    GLint		nFrames;
+    GLint		Wide;		/* codes are GLshort, else signed char */
+    GLfloat		Step[3];	/* per axis */
+    GLfloat *		Ref;
+    void *		Codes;
+};
+
+struct md2_deltaframes {
+    GLint		nSeqs;
+    struct md2_deltaseq *	Seqs;
+    GLint *		Seq;		/* per frame */
+    GLfloat		MaxError;	/* largest error of a decoded position, measured */
+    size_t		Bytes;
+};
+
+#define MD2_DELTAERROR		0.1f	/* default bound in model units */
+
+/* frames of models loaded with MD2L_PAGED are read and expanded a sequence at a time on first
+   use. the frame arrays keep their layout inside one reserved anonymous mapping, pages never
+   touched take no memory and those of cold sequences are given back with MADV_DONTNEED */
+
+struct md2_pageseq {
+    GLint		First;		/* frame */
+    GLint		nFrames;
+    GLint		Resident;
+    GLint		Pins;		/* callers reading its frames, see MD2_page_acquire */
+    GLuint		Stamp;		/* time of last use */
+};
+
+struct md2_paging {
+    GLint		fd;		/* of the model file, -1 for mapped models */
+    GLubyte *		Region;
+    size_t		RegionSize;
+    size_t		RegionUsed;
+    size_t		FrameBytes;	/* expanded bytes of one frame */
+    GLint		nSeqs;
+    struct md2_pageseq *	Seqs;
+    GLint *		Seq;		/* per frame */
+    size_t		Budget;
+    size_t		Resident;	/* bytes */
+    GLuint		Clock;
+    GLuint		PageIns;
+    GLuint		Evictions;
+    pthread_mutex_t	Lock;
+};
+
+/* the glcommand triangles welded into unique (vertex, texture coordinate) pairs and indexed
+   by a triangle list in vertex cache friendly order, see MD2_weld */
+
+#define MD2_CACHESIZE		16	/* fifo post transform cache the order is optimized and measured for */
+
+struct md2_weld {
+    GLuint		nVertices;
+    GLuint		nIndices;
+    GLuint		nRaw;		/* glcommand vertices before welding */
+    GLfloat		ACMRBefore;	/* average cache misses per triangle of the glcommand list */
+    GLfloat		ACMRAfter;	/* and of the welded, reordered one */
+    GLuint *		Point;		/* model vertex of a welded vertex */
+    GLfloat *		UV;		/* its normalized texture coordinate */
+    GLuint *		Index;
+    GLuint		Last;		/* welded vertex the glcommands end with */
+    GLuint		nStrip;
+    GLuint *		Strip;		/* the glcommands in file order as strips, fans cut into strips of two
+					   triangles, separated by MD2_RESTART */
+};
+
+#define MD2_RESTART		0xffffffff
+
+/* gl buffers and the staging array of the buffered render path */
+
+struct md2_buffer {
+    GLuint		VBO;
+    GLuint		IBO;		/* welded glcommand triangles, then wireframe edges */
+    GLenum		IndexType;	/* GL_UNSIGNED_SHORT whenever the indices fit */
+    GLuint		IndexSize;
+    GLuint		nGLVertices;
+    GLuint		nGLIndices;
+    GLfloat *		Stream;
+    GLuint		StreamSize;	/* in vertices */
+    GLuint *		Index;
+};
+
+/* static keyframe buffers of the shader render path, one per vertex order and kind of normal */
+
+#define MD2K_FACE		0
+#define MD2K_AVERAGE		1
+#define MD2K_VERTEX		2
+#define MD2K_TABLE		3
+#define MD2K_WIRE		4
+#define MD2K_POINTS		5
+#define MD2K_MAX		6
+
+struct md2_gpu {
+    GLuint		Frames[MD2K_MAX];	/* position and normal per vertex and frame, built on first use */
+    GLuint		FaceUV;
+    GLuint		GLCmdUV;
+    GLuint		FrameTex[MD2K_MAX];	/* the frames as buffer textures for instancing */
+    GLuint		Instances;		/* per instance stream, refilled by every instanced draw */
+};
+
+/* one entity drawn by MD2_display_instanced, the transform is column major like glMultMatrixf */
+
+struct md2_instance {
+    GLfloat		transform[16];
+    GLint		sf,ef;
+    GLfloat		s;
+};
+
+/* the shader program is shared by all models */
+
+struct md2_program {
+    const GLchar *	Version;
+    GLuint		Program;
+    GLint		uS,uTexMap,uLighting,uLocalViewer,uNormalizing,uLights,uTexturing,uTex,uTex2D,uFrames,uCount;
 };
 
+/* a skin as the render functions see it: w and h are its size in pixels, texture coordinates
+   are offset+scale*(skin coordinate in 0..1). a whole rectangle texture has offset 0 and scale
+   w,h, a mipmapped 2D texture scale 1,1 and a region of an atlas page the part it covers.
+   target 0 stands for a rectangle texture of w,h, so w, h and name are enough to fill in */
+
 struct md2_texture {
     GLint w,h;
     GLuint name;
+    GLenum target;		/* GL_TEXTURE_RECTANGLE_NV or GL_TEXTURE_2D */
+    GLfloat offset[2];
+    GLfloat scale[2];
+};
+
+/* skins of many models packed into shared mipmapped 2D pages, see MD2_atlas_create. regions
+   are placed on shelves at multiples of 2^Levels pixels with a gutter of that size around
+   them filled with their edge pixels, so mipmap levels up to Levels never mix two skins */
+
+struct md2_atlaspage {
+    GLuint		name;
+    GLint		ShelfX,ShelfY,ShelfH;
+    GLint		Dirty;		/* mipmaps are out of date */
+};
+
+struct md2_atlas {
+    GLint		Size;		/* of the square pages */
+    GLint		Levels;
+    GLint		nPages;
+    struct md2_atlaspage *	Pages;
+    GLint		nRegions;
+    struct md2_texture **	Regions;
+};
+
+/* block compressed skins, see MD2_bc_encodefile. the file is this header followed by the mip
+   chain, level 0 first, each level the 4x4 blocks of its rows of blocks */
+
+#define MD2B_IDENT		0x5432444d	/* "MD2T" */
+#define MD2B_VERSION		1
+#define MD2B_BC1		1	/* DXT1, 8 bytes per block, opaque */
+#define MD2B_BC3		3	/* DXT5, 16 bytes per block, interpolated alpha */
+#define MD2B_MAXLEVELS		16
+
+struct md2_bcheader {
+    GLuint		Ident;
+    GLuint		Version;
+    GLuint		Format;
+    GLuint		Width;
+    GLuint		Height;
+    GLuint		nLevels;
+    GLuint		Offset[MD2B_MAXLEVELS];
+    GLuint		Size[MD2B_MAXLEVELS];
+};
+
+/* asynchronous texture loading, see MD2_texloader_create */
+
+#define MD2T_QUEUED		0	/* waiting for a worker to decode it */
+#define MD2T_DECODED		1	/* waiting for or in the middle of its upload */
+#define MD2T_READY		2
+#define MD2T_FAILED		3
+#define MD2T_PBOS		3	/* default length of the pixel buffer ring */
+
+struct md2_texrequest {
+    struct md2_texrequest *	Next;		/* in the decode, then the upload queue */
+    GLubyte *		Path;
+    GLint		State;
+    SDL_Surface *	Surface;	/* decoded pixels until uploaded */
+    GLint		Row;		/* rows uploaded so far */
+    struct md2_texture *	Texture;
+};
+
+struct md2_texloader {
+    GLint		nThreads;
+    pthread_t *		Threads;
+    pthread_mutex_t	Lock;
+    pthread_cond_t	Wake;
+    pthread_cond_t	Done;		/* a request changed its state */
+    struct md2_texrequest *	Decode;		/* fifo, first and last */
+    struct md2_texrequest *	DecodeLast;
+    struct md2_texrequest *	Upload;
+    struct md2_texrequest *	UploadLast;
+    GLint		Quit;
+    GLint		nPBOs;
+    GLuint *		PBOs;
+    GLint		NextPBO;
+    size_t		Budget;		/* bytes per MD2_texloader_upload, 0 means no limit */
+    size_t		Uploaded;	/* bytes in total */
+};
+
+/* a small pool of worker threads, the calling thread always takes part in the work. every
+   thread owns a range of the job list in its own cache line, next job in the low and end in
+   the high 32 bits, and steals the back half of another range when its own runs dry */
+
+struct md2_poolslot {
+    _Alignas(64) atomic_ullong	Range;
+};
+
+struct md2_threadpool {
+    GLint		nThreads;
+    pthread_t *		Threads;
+    struct md2_poolslot * Slots;		/* nThreads+1, the caller has the last one */
+    pthread_mutex_t	RunLock;
+    pthread_mutex_t	Lock;
+    pthread_cond_t	Wake;
+    pthread_cond_t	Done;
+    void		(*Func)(void *, GLint);
+    void *		Arg;
+    atomic_int		Ids;
+    atomic_int		Steals;			/* of the last run */
+    GLint		Finished;
+    GLuint		Generation;
+    GLint		Quit;
+};
+
+/* one entity of MD2_pose_batch, outputs as for MD2_pose */
+
+struct md2_posejob {
+    struct md2_model *	md2;
+    GLint		sf,ef;
+    GLdouble		s;
+    GLfloat *		pos;
+    GLfloat *		vnrm;
+    GLfloat *		fnrm;
+    struct md2_boundingbox * bb;
+    GLint		ok;		/* set by MD2_pose_batch, 0 for frames out of range */
+};
+
+struct md2_batchstats {
+    GLdouble		seconds;	/* wall clock time of the batch */
+    GLint		tasks;		/* chunks of whole jobs plus pieces of split models */
+    GLint		split;		/* jobs spread over several tasks */
+    GLint		steals;		/* task ranges taken over from another thread */
+    GLint		failed;		/* jobs with ok==0 */
+};
+
+/* shared models and textures by path, see MD2_registry_model. an asset stays loaded while
+   referenced; unreferenced ones are kept in LRU order and evicted when the resident bytes of
+   the registry exceed its budget */
+
+#define MD2R_MODEL		0
+#define MD2R_TEXTURE		1
+#define MD2R_BUCKETS		256
+
+struct md2_asset {
+    struct md2_asset *	Next;		/* in the chain of its key */
+    struct md2_asset *	NextAsset;	/* in the chain of its pointer */
+    struct md2_asset *	Older;		/* unreferenced ones, from Oldest to Newest */
+    struct md2_asset *	Newer;
+    unsigned long long	Hash;
+    GLubyte *		Path;
+    GLint		Kind;
+    GLint		Precision;	/* models: the load options that change the result */
+    GLint		Flags;
+    GLfloat		MaxError;
+    void *		Asset;		/* NULL while loading or after a failed load */
+    GLint		Loading;
+    GLint		Refs;		/* callers holding it plus those waiting for its load */
+    size_t		Bytes;
+};
+
+struct md2_registry {
+    struct md2_asset *	Keys[MD2R_BUCKETS];
+    struct md2_asset *	Assets[MD2R_BUCKETS];
+    struct md2_asset *	Oldest;
+    struct md2_asset *	Newest;
+    pthread_mutex_t	Lock;
+    pthread_cond_t	Loaded;
+    size_t		Budget;		/* 0 means no limit */
+    size_t		Bytes;
+    GLuint		nAssets;
+    GLuint		Hits;
+    GLuint		Misses;
+    GLuint		Evictions;
+};
+
+struct md2_registrystats {
+    GLuint		assets;		/* loaded, referenced or not */
+    GLuint		hits;		/* lookups served by a loaded or loading asset */
+    GLuint		misses;		/* lookups that loaded the file */
+    GLuint		evictions;	/* unreferenced assets freed for the budget */
+    size_t		bytes;		/* resident estimate of the loaded assets */
+};
+
+/* optional settings for MD2_loadmodel_ex, all zero means the same as MD2_loadmodel */
+
+#define MD2L_MMAP		1	/* map the file instead of reading it, see MD2_mapmodel */
+#define MD2L_TABLENORMALS	2	/* no normal generation, vertex normals come from MD2_ANORMS */
+#define MD2L_LAZYNORMALS	4	/* normals of a frame are generated on first use, see md2_normalcache */
+#define MD2L_CACHE		8	/* take the derived data from a cache file, see md2_cacheheader */
+#define MD2L_DELTAFRAMES	16	/* keep the positions compressed, see md2_deltaframes. not cached */
+#define MD2L_PAGED		32	/* expand the frames of a sequence on first use, see md2_paging. not cached */
+#define MD2L_PREFETCH		64	/* MD2L_PAGED: read ahead the file range of the next sequence */
+
+struct md2_loadopts {
+    GLint			flags;		/* MD2L_* */
+    GLint			threads;	/* >1: split the frame preprocessing over that many threads */
+    struct md2_threadpool *	pool;		/* or use an existing pool, takes precedence over threads */
+    GLint			precision;	/* MD2P_* */
+    size_t			normalcache;	/* MD2L_LAZYNORMALS: memory limit in bytes, 0 means no limit */
+    GLubyte *			cachedir;	/* MD2L_CACHE: directory of the cache files, NULL: next to the model */
+    GLfloat			maxerror;	/* MD2L_DELTAFRAMES: error bound of the positions, 0 means MD2_DELTAERROR */
+    size_t			pagebudget;	/* MD2L_PAGED: expanded bytes kept before cold sequences are dropped, 0 means no limit */
+    struct md2_allocator *	allocator;	/* memory of the model arena, NULL: aligned_alloc and free */
+};
+
+/* a batch of models loaded together, see MD2_loadmodels */
+
+struct md2_loadstats {
+    GLdouble		seconds;	/* wall clock time of the batch */
+    size_t		bytes;		/* read from the files */
+    GLdouble		mbps;		/* bytes read per second of the batch, in MB */
+    GLint		loaded;
+    GLint		failed;
+    GLint		uring;		/* 1: read through io_uring, 0: pread on a thread pool */
+    GLdouble		latency[5];	/* seconds from open to model per file: min, median, 90th and 99th percentile, max */
+};
+
+/* asynchronous model loading, see MD2_modelloader_create. the queue is kept in order of
+   priority, requests of the same priority in the order they were made */
+
+#define MD2M_QUEUED		0
+#define MD2M_LOADING		1
+#define MD2M_READY		2
+#define MD2M_FAILED		3
+#define MD2M_CANCELLED		4
+
+struct md2_modelrequest {
+    struct md2_modelrequest *	Next;		/* in the queue */
+    GLubyte *		Path;
+    struct md2_loadopts	Opts;
+    GLint		HasOpts;
+    GLint		Priority;	/* higher ones are loaded first */
+    GLint		State;
+    GLint		Cancel;		/* cancelled while loading, the result is dropped */
+    GLint		Returned;	/* the load is done, too late to cancel */
+    void		(*Callback)(struct md2_modelrequest *, struct md2_model *, void *);	/* on the worker, before the request turns ready or failed */
+    void *		Arg;
+    struct md2_model *	Model;
+};
+
+/* a registry model of a request cancelled while loading, released on the GL thread */
+
+struct md2_modeldrop {
+    struct md2_modeldrop *	Next;
+    struct md2_model *	Model;
+};
+
+struct md2_modelloader {
+    GLint		nThreads;
+    pthread_t *		Threads;
+    pthread_mutex_t	Lock;
+    pthread_cond_t	Wake;
+    pthread_cond_t	Done;		/* a request changed its state */
+    struct md2_modelrequest *	Queue;
+    struct md2_registry *	Registry;	/* NULL: every request loads its own model */
+    struct md2_modeldrop *	Dropped;
+    GLint		Quit;
+};
+
+/* animation state of many entities, see MD2_animator_create. entity e is index e of every
+   array. Rate, Phase and Mode may be written directly between ticks, the rest belongs to the
+   MD2_animator_* functions */
+
+#define MD2N_LOOP		0	/* wraps from the last keyframe back to the first */
+#define MD2N_ONCE		1	/* stops on the last keyframe and sets Done */
+
+struct md2_animator {
+    GLint		nEntities;
+    GLint		Capacity;	/* grows by doubling */
+    void *		Block;		/* all arrays */
+    struct md2_model **	Model;
+    GLint *		Anim;		/* MD2A_* or -1 for a range of MD2_animator_range */
+    GLint *		First;		/* keyframe range of the sequence */
+    GLint *		Len;
+    GLfloat *		Fps;
+    GLfloat *		Rate;		/* speed factor, negative plays backwards */
+    GLfloat *		Phase;		/* position in keyframes from First, 0<=Phase<Len */
+    GLint *		Mode;
+    GLint *		SF;		/* results of the last MD2_animator_tick */
+    GLint *		EF;
+    GLfloat *		S;
+    GLint *		Done;
 };
 
 
@@ -158,11 +728,154 @@ void MD2_calc_normal(struct md2_vertexd *avf, struct md2_vertexd *bvf, struct md
 
 
 
+/* thread pool, MD2_pool_run calls func(arg,job) for every job in 0..njobs-1 and returns when all are done.
+   taking a job is one compare and swap on the own range, no lock is held while jobs run */
+
+#define MD2_RANGE(lo,hi)	((unsigned long long)(hi)<<32|(GLuint)(lo))
+#define MD2_RANGE_LO(r)		((GLint)((r)&0xffffffff))
+#define MD2_RANGE_HI(r)		((GLint)((r)>>32))
+
+int MD2_pool_steal (struct md2_threadpool * pool, GLint id) {
+    unsigned long long r;
+    GLint c,v,lo,hi,mid;
+
+    for(c=1;c<=(pool->nThreads);c++) {
+	v=(id+c)%(pool->nThreads+1);
+	r=atomic_load(&(pool->Slots[v].Range));
+	while((lo=MD2_RANGE_LO(r))<(hi=MD2_RANGE_HI(r))) {
+	    mid=lo+(hi-lo)/2;
+	    if(atomic_compare_exchange_weak(&(pool->Slots[v].Range),&r,MD2_RANGE(lo,mid))) {
+		/* the own range is empty, no other thread touches it before this store */
+		atomic_store(&(pool->Slots[id].Range),MD2_RANGE(mid,hi));
+		atomic_fetch_add(&(pool->Steals),1);
+		return(1);
+	    }
+	}
+    }
+    return(0);
+}
+
+void MD2_pool_work (struct md2_threadpool * pool, GLint id) {
+    atomic_ullong *own;
+    unsigned long long r;
+
+    own=&(pool->Slots[id].Range);
+    do {
+	r=atomic_load(own);
+	while(MD2_RANGE_LO(r)<MD2_RANGE_HI(r)) {
+	    if(atomic_compare_exchange_weak(own,&r,r+1)) {
+		pool->Func(pool->Arg,MD2_RANGE_LO(r));
+		r=atomic_load(own);
+	    }
+	}
+    } while(MD2_pool_steal(pool,id));
+}
+
+void * MD2_pool_worker (void * arg) {
+    struct md2_threadpool *pool;
+    GLuint seen;
+    GLint id;
+
+    /* workers only start in MD2_pool_create, before any job list was posted */
+    pool=(struct md2_threadpool *)arg;
+    id=atomic_fetch_add(&(pool->Ids),1);
+    seen=0;
+    pthread_mutex_lock(&(pool->Lock));
+    for(;;) {
+	while(seen==pool->Generation && !pool->Quit) pthread_cond_wait(&(pool->Wake),&(pool->Lock));
+	if(pool->Quit) break;
+	seen=pool->Generation;
+	pthread_mutex_unlock(&(pool->Lock));
+	MD2_pool_work(pool,id);
+	pthread_mutex_lock(&(pool->Lock));
+	if(++(pool->Finished)==pool->nThreads) pthread_cond_signal(&(pool->Done));
+    }
+    pthread_mutex_unlock(&(pool->Lock));
+    return(NULL);
+}
+
+/* threads is the total number of threads working on a job list including the caller, 0 means one per cpu */
+
+struct md2_threadpool * MD2_pool_create (GLint threads) {
+    struct md2_threadpool *pool;
+    GLint c;
+
+    if(threads<=0) threads=sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads<=0) threads=1;
+    pool=calloc(1,sizeof(struct md2_threadpool));
+    if(pool) pool->Threads=malloc(threads*sizeof(pthread_t));
+    if(pool) pool->Slots=aligned_alloc(sizeof(struct md2_poolslot),threads*sizeof(struct md2_poolslot));
+    if(!pool || !pool->Threads || !pool->Slots) {
+	fprintf(stderr,"Out of memory, thread pool\n");
+	if(pool) { free(pool->Threads); free(pool->Slots); }
+	free(pool); return(NULL);
+    }
+    pthread_mutex_init(&(pool->RunLock),NULL);
+    pthread_mutex_init(&(pool->Lock),NULL);
+    pthread_cond_init(&(pool->Wake),NULL);
+    pthread_cond_init(&(pool->Done),NULL);
+    for(c=0;c<threads-1;c++) {
+	if(pthread_create(&(pool->Threads[c]),NULL,MD2_pool_worker,pool)) {
+	    fprintf(stderr,"Cannot create thread %d\n",c);
+	    break;
+	}
+	pool->nThreads++;
+    }
+    return(pool);
+}
+
+int MD2_pool_run (struct md2_threadpool * pool, void (*func)(void *, GLint), void * arg, GLint njobs) {
+    GLint j,n;
+
+    if(!pool || !pool->nThreads || njobs<2) {
+	for(j=0;j<njobs;j++) func(arg,j);
+	return(1);
+    }
+    pthread_mutex_lock(&(pool->RunLock));
+    pthread_mutex_lock(&(pool->Lock));
+    pool->Func=func;
+    pool->Arg=arg;
+    n=pool->nThreads+1;
+    for(j=0;j<n;j++) atomic_store(&(pool->Slots[j].Range),MD2_RANGE((GLint64)njobs*j/n,(GLint64)njobs*(j+1)/n));
+    atomic_store(&(pool->Steals),0);
+    pool->Finished=0;
+    pool->Generation++;
+    pthread_cond_broadcast(&(pool->Wake));
+    pthread_mutex_unlock(&(pool->Lock));
+    MD2_pool_work(pool,pool->nThreads);
+    pthread_mutex_lock(&(pool->Lock));
+    while(pool->Finished<pool->nThreads) pthread_cond_wait(&(pool->Done),&(pool->Lock));
+    pthread_mutex_unlock(&(pool->Lock));
+    pthread_mutex_unlock(&(pool->RunLock));
+    return(1);
+}
+
+int MD2_pool_free (struct md2_threadpool * pool) {
+    GLint c;
+
+    pthread_mutex_lock(&(pool->Lock));
+    pool->Quit=1;
+    pthread_cond_broadcast(&(pool->Wake));
+    pthread_mutex_unlock(&(pool->Lock));
+    for(c=0;c<(pool->nThreads);c++) pthread_join(pool->Threads[c],NULL);
+    pthread_cond_destroy(&(pool->Done));
+    pthread_cond_destroy(&(pool->Wake));
+    pthread_mutex_destroy(&(pool->Lock));
+    pthread_mutex_destroy(&(pool->RunLock));
+    free(pool->Threads);
+    free(pool->Slots);
+    free(pool);
+    return(1);
+}
+
+
+
 /* texture loading, independent from model loading, so you can have multiple textures for one model or use whatever as texture */
 
-struct md2_texture * MD2_loadtexture (GLubyte * fn) {
+/* decodes an image file into a 24 bit BGR surface, safe to call from any thread */
+
+SDL_Surface * MD2_decodetexture (GLubyte * fn) {
     SDL_Surface *surf1,*surf2;
-    struct md2_texture *tex;
     SDL_PixelFormat cform;
     
     cform.palette=NULL;
@@ -176,245 +889,3877 @@ struct md2_texture * MD2_loadtexture (GLubyte * fn) {
     cform.Rloss =cform.Gloss =cform.Bloss =0;
     cform.colorkey=0; cform.alpha=0;
     
-    tex=malloc(sizeof(struct md2_texture));
-    if(!tex) {
-	fprintf(stderr,"Out of memory, texture\n");
-	return(NULL);
-    }
     surf1=IMG_Load(fn);
     if(surf1==NULL) {
 	fprintf(stderr,"Cannot load %s\n",fn);
-	free(tex); return(NULL);
+	return(NULL);
     }
-    glGenTextures(1,&(tex->name));
     surf2=SDL_ConvertSurface(surf1,&cform,0);
-    if(surf2==NULL) {
-	fprintf(stderr,"Cannot convert %s\n",fn);
-	SDL_FreeSurface(surf1); free(tex); return(NULL);
-    }
+    SDL_FreeSurface(surf1);
+    if(surf2==NULL) fprintf(stderr,"Cannot convert %s\n",fn);
+    return(surf2);
+}
+
+/* creates the rectangle texture of tex, pixels may be NULL to fill it later */
+
+void MD2_texture_create (struct md2_texture * tex, GLint w, GLint h, void * pixels) {
+    tex->target=GL_TEXTURE_RECTANGLE_NV;
+    tex->offset[0]=tex->offset[1]=0;
+    tex->scale[0]=w;
+    tex->scale[1]=h;
+    glGenTextures(1,&(tex->name));
     glBindTexture(GL_TEXTURE_RECTANGLE_NV,tex->name);
     glTexParameteri(GL_TEXTURE_RECTANGLE_NV, GL_TEXTURE_WRAP_S, GL_CLAMP);
     glTexParameteri(GL_TEXTURE_RECTANGLE_NV, GL_TEXTURE_WRAP_T, GL_CLAMP);
     glTexParameteri(GL_TEXTURE_RECTANGLE_NV, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_RECTANGLE_NV, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     
-    tex->w=surf2->w;
-    tex->h=surf2->h;
-    glTexImage2D(GL_TEXTURE_RECTANGLE_NV,0,GL_RGB,surf2->w,surf2->h,0,GL_BGR,GL_UNSIGNED_BYTE,surf2->pixels);
+    tex->w=w;
+    tex->h=h;
+    glTexImage2D(GL_TEXTURE_RECTANGLE_NV,0,GL_RGB,w,h,0,GL_BGR,GL_UNSIGNED_BYTE,pixels);
+}
+
+struct md2_texture * MD2_loadtexture (GLubyte * fn) {
+    SDL_Surface *surf;
+    struct md2_texture *tex;
     
-    SDL_FreeSurface(surf1);
-    SDL_FreeSurface(surf2);
+    tex=malloc(sizeof(struct md2_texture));
+    if(!tex) {
+	fprintf(stderr,"Out of memory, texture\n");
+	return(NULL);
+    }
+    if(!(surf=MD2_decodetexture(fn))) {
+	free(tex); return(NULL);
+    }
+    MD2_texture_create(tex,surf->w,surf->h,surf->pixels);
+    SDL_FreeSurface(surf);
     return(tex);
 }
 
+/* a GL_TEXTURE_2D with a full mipmap chain and normalized coordinates, for models seen from
+   far away. enable GL_TEXTURE_2D instead of GL_TEXTURE_RECTANGLE_NV to draw with it */
 
-
-/* loading the model itself */
-
-struct md2_model * MD2_loadmodel (GLubyte * fn) {
-    FILE *file;
-    struct md2_model *md2;
-    GLuint n;
-    GLubyte *frames;
-    GLint c,i,s,d;    
-    struct md2_frameheader *fh;
-    struct md2_vertex *vb;
-    struct md2_vertexd *vf,*avf,*bvf,*cvf,svf,rvf;
+struct md2_texture * MD2_loadtexture_mipmapped (GLubyte * fn) {
+    SDL_Surface *surf;
+    struct md2_texture *tex;
     
-    file=fopen(fn,"rb");
-    if(!file) {
-	fprintf(stderr,"Cannot load %s\n",fn);
+    tex=malloc(sizeof(struct md2_texture));
+    if(!tex) {
+	fprintf(stderr,"Out of memory, texture\n");
 	return(NULL);
     }
-    
-    /* loading header */
-    n=sizeof(struct md2_model); md2=malloc(n);
-    if(!md2) {
-	fprintf(stderr,"Out of memory, header\n");
-	fclose(file); return(NULL);
-    }
-    if(n!=fread((void *)md2,1,n,file)) {
-	fprintf(stderr,"Read error, header\n");
-	fclose(file); return(NULL);
+    if(!(surf=MD2_decodetexture(fn))) {
+	free(tex); return(NULL);
     }
+    tex->w=surf->w;
+    tex->h=surf->h;
+    tex->target=GL_TEXTURE_2D;
+    tex->offset[0]=tex->offset[1]=0;
+    tex->scale[0]=tex->scale[1]=1;
+    glGenTextures(1,&(tex->name));
+    glBindTexture(GL_TEXTURE_2D,tex->name);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D,0,GL_RGB,surf->w,surf->h,0,GL_BGR,GL_UNSIGNED_BYTE,surf->pixels);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    SDL_FreeSurface(surf);
+    return(tex);
+}
 
-    /* loading texture names */
-    n=64*(md2->nTextures); md2->TexNames=malloc(n);
-    if(md2->TexNames==NULL) {
-	fprintf(stderr,"Out of memory, tex names\n"); fclose(file);
-	free(md2); return(NULL);
-    }
-    fseek(file,md2->TexOffset,SEEK_SET);
-    if(n!=fread(md2->TexNames,1,n,file)) {
-	fprintf(stderr,"Read error, tex names\n"); fclose(file);
-	free(md2->TexNames); free(md2); return(NULL);
+/* texture coordinate mapping of a model drawn with tex: coordinate = map[0..1] + uv * map[2..3]
+   for the pixel uv of the faces (faces=1) or the 0..1 uv of the glcommands. rectangle textures
+   take the pixel uv as they are, they are expected to have the size of the skin */
+
+void MD2_texture_map (struct md2_model * md2, struct md2_texture * tex, GLint faces, GLfloat * map) {
+    if(!tex || (faces && tex->target!=GL_TEXTURE_2D)) {
+	map[0]=map[1]=0; map[2]=map[3]=1;
+	return;
     }
-    
-    /* loading texture coordinates */
-    n=2*2*(md2->nTexCoords); md2->UV=malloc(n);
-    if(md2->UV==NULL) {
-	fprintf(stderr,"Out of memory, tex coo\n"); fclose(file);
-	free(md2->TexNames); free(md2); return(NULL);
+    map[0]=tex->offset[0];
+    map[1]=tex->offset[1];
+    map[2]=tex->scale[0];
+    map[3]=tex->scale[1];
+    if(!tex->target) {
+	map[2]=tex->w; map[3]=tex->h;
     }
-    fseek(file,md2->UVOffset,SEEK_SET);
-    if(n!=fread(md2->UV,1,n,file)) {
-	fprintf(stderr,"Read error, tex coo\n"); fclose(file);
-	free(md2->UV); free(md2->TexNames); free(md2); return(NULL);
+    if(faces) {
+	map[2]/=md2->TexWidth?md2->TexWidth:tex->w;
+	map[3]/=md2->TexHeight?md2->TexHeight:tex->h;
     }
+}
 
-    /* loading glcommands */
-    n=4*(md2->nGLCommands); md2->GLCmds=malloc(n);
-    if(md2->GLCmds==NULL) {
-	fprintf(stderr,"Out of memory, tex coo\n"); fclose(file);
-	free(md2->UV); free(md2->TexNames); free(md2); return(NULL);
-    }
-    fseek(file,md2->GLCmdOffset,SEEK_SET);
-    if(n!=fread(md2->GLCmds,1,n,file)) {
-	fprintf(stderr,"Read error, tex coo\n"); fclose(file);
-	free(md2->GLCmds); free(md2->UV); free(md2->TexNames); free(md2); return(NULL);
+
+
+/* the texture atlas. call on the GL thread: levels is the number of mipmap levels kept free of
+   bleeding between skins (0 for none), size the edge length of each page */
+
+struct md2_atlas * MD2_atlas_create (GLint size, GLint levels) {
+    struct md2_atlas *at;
+
+    at=calloc(1,sizeof(struct md2_atlas));
+    if(!at) {
+	fprintf(stderr,"Out of memory, atlas\n");
+	return(NULL);
     }
+    at->Size=size;
+    at->Levels=levels<0?0:levels;
+    return(at);
+}
 
-    /* loading faces */
-    n=2*6*(md2->nFaces); md2->Faces=malloc(n);
-    if(md2->Faces==NULL) {
-	fprintf(stderr,"Out of memory, faces\n"); fclose(file);
-	free(md2->GLCmds); free(md2->UV); free(md2->TexNames); free(md2); return(NULL);
+int MD2_atlas_page (struct md2_atlas * at) {
+    struct md2_atlaspage *pages,*pg;
+
+    pages=realloc(at->Pages,(at->nPages+1)*sizeof(struct md2_atlaspage));
+    if(!pages) {
+	fprintf(stderr,"Out of memory, atlas\n");
+	return(0);
     }
-    fseek(file,md2->FaceOffset,SEEK_SET);
-    if(n!=fread(md2->Faces,1,n,file)) {
-	fprintf(stderr,"Read error, faces\n"); fclose(file);
-	free(md2->Faces); free(md2->GLCmds); free(md2->UV); free(md2->TexNames); free(md2); return(NULL);
+    at->Pages=pages;
+    pg=&(at->Pages[at->nPages++]);
+    memset(pg,0,sizeof(struct md2_atlaspage));
+    glGenTextures(1,&(pg->name));
+    glBindTexture(GL_TEXTURE_2D,pg->name);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, at->Levels?GL_LINEAR_MIPMAP_LINEAR:GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, at->Levels);
+    glTexImage2D(GL_TEXTURE_2D,0,GL_RGB,at->Size,at->Size,0,GL_BGR,GL_UNSIGNED_BYTE,NULL);
+    return(1);
+}
+
+/* packs a decoded skin into the last page, or a new one when it is full. returns the region */
+
+struct md2_texture * MD2_atlas_put (struct md2_atlas * at, SDL_Surface * surf) {
+    struct md2_texture *tex,**regions;
+    struct md2_atlaspage *pg;
+    GLint g,aw,ah,x,y,sx,sy,pitch;
+    GLubyte *buf,*d,*src;
+
+    g=1<<at->Levels;
+    aw=(surf->w+g-1)/g*g+2*g;
+    ah=(surf->h+g-1)/g*g+2*g;
+    if(aw>at->Size || ah>at->Size) {
+	fprintf(stderr,"Skin of %dx%d does not fit into atlas pages of %d\n",surf->w,surf->h,at->Size);
+	return(NULL);
     }
-    
-    /* loading frames */
-    n=md2->FrameSize*md2->nFrames; frames=malloc(n);
-    if(!frames) {
-	fprintf(stderr,"Out of memory, frames (1)\n"); fclose(file);
-	free(md2->Faces); free(md2->GLCmds); free(md2->UV); free(md2->TexNames); free(md2); return(NULL);
+    pg=at->nPages?&(at->Pages[at->nPages-1]):NULL;
+    if(pg && pg->ShelfX+aw>at->Size) {
+	pg->ShelfX=0;
+	pg->ShelfY+=pg->ShelfH;
+	pg->ShelfH=0;
     }
-    fseek(file,md2->FrameOffset,SEEK_SET);
-    if(n!=fread(frames,1,n,file)) {
-	fprintf(stderr,"Read error, faces\n"); fclose(file);
-	free(frames); free(md2->Faces); free(md2->GLCmds); free(md2->UV); free(md2->TexNames); free(md2); return(NULL);
+    if(!pg || pg->ShelfY+ah>at->Size) {
+	if(!MD2_atlas_page(at)) return(NULL);
+	pg=&(at->Pages[at->nPages-1]);
     }
-    n=md2->nFrames*md2->nVertices*sizeof(struct md2_vertexd); md2->Vertex=malloc(n);
-    if(md2->Vertex==NULL) {
-	fprintf(stderr,"Out of memory, frames (2)\n"); fclose(file);
-	free(frames); free(md2->Faces); free(md2->GLCmds); free(md2->UV); free(md2->TexNames); free(md2); return(NULL);
+    tex=malloc(sizeof(struct md2_texture));
+    regions=realloc(at->Regions,(at->nRegions+1)*sizeof(struct md2_texture *));
+    pitch=(aw*3+3)&~3;
+    buf=malloc((size_t)pitch*ah);
+    if(regions) at->Regions=regions;
+    if(!tex || !regions || !buf) {
+	fprintf(stderr,"Out of memory, atlas\n");
+	free(tex); free(buf); return(NULL);
     }
-    for(n=0;n<(md2->nFrames);n++) {
-	for(c=0;c<(md2->nVertices);c++) {
-	    fh=(struct md2_frameheader *)(frames+(md2->FrameSize*n));
-	    vb=&(fh->vertex[c]);
-	    vf=&(md2->Vertex[md2->nVertices*n+c]);
-	    vf->v[0]=(((GLdouble)vb->v[0])*fh->scale[0])+fh->translate[0];
-	    vf->v[1]=(((GLdouble)vb->v[1])*fh->scale[1])+fh->translate[1];
-	    vf->v[2]=(((GLdouble)vb->v[2])*fh->scale[2])+fh->translate[2];
+
+    /* the skin with its edge pixels repeated into the gutter */
+    for(y=0;y<ah;y++) {
+	sy=y-g<0?0:y-g>=surf->h?surf->h-1:y-g;
+	src=(GLubyte *)surf->pixels+(size_t)sy*surf->pitch;
+	d=buf+(size_t)y*pitch;
+	for(x=0;x<aw;x++,d+=3) {
+	    sx=x-g<0?0:x-g>=surf->w?surf->w-1:x-g;
+	    memcpy(d,src+3*sx,3);
 	}
     }
+    glBindTexture(GL_TEXTURE_2D,pg->name);
+    glTexSubImage2D(GL_TEXTURE_2D,0,pg->ShelfX,pg->ShelfY,aw,ah,GL_BGR,GL_UNSIGNED_BYTE,buf);
+    free(buf);
 
-    free(frames);
-    fclose(file);
+    tex->w=surf->w;
+    tex->h=surf->h;
+    tex->name=pg->name;
+    tex->target=GL_TEXTURE_2D;
+    tex->offset[0]=(GLfloat)(pg->ShelfX+g)/at->Size;
+    tex->offset[1]=(GLfloat)(pg->ShelfY+g)/at->Size;
+    tex->scale[0]=(GLfloat)surf->w/at->Size;
+    tex->scale[1]=(GLfloat)surf->h/at->Size;
+    at->Regions[at->nRegions++]=tex;
+    pg->ShelfX+=aw;
+    if(ah>pg->ShelfH) pg->ShelfH=ah;
+    pg->Dirty=1;
+    return(tex);
+}
 
-    /* building vertex normals */
-    n=md2->nFrames*md2->nVertices*sizeof(struct md2_vertexd); md2->VNormal=malloc(n);
-    if(md2->VNormal==NULL) {
-	fprintf(stderr,"Out of memory, frames (2)\n");
-	free(md2->Vertex); free(md2->Faces); free(md2->GLCmds); free(md2->UV); free(md2->TexNames); free(md2); return(NULL);
-    }
-    for(n=0;n<(md2->nFrames);n++) {
-	for(c=0;c<(md2->nVertices);c++) {
-	    svf.v[0]=svf.v[1]=svf.v[2]=0; s=0;
-	    for(i=0;i<(md2->nFaces);i++) {
-		for(d=0;d<3;d++) {
-		    if(((&(md2->Faces[i]))->point[d])==c) {
-		    	avf=&(md2->Vertex[(&(md2->Faces[i]))->point[0]+(n*(md2->nVertices))]);
-		    	bvf=&(md2->Vertex[(&(md2->Faces[i]))->point[1]+(n*(md2->nVertices))]);
-		    	cvf=&(md2->Vertex[(&(md2->Faces[i]))->point[2]+(n*(md2->nVertices))]);
-			MD2_calc_normal(avf,bvf,cvf,&rvf);
-			svf.v[0]+=rvf.v[0];
-			svf.v[1]+=rvf.v[1];
-			svf.v[2]+=rvf.v[2];
-			s++;
-		    }
-		}
-	    }
-	    svf.v[0]/=((GLdouble)s);
-	    svf.v[1]/=((GLdouble)s);
-	    svf.v[2]/=((GLdouble)s);
-	    MD2_normalize(&svf);
-	    (&(md2->VNormal[c+(n*(md2->nVertices))]))->v[0]=svf.v[0];
-	    (&(md2->VNormal[c+(n*(md2->nVertices))]))->v[1]=svf.v[1];
-	    (&(md2->VNormal[c+(n*(md2->nVertices))]))->v[2]=svf.v[2];
-	}
-    }
-
-    /* building face normals */
-    n=md2->nFrames*md2->nFaces*sizeof(struct md2_vertexd); md2->FNormal=malloc(n);
-    if(md2->FNormal==NULL) {
-        fprintf(stderr,"Out of memory, frames (2)\n");
-        free(md2->VNormal); free(md2->Vertex); free(md2->Faces); free(md2->GLCmds); free(md2->UV); free(md2->TexNames); free(md2); return(NULL);
-    }
-    for(n=0;n<(md2->nFrames);n++) {
-        for(i=0;i<(md2->nFaces);i++) {
-            avf=&(md2->Vertex[(&(md2->Faces[i]))->point[0]+(n*(md2->nVertices))]);
-            bvf=&(md2->Vertex[(&(md2->Faces[i]))->point[1]+(n*(md2->nVertices))]);
-            cvf=&(md2->Vertex[(&(md2->Faces[i]))->point[2]+(n*(md2->nVertices))]);
-            MD2_calc_normal(avf,bvf,cvf,&rvf);
-            (&(md2->FNormal[i+(n*(md2->nFaces))]))->v[0]=rvf.v[0];
-            (&(md2->FNormal[i+(n*(md2->nFaces))]))->v[1]=rvf.v[1];
-            (&(md2->FNormal[i+(n*(md2->nFaces))]))->v[2]=rvf.v[2];
-        }
-    }
+/* adds an image file to the atlas. the region shares the GL texture of its page, it belongs to
+   the atlas and must not be freed with MD2_freetexture */
 
-    return(md2);
+struct md2_texture * MD2_atlas_add (struct md2_atlas * at, GLubyte * fn) {
+    struct md2_texture *tex;
+    SDL_Surface *surf;
+
+    if(!(surf=MD2_decodetexture(fn))) return(NULL);
+    tex=MD2_atlas_put(at,surf);
+    SDL_FreeSurface(surf);
+    return(tex);
 }
 
+/* adds every skin the model file names, looked up by their file name in dir. skins gets
+   nTextures regions, NULL for skins that could not be loaded. returns the number added */
 
+int MD2_atlas_add_skins (struct md2_atlas * at, struct md2_model * md2, GLubyte * dir, struct md2_texture ** skins) {
+    GLubyte name[64],*base,*path;
+    GLint c,n;
 
-/* different render functions, average normals means the average of per vertex and per face normals */
+    n=0;
+    for(c=0;c<(md2->nTextures);c++) {
+	memcpy(name,md2->TexNames+64*c,64);
+	name[63]=0;
+	base=strrchr(name,'/');
+	base=base?base+1:name;
+	skins[c]=NULL;
+	if(!(path=malloc(strlen(dir)+strlen(base)+2))) {
+	    fprintf(stderr,"Out of memory, atlas\n");
+	    continue;
+	}
+	sprintf(path,"%s/%s",dir,base);
+	if((skins[c]=MD2_atlas_add(at,path))) n++;
+	free(path);
+    }
+    return(n);
+}
 
-int MD2_display_average_normals (struct md2_model * md2, struct md2_texture * tex, GLint sf, GLint ef, GLdouble s, struct md2_boundingbox * bb) {
-    GLint n,c;
-    struct md2_vertexd *svf,*evf,*snf,*enf,*saf,*eaf,mv,nv,av;
+/* builds the mipmaps of the pages changed since the last call, after adding skins */
+
+int MD2_atlas_finish (struct md2_atlas * at) {
+    GLint c;
+
+    for(c=0;c<(at->nPages);c++) {
+	if(!at->Pages[c].Dirty) continue;
+	if(at->Levels) {
+	    glBindTexture(GL_TEXTURE_2D,at->Pages[c].name);
+	    glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	at->Pages[c].Dirty=0;
+    }
+    return(1);
+}
+
+int MD2_atlas_free (struct md2_atlas * at) {
+    GLint c;
+
+    for(c=0;c<(at->nPages);c++) glDeleteTextures(1,&(at->Pages[c].name));
+    for(c=0;c<(at->nRegions);c++) free(at->Regions[c]);
+    free(at->Pages); free(at->Regions); free(at);
+    return(1);
+}
+
+
+
+/* block compression of skins into BC1 (DXT1) or BC3 (DXT5). done offline with md2skin, so the
+   loader only maps the file and hands the blocks to glCompressedTexImage2D. the encoder fits
+   the endpoints to the principal axis of the block colors, pulled in by 1/16 of their range */
+
+GLushort MD2_bc_565 (GLfloat * c) {
+    GLint r,g,b;
+
+    r=c[0]*31/255+0.5; g=c[1]*63/255+0.5; b=c[2]*31/255+0.5;
+    r=r<0?0:r>31?31:r; g=g<0?0:g>63?63:g; b=b<0?0:b>31?31:b;
+    return(r<<11|g<<5|b);
+}
+
+void MD2_bc_888 (GLushort c, GLint * rgb) {
+    rgb[0]=(c>>11&31)<<3|(c>>11&31)>>2;
+    rgb[1]=(c>>5&63)<<2|(c>>5&63)>>4;
+    rgb[2]=(c&31)<<3|(c&31)>>2;
+}
+
+/* the four colors of a color block, three and black if c0<=c1 and the block allows it */
+
+void MD2_bc_palette (GLushort c0, GLushort c1, GLint three, GLint pal[4][4]) {
+    GLint c;
+
+    MD2_bc_888(c0,pal[0]);
+    MD2_bc_888(c1,pal[1]);
+    for(c=0;c<3;c++) {
+	if(three && c0<=c1) {
+	    pal[2][c]=(pal[0][c]+pal[1][c])/2;
+	    pal[3][c]=0;
+	} else {
+	    pal[2][c]=(2*pal[0][c]+pal[1][c])/3;
+	    pal[3][c]=(pal[0][c]+2*pal[1][c])/3;
+	}
+    }
+    pal[0][3]=pal[1][3]=pal[2][3]=255;
+    pal[3][3]=three && c0<=c1?0:255;
+}
+
+/* indices of 16 rgba pixels for the endpoints c0>c1, returns the squared error */
+
+GLuint MD2_bc_indices (GLubyte * px, GLushort c0, GLushort c1, GLuint * bits) {
+    GLint i,k,d,best,idx,pal[4][4];
+    GLuint err;
+
+    MD2_bc_palette(c0,c1,0,pal);
+    *bits=err=0;
+    for(i=0;i<16;i++) {
+	best=1<<30; idx=0;
+	for(k=0;k<4;k++) {
+	    d=(px[4*i]-pal[k][0])*(px[4*i]-pal[k][0])+(px[4*i+1]-pal[k][1])*(px[4*i+1]-pal[k][1])+(px[4*i+2]-pal[k][2])*(px[4*i+2]-pal[k][2]);
+	    if(d<best) {
+		best=d; idx=k;
+	    }
+	}
+	*bits|=(GLuint)idx<<(2*i);
+	err+=best;
+    }
+    return(err);
+}
+
+/* encodes the colors of 16 rgba pixels into 8 bytes. the endpoints are then refit by least
+   squares to the chosen indices once and kept if that lowers the error */
+
+void MD2_bc_color (GLubyte * px, GLubyte * out) {
+    static const GLfloat w0[4]={1,0,2.0/3,1.0/3};
+    GLfloat mean[3],cov[6],axis[3],v[3],e0[3],e1[3],t,lo,hi,len,aa,ab,bb,det,ax[3],bx[3];
+    GLint c,i,k;
+    GLushort c0,c1,r0,r1;
+    GLuint bits,rbits,err;
+
+    mean[0]=mean[1]=mean[2]=0;
+    for(i=0;i<16;i++) for(c=0;c<3;c++) mean[c]+=px[4*i+c]/16.0;
+    for(c=0;c<6;c++) cov[c]=0;
+    for(i=0;i<16;i++) {
+	for(c=0;c<3;c++) v[c]=px[4*i+c]-mean[c];
+	cov[0]+=v[0]*v[0]; cov[1]+=v[0]*v[1]; cov[2]+=v[0]*v[2];
+	cov[3]+=v[1]*v[1]; cov[4]+=v[1]*v[2]; cov[5]+=v[2]*v[2];
+    }
+    axis[0]=axis[1]=axis[2]=1;
+    for(k=0;k<8;k++) {
+	v[0]=cov[0]*axis[0]+cov[1]*axis[1]+cov[2]*axis[2];
+	v[1]=cov[1]*axis[0]+cov[3]*axis[1]+cov[4]*axis[2];
+	v[2]=cov[2]*axis[0]+cov[4]*axis[1]+cov[5]*axis[2];
+	len=sqrt(v[0]*v[0]+v[1]*v[1]+v[2]*v[2]);
+	if(len<1e-6) break;
+	for(c=0;c<3;c++) axis[c]=v[c]/len;
+    }
+    lo=FLT_MAX; hi=-FLT_MAX;
+    for(i=0;i<16;i++) {
+	t=(px[4*i]-mean[0])*axis[0]+(px[4*i+1]-mean[1])*axis[1]+(px[4*i+2]-mean[2])*axis[2];
+	if(t<lo) lo=t;
+	if(t>hi) hi=t;
+    }
+    t=(hi-lo)/16; lo+=t; hi-=t;
+    for(c=0;c<3;c++) {
+	e0[c]=mean[c]+axis[c]*hi;
+	e1[c]=mean[c]+axis[c]*lo;
+    }
+    c0=MD2_bc_565(e0);
+    c1=MD2_bc_565(e1);
+    if(c0<c1) {
+	k=c0; c0=c1; c1=k;
+    }
+    bits=0;
+    if(c0!=c1) {
+	err=MD2_bc_indices(px,c0,c1,&bits);
+	aa=ab=bb=0;
+	for(c=0;c<3;c++) ax[c]=bx[c]=0;
+	for(i=0;i<16;i++) {
+	    t=w0[bits>>(2*i)&3];
+	    aa+=t*t; ab+=t*(1-t); bb+=(1-t)*(1-t);
+	    for(c=0;c<3;c++) {
+		ax[c]+=t*px[4*i+c];
+		bx[c]+=(1-t)*px[4*i+c];
+	    }
+	}
+	det=aa*bb-ab*ab;
+	if(fabs(det)>1e-6) {
+	    for(c=0;c<3;c++) {
+		e0[c]=(ax[c]*bb-bx[c]*ab)/det;
+		e1[c]=(bx[c]*aa-ax[c]*ab)/det;
+	    }
+	    r0=MD2_bc_565(e0);
+	    r1=MD2_bc_565(e1);
+	    if(r0<r1) {
+		k=r0; r0=r1; r1=k;
+	    }
+	    if(r0!=r1 && MD2_bc_indices(px,r0,r1,&rbits)<err) {
+		c0=r0; c1=r1; bits=rbits;
+	    }
+	}
+    }
+    out[0]=c0; out[1]=c0>>8; out[2]=c1; out[3]=c1>>8;
+    out[4]=bits; out[5]=bits>>8; out[6]=bits>>16; out[7]=bits>>24;
+}
+
+/* the eight alphas of an alpha block, a0>a1 always holds for blocks this encoder writes */
+
+void MD2_bc_alphas (GLint a0, GLint a1, GLint * pal) {
+    GLint k;
+
+    pal[0]=a0; pal[1]=a1;
+    for(k=2;k<8;k++) {
+	if(a0>a1) pal[k]=((8-k)*a0+(k-1)*a1)/7;
+	else pal[k]=k<6?((6-k)*a0+(k-1)*a1)/5:k==6?0:255;
+    }
+}
+
+void MD2_bc_alpha (GLubyte * px, GLubyte * out) {
+    GLint i,k,a0,a1,d,best,idx,pal[8];
+    unsigned long long bits;
+
+    a0=0; a1=255;
+    for(i=0;i<16;i++) {
+	if(px[4*i+3]>a0) a0=px[4*i+3];
+	if(px[4*i+3]<a1) a1=px[4*i+3];
+    }
+    bits=0;
+    if(a0!=a1) {
+	MD2_bc_alphas(a0,a1,pal);
+	for(i=0;i<16;i++) {
+	    best=1<<30; idx=0;
+	    for(k=0;k<8;k++) {
+		d=abs(px[4*i+3]-pal[k]);
+		if(d<best) {
+		    best=d; idx=k;
+		}
+	    }
+	    bits|=(unsigned long long)idx<<(3*i);
+	}
+    }
+    out[0]=a0; out[1]=a1;
+    for(i=0;i<6;i++) out[2+i]=bits>>(8*i);
+}
+
+/* 16 rgba pixels of a block */
+
+void MD2_bc_decode (GLint format, GLubyte * block, GLubyte * px) {
+    GLint i,c,pal[4][4],alpha[8];
+    GLuint bits;
+    unsigned long long abits;
+
+    if(format==MD2B_BC3) {
+	MD2_bc_alphas(block[0],block[1],alpha);
+	abits=0;
+	for(i=0;i<6;i++) abits|=(unsigned long long)block[2+i]<<(8*i);
+	block+=8;
+    }
+    MD2_bc_palette(block[0]|block[1]<<8,block[2]|block[3]<<8,format==MD2B_BC1,pal);
+    bits=block[4]|block[5]<<8|block[6]<<16|(GLuint)block[7]<<24;
+    for(i=0;i<16;i++) {
+	for(c=0;c<4;c++) px[4*i+c]=pal[bits>>(2*i)&3][c];
+	if(format==MD2B_BC3) px[4*i+3]=alpha[abits>>(3*i)&7];
+    }
+}
+
+GLuint MD2_bc_size (GLint format, GLint w, GLint h) {
+    return(((w+3)/4)*((h+3)/4)*(format==MD2B_BC1?8:16));
+}
+
+/* one level, the blocks at the right and bottom edge repeat the last column and row */
+
+void MD2_bc_encode_level (GLubyte * rgba, GLint w, GLint h, GLint format, GLubyte * out) {
+    GLubyte px[64];
+    GLint bx,by,x,y,sx,sy;
+
+    for(by=0;by<h;by+=4) {
+	for(bx=0;bx<w;bx+=4) {
+	    for(y=0;y<4;y++) {
+		sy=by+y<h?by+y:h-1;
+		for(x=0;x<4;x++) {
+		    sx=bx+x<w?bx+x:w-1;
+		    memcpy(px+4*(4*y+x),rgba+4*((size_t)sy*w+sx),4);
+		}
+	    }
+	    if(format==MD2B_BC3) {
+		MD2_bc_alpha(px,out);
+		out+=8;
+	    }
+	    MD2_bc_color(px,out);
+	    out+=8;
+	}
+    }
+}
+
+void MD2_bc_decode_level (GLubyte * blocks, GLint w, GLint h, GLint format, GLubyte * rgba) {
+    GLubyte px[64];
+    GLint bx,by,x,y;
+
+    for(by=0;by<h;by+=4) {
+	for(bx=0;bx<w;bx+=4) {
+	    MD2_bc_decode(format,blocks,px);
+	    blocks+=format==MD2B_BC1?8:16;
+	    for(y=0;y<4 && by+y<h;y++) {
+		for(x=0;x<4 && bx+x<w;x++) memcpy(rgba+4*((size_t)(by+y)*w+bx+x),px+4*(4*y+x),4);
+	    }
+	}
+    }
+}
+
+/* next smaller mipmap level by a 2x2 box filter */
+
+void MD2_bc_halve (GLubyte * src, GLint w, GLint h, GLubyte * dst) {
+    GLint x,y,c,nw,nh,x1,y1;
+
+    nw=w>1?w/2:1; nh=h>1?h/2:1;
+    for(y=0;y<nh;y++) {
+	y1=2*y+1<h?2*y+1:2*y;
+	for(x=0;x<nw;x++) {
+	    x1=2*x+1<w?2*x+1:2*x;
+	    for(c=0;c<4;c++) {
+		dst[4*(y*nw+x)+c]=(src[4*(2*y*w+2*x)+c]+src[4*(2*y*w+x1)+c]+src[4*(y1*w+2*x)+c]+src[4*(y1*w+x1)+c]+2)/4;
+	    }
+	}
+    }
+}
+
+/* writes w x h rgba pixels with their whole mip chain as a compressed skin file */
+
+int MD2_bc_encodefile (GLubyte * rgba, GLint w, GLint h, GLint format, GLubyte * fn) {
+    struct md2_bcheader hd;
+    GLubyte *cur,*next,*blocks;
+    GLint l,lw,lh,ok;
+    FILE *file;
+
+    if(w<1 || h<1 || (format!=MD2B_BC1 && format!=MD2B_BC3)) {
+	fprintf(stderr,"Cannot encode %dx%d, format %d\n",w,h,format);
+	return(0);
+    }
+    memset(&hd,0,sizeof(hd));
+    hd.Ident=MD2B_IDENT;
+    hd.Version=MD2B_VERSION;
+    hd.Format=format;
+    hd.Width=w;
+    hd.Height=h;
+    for(lw=w,lh=h;;lw=lw>1?lw/2:1,lh=lh>1?lh/2:1) {
+	hd.Offset[hd.nLevels]=hd.nLevels?hd.Offset[hd.nLevels-1]+hd.Size[hd.nLevels-1]:sizeof(hd);
+	hd.Size[hd.nLevels]=MD2_bc_size(format,lw,lh);
+	hd.nLevels++;
+	if((lw==1 && lh==1) || hd.nLevels==MD2B_MAXLEVELS) break;
+    }
+    cur=malloc((size_t)w*h*4);
+    next=malloc((size_t)(w>1?w/2:1)*(h>1?h/2:1)*4);
+    blocks=malloc(hd.Size[0]);
+    if(!cur || !next || !blocks) {
+	fprintf(stderr,"Out of memory, compressed texture\n");
+	free(cur); free(next); free(blocks); return(0);
+    }
+    if(!(file=fopen(fn,"wb"))) {
+	fprintf(stderr,"Cannot write %s\n",fn);
+	free(cur); free(next); free(blocks); return(0);
+    }
+    memcpy(cur,rgba,(size_t)w*h*4);
+    ok=fwrite(&hd,sizeof(hd),1,file)==1;
+    for(l=0,lw=w,lh=h;l<hd.nLevels && ok;l++) {
+	MD2_bc_encode_level(cur,lw,lh,format,blocks);
+	ok=fwrite(blocks,hd.Size[l],1,file)==1;
+	MD2_bc_halve(cur,lw,lh,next);
+	lw=lw>1?lw/2:1; lh=lh>1?lh/2:1;
+	memcpy(cur,next,(size_t)lw*lh*4);
+    }
+    if(fclose(file)) ok=0;
+    if(!ok) fprintf(stderr,"Write error, %s\n",fn);
+    free(cur); free(next); free(blocks);
+    return(ok);
+}
+
+/* 1 if GL_EXT_texture_compression_s3tc is present, checked on first use. set it to 0 to
+   decode the blocks on the cpu instead */
+
+GLint MD2_s3tc=-1;
+
+/* loads a skin written by MD2_bc_encodefile as a mipmapped GL_TEXTURE_2D. the blocks go to the
+   GL as they are in the file, without the extension they are decoded and uploaded as rgb(a) */
+
+struct md2_texture * MD2_loadtexture_compressed (GLubyte * fn) {
+    struct md2_bcheader *hd;
+    struct md2_texture *tex;
+    struct stat st;
+    const GLubyte *ext;
+    GLubyte *map,*rgba;
+    GLint fd,l,lw,lh,ok;
+
+    fd=open(fn,O_RDONLY);
+    if(fd<0) {
+	fprintf(stderr,"Cannot load %s\n",fn);
+	return(NULL);
+    }
+    if(fstat(fd,&st) || st.st_size<sizeof(struct md2_bcheader)) {
+	fprintf(stderr,"Invalid compressed texture %s\n",fn);
+	close(fd); return(NULL);
+    }
+    map=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(map==MAP_FAILED) {
+	fprintf(stderr,"Cannot map %s\n",fn);
+	return(NULL);
+    }
+    hd=(struct md2_bcheader *)map;
+    ok=hd->Ident==MD2B_IDENT && hd->Version==MD2B_VERSION && (hd->Format==MD2B_BC1 || hd->Format==MD2B_BC3)
+	&& hd->Width && hd->Height && hd->nLevels && hd->nLevels<=MD2B_MAXLEVELS;
+    for(l=0,lw=hd->Width,lh=hd->Height;ok && l<hd->nLevels;l++,lw=lw>1?lw/2:1,lh=lh>1?lh/2:1) {
+	ok=hd->Size[l]==MD2_bc_size(hd->Format,lw,lh) && hd->Offset[l]<=st.st_size && hd->Size[l]<=st.st_size-hd->Offset[l];
+    }
+    if(!ok || !(tex=malloc(sizeof(struct md2_texture)))) {
+	fprintf(stderr,ok?"Out of memory, texture\n":"Invalid compressed texture %s\n",fn);
+	munmap(map,st.st_size); return(NULL);
+    }
+    if(MD2_s3tc<0) {
+	ext=glGetString(GL_EXTENSIONS);
+	MD2_s3tc=ext && strstr(ext,"GL_EXT_texture_compression_s3tc");
+    }
+    tex->w=hd->Width;
+    tex->h=hd->Height;
+    tex->target=GL_TEXTURE_2D;
+    tex->offset[0]=tex->offset[1]=0;
+    tex->scale[0]=tex->scale[1]=1;
+    glGenTextures(1,&(tex->name));
+    glBindTexture(GL_TEXTURE_2D,tex->name);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, hd->nLevels>1?GL_LINEAR_MIPMAP_LINEAR:GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hd->nLevels-1);
+    for(l=0,lw=hd->Width,lh=hd->Height;l<hd->nLevels;l++,lw=lw>1?lw/2:1,lh=lh>1?lh/2:1) {
+	if(MD2_s3tc) {
+	    glCompressedTexImage2D(GL_TEXTURE_2D,l,hd->Format==MD2B_BC1?GL_COMPRESSED_RGB_S3TC_DXT1_EXT:GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+		lw,lh,0,hd->Size[l],map+hd->Offset[l]);
+	} else if((rgba=malloc((size_t)lw*lh*4))) {
+	    MD2_bc_decode_level(map+hd->Offset[l],lw,lh,hd->Format,rgba);
+	    glTexImage2D(GL_TEXTURE_2D,l,hd->Format==MD2B_BC1?GL_RGB:GL_RGBA,lw,lh,0,GL_RGBA,GL_UNSIGNED_BYTE,rgba);
+	    free(rgba);
+	} else {
+	    fprintf(stderr,"Out of memory, texture\n");
+	}
+    }
+    munmap(map,st.st_size);
+    return(tex);
+}
+
+
+
+/* asynchronous texture loading. worker threads decode and convert the images, the GL thread
+   calls MD2_texloader_upload once per frame to stream decoded pixels into their textures
+   through a ring of pixel buffer objects, no more than the budget per call. a texture being
+   uploaded is continued by the next call where the budget cut it off */
+
+void * MD2_texloader_worker (void * arg) {
+    struct md2_texloader *tl;
+    struct md2_texrequest *r;
+    SDL_Surface *surf;
+
+    tl=arg;
+    pthread_mutex_lock(&(tl->Lock));
+    for(;;) {
+	while(!tl->Decode && !tl->Quit) pthread_cond_wait(&(tl->Wake),&(tl->Lock));
+	if(tl->Quit) break;
+	r=tl->Decode;
+	if(!(tl->Decode=r->Next)) tl->DecodeLast=NULL;
+	pthread_mutex_unlock(&(tl->Lock));
+	surf=MD2_decodetexture(r->Path);
+	pthread_mutex_lock(&(tl->Lock));
+	if(surf) {
+	    r->Surface=surf;
+	    r->State=MD2T_DECODED;
+	    r->Next=NULL;
+	    if(tl->UploadLast) tl->UploadLast->Next=r; else tl->Upload=r;
+	    tl->UploadLast=r;
+	} else {
+	    r->State=MD2T_FAILED;
+	}
+	pthread_cond_broadcast(&(tl->Done));
+    }
+    pthread_mutex_unlock(&(tl->Lock));
+    return(NULL);
+}
+
+/* call on the GL thread. threads decode in parallel, pbos is the length of the buffer ring
+   (0 for MD2T_PBOS), budget the bytes per MD2_texloader_upload (0 means no limit) */
+
+struct md2_texloader * MD2_texloader_create (GLint threads, GLint pbos, size_t budget) {
+    struct md2_texloader *tl;
+    GLint c;
+
+    tl=calloc(1,sizeof(struct md2_texloader));
+    if(!tl) {
+	fprintf(stderr,"Out of memory, texture loader\n");
+	return(NULL);
+    }
+    tl->nThreads=threads<1?1:threads;
+    tl->nPBOs=pbos<1?MD2T_PBOS:pbos;
+    tl->Budget=budget;
+    tl->Threads=malloc(tl->nThreads*sizeof(pthread_t));
+    tl->PBOs=malloc(tl->nPBOs*sizeof(GLuint));
+    if(!tl->Threads || !tl->PBOs) {
+	fprintf(stderr,"Out of memory, texture loader\n");
+	free(tl->Threads); free(tl->PBOs); free(tl); return(NULL);
+    }
+    glGenBuffers(tl->nPBOs,tl->PBOs);
+    pthread_mutex_init(&(tl->Lock),NULL);
+    pthread_cond_init(&(tl->Wake),NULL);
+    pthread_cond_init(&(tl->Done),NULL);
+    for(c=0;c<(tl->nThreads);c++) {
+	if(pthread_create(&(tl->Threads[c]),NULL,MD2_texloader_worker,tl)) {
+	    fprintf(stderr,"Cannot create texture loader thread\n");
+	    tl->nThreads=c;
+	    break;
+	}
+    }
+    if(!tl->nThreads) {
+	pthread_cond_destroy(&(tl->Done)); pthread_cond_destroy(&(tl->Wake)); pthread_mutex_destroy(&(tl->Lock));
+	glDeleteBuffers(tl->nPBOs,tl->PBOs);
+	free(tl->Threads); free(tl->PBOs); free(tl); return(NULL);
+    }
+    return(tl);
+}
+
+/* queues an image file for decoding, from any thread. the returned handle is polled with
+   MD2_texrequest_state or waited for with MD2_texrequest_wait */
+
+struct md2_texrequest * MD2_texloader_load (struct md2_texloader * tl, GLubyte * fn) {
+    struct md2_texrequest *r;
+
+    r=calloc(1,sizeof(struct md2_texrequest));
+    if(!r || !(r->Path=malloc(strlen(fn)+1))) {
+	fprintf(stderr,"Out of memory, texture request\n");
+	free(r); return(NULL);
+    }
+    strcpy(r->Path,fn);
+    r->State=MD2T_QUEUED;
+    pthread_mutex_lock(&(tl->Lock));
+    if(tl->DecodeLast) tl->DecodeLast->Next=r; else tl->Decode=r;
+    tl->DecodeLast=r;
+    pthread_cond_signal(&(tl->Wake));
+    pthread_mutex_unlock(&(tl->Lock));
+    return(r);
+}
+
+/* uploads rows of a decoded request, one pixel buffer of the ring per chunk, until left runs
+   out. some progress is always made if force is set. returns 1 when the texture is complete,
+   0 when left ran out first, -1 if the texture could not be allocated */
+
+int MD2_texrequest_stream (struct md2_texloader * tl, struct md2_texrequest * r, size_t * left, GLint force) {
+    SDL_Surface *surf;
+    GLint rows;
+    size_t bytes;
+    void *p;
+
+    surf=r->Surface;
+    if(!r->Texture) {
+	if(!(r->Texture=malloc(sizeof(struct md2_texture)))) {
+	    fprintf(stderr,"Out of memory, texture\n");
+	    return(-1);
+	}
+	MD2_texture_create(r->Texture,surf->w,surf->h,NULL);
+    }
+    glBindTexture(GL_TEXTURE_RECTANGLE_NV,r->Texture->name);
+    while(r->Row<surf->h) {
+	rows=*left/surf->pitch;
+	if(!rows && !force) return(0);
+	if(!rows) rows=1;
+	if(rows>surf->h-r->Row) rows=surf->h-r->Row;
+	bytes=(size_t)rows*surf->pitch;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER,tl->PBOs[tl->NextPBO]);
+	tl->NextPBO=(tl->NextPBO+1)%tl->nPBOs;
+	glBufferData(GL_PIXEL_UNPACK_BUFFER,bytes,NULL,GL_STREAM_DRAW);
+	p=glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,0,bytes,GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT);
+	if(p) {
+	    memcpy(p,(GLubyte *)surf->pixels+(size_t)r->Row*surf->pitch,bytes);
+	    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	} else {
+	    glBufferSubData(GL_PIXEL_UNPACK_BUFFER,0,bytes,(GLubyte *)surf->pixels+(size_t)r->Row*surf->pitch);
+	}
+	glTexSubImage2D(GL_TEXTURE_RECTANGLE_NV,0,0,r->Row,surf->w,rows,GL_BGR,GL_UNSIGNED_BYTE,(void *)0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER,0);
+	r->Row+=rows;
+	*left-=bytes<*left?bytes:*left;
+	tl->Uploaded+=bytes;
+	force=0;
+    }
+    SDL_FreeSurface(surf);
+    r->Surface=NULL;
+    return(1);
+}
+
+/* call once per frame on the GL thread, returns the number of textures completed */
+
+int MD2_texloader_upload (struct md2_texloader * tl) {
+    struct md2_texrequest *r;
+    size_t left;
+    GLint n,force,done;
+
+    left=tl->Budget?tl->Budget:(size_t)-1;
+    n=0; force=1;
+    pthread_mutex_lock(&(tl->Lock));
+    while((r=tl->Upload)) {
+	pthread_mutex_unlock(&(tl->Lock));
+	if(!(done=MD2_texrequest_stream(tl,r,&left,force))) return(n);
+	force=0;
+	/* a failed request leaves the queue too, it would block the ones behind it */
+	if(done<0) {
+	    SDL_FreeSurface(r->Surface);
+	    r->Surface=NULL;
+	}
+	pthread_mutex_lock(&(tl->Lock));
+	if(!(tl->Upload=r->Next)) tl->UploadLast=NULL;
+	if(done<0) r->State=MD2T_FAILED;
+	else { r->State=MD2T_READY; n++; }
+	pthread_cond_broadcast(&(tl->Done));
+    }
+    pthread_mutex_unlock(&(tl->Lock));
+    return(n);
+}
+
+GLint MD2_texrequest_state (struct md2_texloader * tl, struct md2_texrequest * r) {
+    GLint state;
+
+    pthread_mutex_lock(&(tl->Lock));
+    state=r->State;
+    pthread_mutex_unlock(&(tl->Lock));
+    return(state);
+}
+
+/* blocks until the image is decoded and uploads it at once, ignoring the budget. call on the
+   GL thread. returns the texture or NULL if loading failed */
+
+struct md2_texture * MD2_texrequest_wait (struct md2_texloader * tl, struct md2_texrequest * r) {
+    struct md2_texrequest **p;
+    size_t left;
+
+    pthread_mutex_lock(&(tl->Lock));
+    while(r->State==MD2T_QUEUED) pthread_cond_wait(&(tl->Done),&(tl->Lock));
+    if(r->State==MD2T_DECODED) {
+	for(p=&(tl->Upload);*p!=r;p=&((*p)->Next));
+	*p=r->Next;
+	if(tl->UploadLast==r) {
+	    for(tl->UploadLast=tl->Upload;tl->UploadLast && tl->UploadLast->Next;tl->UploadLast=tl->UploadLast->Next);
+	}
+	pthread_mutex_unlock(&(tl->Lock));
+	left=(size_t)-1;
+	if(MD2_texrequest_stream(tl,r,&left,1)<1) {
+	    SDL_FreeSurface(r->Surface);
+	    r->Surface=NULL;
+	    pthread_mutex_lock(&(tl->Lock));
+	    r->State=MD2T_FAILED;
+	} else {
+	    pthread_mutex_lock(&(tl->Lock));
+	    r->State=MD2T_READY;
+	}
+	pthread_cond_broadcast(&(tl->Done));
+    }
+    pthread_mutex_unlock(&(tl->Lock));
+    return(r->State==MD2T_READY?r->Texture:NULL);
+}
+
+/* frees a request that is ready or failed. the texture belongs to the caller from then on,
+   free it with MD2_freetexture */
+
+int MD2_texrequest_free (struct md2_texrequest * r) {
+    free(r->Path);
+    free(r);
+    return(1);
+}
+
+/* stops the workers, on the GL thread. requests still queued or uploading fail, their
+   handles stay valid for MD2_texrequest_free */
+
+int MD2_texloader_free (struct md2_texloader * tl) {
+    struct md2_texrequest *r;
+    GLint c;
+
+    pthread_mutex_lock(&(tl->Lock));
+    tl->Quit=1;
+    pthread_cond_broadcast(&(tl->Wake));
+    pthread_mutex_unlock(&(tl->Lock));
+    for(c=0;c<(tl->nThreads);c++) pthread_join(tl->Threads[c],NULL);
+    for(r=tl->Decode;r;r=r->Next) r->State=MD2T_FAILED;
+    for(r=tl->Upload;r;r=r->Next) {
+	SDL_FreeSurface(r->Surface);
+	r->Surface=NULL;
+	if(r->Texture) {
+	    glDeleteTextures(1,&(r->Texture->name));
+	    free(r->Texture);
+	    r->Texture=NULL;
+	}
+	r->State=MD2T_FAILED;
+    }
+    glDeleteBuffers(tl->nPBOs,tl->PBOs);
+    pthread_cond_destroy(&(tl->Done));
+    pthread_cond_destroy(&(tl->Wake));
+    pthread_mutex_destroy(&(tl->Lock));
+    free(tl->Threads); free(tl->PBOs); free(tl);
+    return(1);
+}
+
+
+
+/* model memory, see md2_arena. MD2_arena_alloc carves from the blocks, MD2_arena_drop frees
+   what did not come from them, MD2_arena_free releases all blocks and the model with them */
+
+struct md2_arena * MD2_arena_block (struct md2_allocator * al, size_t size) {
+    struct md2_arena *a;
+
+    size=MD2_ALIGNUP(sizeof(struct md2_arena))+MD2_ALIGNUP(size);
+    if(al && al->alloc) a=al->alloc(size,MD2_ARENAALIGN,al->user);
+    else a=aligned_alloc(MD2_ARENAALIGN,size);
+    if(!a) return(NULL);
+    memset(a,0,sizeof(struct md2_arena));
+    a->Size=size;
+    a->Used=MD2_ALIGNUP(sizeof(struct md2_arena));
+    if(al) a->Allocator=*al;
+    return(a);
+}
+
+/* makes sure one block has size bytes left, adding a block if none has */
+
+int MD2_arena_reserve (struct md2_model * md2, size_t size) {
+    struct md2_arena *a;
+
+    for(a=md2->Arena;;a=a->Next) {
+	if(a->Size-a->Used>=MD2_ALIGNUP(size)) return(1);
+	if(!a->Next) break;
+    }
+    if(!(a->Next=MD2_arena_block(&(md2->Arena->Allocator),size))) {
+	fprintf(stderr,"Out of memory, arena\n");
+	return(0);
+    }
+    return(1);
+}
+
+void * MD2_arena_alloc (struct md2_model * md2, size_t size) {
+    struct md2_arena *a;
+    void *p;
+
+    if(!MD2_arena_reserve(md2,size)) return(NULL);
+    for(a=md2->Arena;a->Size-a->Used<MD2_ALIGNUP(size);a=a->Next);
+    p=(GLubyte *)a+a->Used;
+    a->Used+=MD2_ALIGNUP(size);
+    return(p);
+}
+
+GLint MD2_arena_owns (struct md2_model * md2, void * p) {
+    struct md2_arena *a;
+
+    for(a=md2->Arena;a;a=a->Next) {
+	if((GLubyte *)p>=(GLubyte *)a && (GLubyte *)p<(GLubyte *)a+a->Size) return(1);
+    }
+    return(0);
+}
+
+/* frees p unless it lives in the arena, where it stays until the model is freed */
+
+void MD2_arena_drop (struct md2_model * md2, void * p) {
+    if(p && !MD2_arena_owns(md2,p)) free(p);
+}
+
+void MD2_arena_free (struct md2_model * md2) {
+    struct md2_allocator al;
+    struct md2_arena *a,*next;
+
+    al=md2->Arena->Allocator;
+    for(a=md2->Arena;a;a=next) {
+	next=a->Next;
+	if(al.alloc) al.release(a,al.user); else free(a);
+    }
+}
+
+/* bytes of the expanded frames, the adjacency and the boxes as MD2_expandframes allocates
+   them for precision and flags */
+
+size_t MD2_arena_frames (struct md2_model * md2, GLint precision, GLint flags) {
+    size_t nv,nf,pv,pn,size;
+
+    nv=(size_t)md2->nFrames*md2->nVertices;
+    nf=(size_t)md2->nFrames*md2->nFaces;
+    if(precision!=MD2P_FLOAT && precision!=MD2P_SNORM16) precision=MD2P_DOUBLE;
+    pv=precision==MD2P_DOUBLE?sizeof(struct md2_vertexd):3*sizeof(GLfloat);
+    pn=precision==MD2P_DOUBLE?sizeof(struct md2_vertexd):precision==MD2P_FLOAT?3*sizeof(GLfloat):3*sizeof(GLshort);
+    size=MD2_ALIGNUP(md2->nFrames*sizeof(struct md2_boundingbox));
+    /* compressed positions replace the expanded ones, paged frames live in their own region */
+    if(!(flags&MD2L_PAGED)) {
+	if(!(flags&MD2L_DELTAFRAMES)) size+=MD2_ALIGNUP(nv*pv);
+	if(!(flags&(MD2L_TABLENORMALS|MD2L_LAZYNORMALS))) size+=MD2_ALIGNUP(nv*pn)+MD2_ALIGNUP(nf*pn);
+	size+=MD2_ALIGNUP(nv);
+    }
+    if(!(flags&MD2L_TABLENORMALS)) size+=MD2_ALIGNUP((md2->nVertices+1)*sizeof(GLuint))+MD2_ALIGNUP(3*md2->nFaces*sizeof(GLuint));
+    return(size);
+}
+
+/* the welded glcommands take at most this, every glcommand vertex needs three words */
+
+size_t MD2_arena_weld (struct md2_model * md2) {
+    size_t n;
+
+    n=md2->nGLCommands/3;
+    return(MD2_ALIGNUP(sizeof(struct md2_weld))+MD2_ALIGNUP(n*sizeof(GLuint))+MD2_ALIGNUP(2*n*sizeof(GLfloat))
+	  +2*MD2_ALIGNUP(3*n*sizeof(GLuint)));
+}
+
+/* a new model with the header hd in an arena sized for everything the header tells. unless
+   mapped the file sections are allocated too, without MD2L_CACHE the frames are counted in */
+
+struct md2_model * MD2_arena_create (struct md2_model * hd, struct md2_loadopts * opts, GLint mapped) {
+    struct md2_model *md2;
+    struct md2_arena *a;
+    size_t size;
+
+    size=MD2_ALIGNUP(sizeof(struct md2_model))+MD2_arena_weld(hd);
+    if(!mapped) size+=MD2_ALIGNUP(64*hd->nTextures)+MD2_ALIGNUP(hd->nTexCoords*sizeof(struct md2_uv))
+		     +MD2_ALIGNUP(hd->nGLCommands*sizeof(GLuint))+MD2_ALIGNUP(hd->nFaces*sizeof(struct md2_face));
+    if(!opts || !(opts->flags&MD2L_CACHE)) size+=MD2_arena_frames(hd,opts?opts->precision:MD2P_DOUBLE,opts?opts->flags:0);
+    if(!(a=MD2_arena_block(opts?opts->allocator:NULL,size))) {
+	fprintf(stderr,"Out of memory, model\n");
+	return(NULL);
+    }
+    md2=(struct md2_model *)((GLubyte *)a+a->Used);
+    a->Used+=MD2_ALIGNUP(sizeof(struct md2_model));
+    memset(md2,0,sizeof(struct md2_model));
+    memcpy(md2,hd,MD2_HEADERSIZE);
+    md2->Arena=a;
+    if(!mapped) {
+	md2->TexNames=MD2_arena_alloc(md2,64*md2->nTextures);
+	md2->UV=MD2_arena_alloc(md2,md2->nTexCoords*sizeof(struct md2_uv));
+	md2->GLCmds=MD2_arena_alloc(md2,md2->nGLCommands*sizeof(GLuint));
+	md2->Faces=MD2_arena_alloc(md2,md2->nFaces*sizeof(struct md2_face));
+    }
+    return(md2);
+}
+
+
+
+/* vertex to face index in CSR layout: the faces vertex c is member of are
+   AdjFaces[AdjIndex[c]] .. AdjFaces[AdjIndex[c+1]-1], in ascending face order */
+
+int MD2_build_adjacency (struct md2_model * md2) {
+    GLuint c,i,d,p;
+
+    md2->AdjIndex=MD2_arena_alloc(md2,(md2->nVertices+1)*sizeof(GLuint));
+    md2->AdjFaces=MD2_arena_alloc(md2,3*md2->nFaces*sizeof(GLuint));
+    if(md2->AdjIndex==NULL || md2->AdjFaces==NULL) {
+	fprintf(stderr,"Out of memory, adjacency\n");
+	md2->AdjIndex=NULL; md2->AdjFaces=NULL;
+	return(0);
+    }
+    memset(md2->AdjIndex,0,(md2->nVertices+1)*sizeof(GLuint));
+    for(i=0;i<(md2->nFaces);i++) {
+	for(d=0;d<3;d++) {
+	    p=(&(md2->Faces[i]))->point[d];
+	    if(p<(md2->nVertices)) md2->AdjIndex[p+1]++;
+	}
+    }
+    for(c=0;c<(md2->nVertices);c++) md2->AdjIndex[c+1]+=md2->AdjIndex[c];
+    /* AdjIndex[p] is used as fill cursor and ends up shifted by one slot */
+    for(i=0;i<(md2->nFaces);i++) {
+	for(d=0;d<3;d++) {
+	    p=(&(md2->Faces[i]))->point[d];
+	    if(p<(md2->nVertices)) md2->AdjFaces[md2->AdjIndex[p]++]=i;
+	}
+    }
+    for(c=(md2->nVertices);c>0;c--) md2->AdjIndex[c]=md2->AdjIndex[c-1];
+    md2->AdjIndex[0]=0;
+    return(1);
+}
+
+
+
+/* expanding one keyframe: dequantized vertices, face normals, then vertex normals from the face normals */
+
+void MD2_build_frame_vertices (struct md2_model * md2, struct md2_frameheader * fh, struct md2_vertexd * vf) {
+    GLint c;
+    struct md2_vertex *vb;
+
+    for(c=0;c<(md2->nVertices);c++) {
+	vb=&(fh->vertex[c]);
+	vf[c].v[0]=(((GLdouble)vb->v[0])*fh->scale[0])+fh->translate[0];
+	vf[c].v[1]=(((GLdouble)vb->v[1])*fh->scale[1])+fh->translate[1];
+	vf[c].v[2]=(((GLdouble)vb->v[2])*fh->scale[2])+fh->translate[2];
+    }
+}
+
+void MD2_build_frame_normalidx (struct md2_model * md2, struct md2_frameheader * fh, GLubyte * ni) {
+    GLint c;
+
+    for(c=0;c<(md2->nVertices);c++) {
+	ni[c]=fh->vertex[c].normalidx;
+	if(ni[c]>=MD2_NUMNORMALS) ni[c]=0;
+    }
+}
+
+void MD2_build_frame_normals (struct md2_model * md2, struct md2_vertexd * vf, struct md2_vertexd * fnf, struct md2_vertexd * vnf) {
+    GLint c,i,s;
+    struct md2_vertexd *avf,svf;
+
+    for(i=0;i<(md2->nFaces);i++) {
+	MD2_calc_normal(&(vf[(&(md2->Faces[i]))->point[0]]),&(vf[(&(md2->Faces[i]))->point[1]]),&(vf[(&(md2->Faces[i]))->point[2]]),&(fnf[i]));
+    }
+    for(c=0;c<(md2->nVertices);c++) {
+	svf.v[0]=svf.v[1]=svf.v[2]=0;
+	s=md2->AdjIndex[c+1]-md2->AdjIndex[c];
+	for(i=md2->AdjIndex[c];i<md2->AdjIndex[c+1];i++) {
+	    avf=&(fnf[md2->AdjFaces[i]]);
+	    svf.v[0]+=avf->v[0];
+	    svf.v[1]+=avf->v[1];
+	    svf.v[2]+=avf->v[2];
+	}
+	if(s) {
+	    svf.v[0]/=((GLdouble)s);
+	    svf.v[1]/=((GLdouble)s);
+	    svf.v[2]/=((GLdouble)s);
+	}
+	MD2_normalize(&svf);
+	vnf[c]=svf;
+    }
+}
+
+
+
+/* conversion between the double precision frame layout and the compact SoA layouts */
+
+void MD2_pack_float (struct md2_vertexd * src, GLuint count, GLfloat * dst) {
+    GLuint c;
+
+    for(c=0;c<count;c++) {
+	dst[c]=src[c].v[0];
+	dst[count+c]=src[c].v[1];
+	dst[2*count+c]=src[c].v[2];
+    }
+}
+
+void MD2_pack_snorm (struct md2_vertexd * src, GLuint count, GLshort * dst) {
+    GLuint c;
+
+    for(c=0;c<count;c++) {
+	dst[c]=(GLshort)lrint(src[c].v[0]*32767.0);
+	dst[count+c]=(GLshort)lrint(src[c].v[1]*32767.0);
+	dst[2*count+c]=(GLshort)lrint(src[c].v[2]*32767.0);
+    }
+}
+
+/* fetching element i of frame f from whichever array is in use */
+
+void MD2_fetch (struct md2_vertexd * d, GLfloat * fl, GLshort * sh, GLuint count, GLint f, GLint i, struct md2_vertexd * r) {
+    if(d) {
+	*r=d[i+f*count];
+    } else if(fl) {
+	fl+=3*count*f+i;
+	r->v[0]=fl[0]; r->v[1]=fl[count]; r->v[2]=fl[2*count];
+    } else {
+	sh+=3*count*f+i;
+	r->v[0]=sh[0]/32767.0; r->v[1]=sh[count]/32767.0; r->v[2]=sh[2*count]/32767.0;
+    }
+}
+
+/* the frames of one animation sequence share their name up to the trailing digits, "run1".."run6" */
+
+int MD2_same_sequence (const GLubyte * a, const GLubyte * b) {
+    GLint la,lb;
+
+    for(la=0;la<16 && a[la];la++);
+    while(la>0 && a[la-1]>='0' && a[la-1]<='9') la--;
+    for(lb=0;lb<16 && b[lb];lb++);
+    while(lb>0 && b[lb-1]>='0' && b[lb-1]<='9') lb--;
+    return(la==lb && !memcmp(a,b,la));
+}
+
+/* compressed positions, see md2_deltaframes. a single position is decoded here, the pose
+   decodes whole ranges with the kernels of MD2_pose_delta in the same float operations */
+
+void MD2_delta_fetch (struct md2_model * md2, GLint f, GLint i, struct md2_vertexd * r) {
+    struct md2_deltaseq *seq;
+    size_t off;
+    GLint d,code;
+
+    seq=&(md2->Delta->Seqs[md2->Delta->Seq[f]]);
+    for(d=0;d<3;d++) {
+	off=((size_t)(f-seq->First)*3+d)*md2->nVertices+i;
+	code=seq->Wide?((GLshort *)seq->Codes)[off]:((signed char *)seq->Codes)[off];
+	r->v[d]=(GLfloat)(seq->Ref[d*md2->nVertices+i]+seq->Step[d]*code);
+    }
+}
+
+void MD2_delta_free (struct md2_model * md2) {
+    GLint c;
+
+    if(!md2->Delta) return;
+    for(c=0;c<(md2->Delta->nSeqs);c++) free(md2->Delta->Seqs[c].Ref);
+    free(md2->Delta->Seqs); free(md2->Delta->Seq); free(md2->Delta);
+    md2->Delta=NULL;
+}
+
+/* encodes one sequence from the uncompressed positions. the step of an axis spreads the
+   largest distance from the reference over the code range, 8 bit codes are taken when that
+   keeps every position within maxerror */
+
+int MD2_delta_encode (struct md2_model * md2, struct md2_deltaseq * seq, GLfloat maxerror, GLfloat * error) {
+    struct md2_vertexd vf;
+    GLdouble lo,hi,h[3],e;
+    GLuint nv,c,f,d,limit;
+    GLfloat *ref,*p,t;
+    GLint code;
+
+    nv=md2->nVertices;
+    ref=malloc(3*nv*sizeof(GLfloat)+(size_t)seq->nFrames*3*nv*sizeof(GLshort));
+    if(!ref) return(0);
+    lo=hi=0;
+    for(d=0;d<3;d++) {
+	for(c=0;c<nv;c++) {
+	    for(f=0;f<seq->nFrames;f++) {
+		MD2_fetch(md2->Vertex,md2->VertexF,NULL,nv,seq->First+f,c,&vf);
+		if(!f || vf.v[d]<lo) lo=vf.v[d];
+		if(!f || vf.v[d]>hi) hi=vf.v[d];
+	    }
+	    ref[d*nv+c]=(lo+hi)/2;
+	}
+    }
+    h[0]=h[1]=h[2]=0;
+    for(f=0;f<seq->nFrames;f++) {
+	for(c=0;c<nv;c++) {
+	    MD2_fetch(md2->Vertex,md2->VertexF,NULL,nv,seq->First+f,c,&vf);
+	    for(d=0;d<3;d++) if(fabs(vf.v[d]-ref[d*nv+c])>h[d]) h[d]=fabs(vf.v[d]-ref[d*nv+c]);
+	}
+    }
+    seq->Wide=h[0]>254*maxerror || h[1]>254*maxerror || h[2]>254*maxerror;
+    limit=seq->Wide?32767:127;
+    for(d=0;d<3;d++) seq->Step[d]=h[d]/limit;
+    if(!seq->Wide && (p=realloc(ref,3*nv*sizeof(GLfloat)+(size_t)seq->nFrames*3*nv))) ref=p;
+    seq->Ref=ref;
+    seq->Codes=ref+3*nv;
+    for(f=0;f<seq->nFrames;f++) {
+	for(c=0;c<nv;c++) {
+	    MD2_fetch(md2->Vertex,md2->VertexF,NULL,nv,seq->First+f,c,&vf);
+	    for(d=0;d<3;d++) {
+		code=seq->Step[d]>0?lrint((vf.v[d]-ref[d*nv+c])/seq->Step[d]):0;
+		if(code>(GLint)limit) code=limit;
+		if(code<-(GLint)limit) code=-limit;
+		if(seq->Wide) ((GLshort *)seq->Codes)[(f*3+d)*nv+c]=code;
+		else ((signed char *)seq->Codes)[(f*3+d)*nv+c]=code;
+		t=(GLfloat)(ref[d*nv+c]+seq->Step[d]*code);
+		if((e=fabs(vf.v[d]-t))>*error) *error=e;
+	    }
+	}
+    }
+    return(1);
+}
+
+/* replaces the uncompressed positions of a freshly expanded model by md2_deltaframes,
+   frames holds the raw frame records for their names */
+
+int MD2_delta_build (struct md2_model * md2, GLubyte * frames, GLfloat maxerror) {
+    struct md2_deltaframes *df;
+    struct md2_frameheader *fh;
+    GLubyte *name,*prev;
+    GLint f;
+
+    df=calloc(1,sizeof(struct md2_deltaframes));
+    if(!df || !(df->Seq=malloc(md2->nFrames*sizeof(GLint))) || !(df->Seqs=calloc(md2->nFrames,sizeof(struct md2_deltaseq)))) {
+	fprintf(stderr,"Out of memory, compressed frames\n");
+	if(df) free(df->Seq);
+	free(df); return(0);
+    }
+    md2->Delta=df;
+    prev=NULL;
+    for(f=0;f<(md2->nFrames);f++) {
+	fh=(struct md2_frameheader *)(frames+(md2->FrameSize*f));
+	name=fh->name;
+	if(!prev || !MD2_same_sequence(name,prev)) df->Seqs[df->nSeqs++].First=f;
+	prev=name;
+	df->Seq[f]=df->nSeqs-1;
+	df->Seqs[df->nSeqs-1].nFrames++;
+    }
+    df->Bytes=sizeof(struct md2_deltaframes)+df->nSeqs*sizeof(struct md2_deltaseq)+md2->nFrames*sizeof(GLint);
+    for(f=0;f<(df->nSeqs);f++) {
+	if(!MD2_delta_encode(md2,&(df->Seqs[f]),maxerror,&(df->MaxError))) {
+	    fprintf(stderr,"Out of memory, compressed frames\n");
+	    MD2_delta_free(md2); return(0);
+	}
+	df->Bytes+=3*md2->nVertices*(sizeof(GLfloat)+(size_t)df->Seqs[f].nFrames*(df->Seqs[f].Wide?sizeof(GLshort):1));
+    }
+    free(md2->Vertex); free(md2->VertexF);
+    md2->Vertex=NULL; md2->VertexF=NULL;
+    return(1);
+}
+
+void MD2_get_vertex (struct md2_model * md2, GLint f, GLint i, struct md2_vertexd * r) {
+    if(md2->Delta) MD2_delta_fetch(md2,f,i,r);
+    else MD2_fetch(md2->Vertex,md2->VertexF,NULL,md2->nVertices,f,i,r);
+}
+
+/* the lazy normal cache, limit is the memory budget in bytes, at least two frames are
+   kept so both keyframes of an interpolation fit */
+
+int MD2_ncache_create (struct md2_model * md2, size_t limit) {
+    struct md2_normalcache *nc;
+    GLint c;
+
+    nc=calloc(1,sizeof(struct md2_normalcache));
+    if(!nc) {
+	fprintf(stderr,"Out of memory, normal cache\n");
+	return(0);
+    }
+    switch(md2->Precision) {
+	case MD2P_FLOAT:   nc->SlotSize=3*(md2->nVertices+md2->nFaces)*sizeof(GLfloat); break;
+	case MD2P_SNORM16: nc->SlotSize=3*(md2->nVertices+md2->nFaces)*sizeof(GLshort); break;
+	default:           nc->SlotSize=(md2->nVertices+md2->nFaces)*sizeof(struct md2_vertexd); break;
+    }
+    nc->nSlots=limit?limit/nc->SlotSize:md2->nFrames;
+    if(nc->nSlots<2) nc->nSlots=2;
+    if(nc->nSlots>md2->nFrames) nc->nSlots=md2->nFrames;
+    nc->Slot=malloc(md2->nFrames*sizeof(GLint));
+    nc->Frame=malloc(nc->nSlots*sizeof(GLint));
+    nc->Stamp=calloc(nc->nSlots,sizeof(GLuint));
+    nc->Data=malloc(nc->nSlots*nc->SlotSize);
+    nc->Scratch=malloc((2*md2->nVertices+md2->nFaces)*sizeof(struct md2_vertexd));
+    if(!nc->Slot || !nc->Frame || !nc->Stamp || !nc->Data || !nc->Scratch) {
+	fprintf(stderr,"Out of memory, normal cache\n");
+	free(nc->Slot); free(nc->Frame); free(nc->Stamp); free(nc->Data); free(nc->Scratch); free(nc);
+	return(0);
+    }
+    for(c=0;c<(md2->nFrames);c++) nc->Slot[c]=-1;
+    for(c=0;c<(nc->nSlots);c++) nc->Frame[c]=-1;
+    pthread_mutex_init(&(nc->Lock),NULL);
+    md2->NCache=nc;
+    return(1);
+}
+
+void MD2_ncache_free (struct md2_model * md2) {
+    struct md2_normalcache *nc;
+
+    if(!(nc=md2->NCache)) return;
+    pthread_mutex_destroy(&(nc->Lock));
+    free(nc->Slot); free(nc->Frame); free(nc->Stamp); free(nc->Data); free(nc->Scratch); free(nc);
+    md2->NCache=NULL;
+}
+
+/* returns the slot of frame f, generating its normals into the least recently used slot
+   if necessary. must be called with the cache locked */
+
+GLint MD2_ncache_frame (struct md2_model * md2, GLint f) {
+    struct md2_normalcache *nc;
+    struct md2_vertexd *vf,*vnf,*fnf;
+    GLubyte *data;
+    GLint c,slot;
+
+    nc=md2->NCache;
+    if((slot=nc->Slot[f])>=0) {
+	nc->Hits++;
+	nc->Stamp[slot]=++(nc->Clock);
+	return(slot);
+    }
+    nc->Misses++;
+    slot=0;
+    for(c=1;c<(nc->nSlots);c++) if(nc->Stamp[c]<nc->Stamp[slot]) slot=c;
+    if(nc->Frame[slot]>=0) nc->Slot[nc->Frame[slot]]=-1;
+    vf=nc->Scratch;
+    vnf=vf+md2->nVertices;
+    fnf=vnf+md2->nVertices;
+    for(c=0;c<(md2->nVertices);c++) MD2_get_vertex(md2,f,c,&(vf[c]));
+    MD2_build_frame_normals(md2,vf,fnf,vnf);
+    data=nc->Data+slot*nc->SlotSize;
+    switch(md2->Precision) {
+	case MD2P_FLOAT:
+	    MD2_pack_float(vnf,md2->nVertices,(GLfloat *)data);
+	    MD2_pack_float(fnf,md2->nFaces,((GLfloat *)data)+3*md2->nVertices);
+	    break;
+	case MD2P_SNORM16:
+	    MD2_pack_snorm(vnf,md2->nVertices,(GLshort *)data);
+	    MD2_pack_snorm(fnf,md2->nFaces,((GLshort *)data)+3*md2->nVertices);
+	    break;
+	default:
+	    memcpy(data,vnf,(md2->nVertices+md2->nFaces)*sizeof(struct md2_vertexd));
+	    break;
+    }
+    nc->Frame[slot]=f;
+    nc->Slot[f]=slot;
+    nc->Stamp[slot]=++(nc->Clock);
+    return(slot);
+}
+
+/* vertex normal (face=0) or face normal (face=1) i of frame f */
+
+void MD2_ncache_fetch (struct md2_model * md2, GLint f, GLint i, GLint face, struct md2_vertexd * r) {
+    struct md2_normalcache *nc;
+    GLubyte *data;
+    GLuint offset;
+
+    nc=md2->NCache;
+    pthread_mutex_lock(&(nc->Lock));
+    data=nc->Data+MD2_ncache_frame(md2,f)*nc->SlotSize;
+    offset=face?md2->nVertices:0;
+    switch(md2->Precision) {
+	case MD2P_FLOAT:
+	    MD2_fetch(NULL,((GLfloat *)data)+3*offset,NULL,face?md2->nFaces:md2->nVertices,0,i,r);
+	    break;
+	case MD2P_SNORM16:
+	    MD2_fetch(NULL,NULL,((GLshort *)data)+3*offset,face?md2->nFaces:md2->nVertices,0,i,r);
+	    break;
+	default:
+	    *r=((struct md2_vertexd *)data)[offset+i];
+	    break;
+    }
+    pthread_mutex_unlock(&(nc->Lock));
+}
+
+
+
+/* the normal of the precomputed table the file assigns to vertex i in frame f. MD2_calc_normal
+   works on the clockwise quake winding, so all generated normals point the opposite way of the
+   table ones; the table normal is flipped to match them */
+
+void MD2_get_tnormal (struct md2_model * md2, GLint f, GLint i, struct md2_vertexd * r) {
+    const GLfloat *an;
+
+    an=MD2_ANORMS[md2->NormalIdx[i+f*md2->nVertices]];
+    r->v[0]=-an[0]; r->v[1]=-an[1]; r->v[2]=-an[2];
+}
+
+/* models loaded with MD2L_TABLENORMALS have no generated normals, vertex normals fall back
+   to the table and face normals are calculated from the vertices on demand */
+
+void MD2_get_vnormal (struct md2_model * md2, GLint f, GLint i, struct md2_vertexd * r) {
+    if(md2->Flags&MD2L_TABLENORMALS) MD2_get_tnormal(md2,f,i,r);
+    else if(md2->NCache) MD2_ncache_fetch(md2,f,i,0,r);
+    else MD2_fetch(md2->VNormal,md2->VNormalF,md2->VNormalS,md2->nVertices,f,i,r);
+}
+
+void MD2_get_fnormal (struct md2_model * md2, GLint f, GLint i, struct md2_vertexd * r) {
+    struct md2_vertexd avf,bvf,cvf;
+
+    if(md2->Flags&MD2L_TABLENORMALS) {
+	MD2_get_vertex(md2,f,(&(md2->Faces[i]))->point[0],&avf);
+	MD2_get_vertex(md2,f,(&(md2->Faces[i]))->point[1],&bvf);
+	MD2_get_vertex(md2,f,(&(md2->Faces[i]))->point[2],&cvf);
+	MD2_calc_normal(&avf,&bvf,&cvf,r);
+    } else if(md2->NCache) MD2_ncache_fetch(md2,f,i,1,r);
+    else MD2_fetch(md2->FNormal,md2->FNormalF,md2->FNormalS,md2->nFaces,f,i,r);
+}
+
+
+
+struct md2_framejob {
+    struct md2_model *	md2;
+    GLubyte *		frames;		/* the raw records from frame first on */
+    GLint		first;
+    atomic_int		failed;
+};
+
+/* the double arrays are built in place, the compact modes go through a scratch frame */
+
+void MD2_build_frame_job (void * arg, GLint n) {
+    struct md2_framejob *job;
+    struct md2_model *md2;
+    struct md2_frameheader *fh;
+    struct md2_vertexd *vf,*fnf,*vnf;
+
+    job=(struct md2_framejob *)arg;
+    md2=job->md2;
+    fh=(struct md2_frameheader *)(job->frames+(md2->FrameSize*n));
+    n+=job->first;
+    MD2_build_frame_normalidx(md2,fh,md2->NormalIdx+n*md2->nVertices);
+    if(md2->Flags&(MD2L_TABLENORMALS|MD2L_LAZYNORMALS)) {
+	if(md2->Precision==MD2P_DOUBLE) {
+	    MD2_build_frame_vertices(md2,fh,&(md2->Vertex[n*(md2->nVertices)]));
+	    return;
+	}
+	vf=malloc(md2->nVertices*sizeof(struct md2_vertexd));
+	if(!vf) {
+	    atomic_store(&(job->failed),1);
+	    return;
+	}
+	MD2_build_frame_vertices(md2,fh,vf);
+	MD2_pack_float(vf,md2->nVertices,md2->VertexF+3*n*md2->nVertices);
+	free(vf);
+	return;
+    }
+    if(md2->Precision==MD2P_DOUBLE) {
+	vf=&(md2->Vertex[n*(md2->nVertices)]);
+	MD2_build_frame_vertices(md2,fh,vf);
+	MD2_build_frame_normals(md2,vf,&(md2->FNormal[n*(md2->nFaces)]),&(md2->VNormal[n*(md2->nVertices)]));
+	return;
+    }
+    vf=malloc((2*md2->nVertices+md2->nFaces)*sizeof(struct md2_vertexd));
+    if(!vf) {
+	atomic_store(&(job->failed),1);
+	return;
+    }
+    vnf=vf+md2->nVertices;
+    fnf=vnf+md2->nVertices;
+    MD2_build_frame_vertices(md2,fh,vf);
+    MD2_build_frame_normals(md2,vf,fnf,vnf);
+    MD2_pack_float(vf,md2->nVertices,md2->VertexF+3*n*md2->nVertices);
+    if(md2->Precision==MD2P_FLOAT) {
+	MD2_pack_float(vnf,md2->nVertices,md2->VNormalF+3*n*md2->nVertices);
+	MD2_pack_float(fnf,md2->nFaces,md2->FNormalF+3*n*md2->nFaces);
+    } else {
+	MD2_pack_snorm(vnf,md2->nVertices,md2->VNormalS+3*n*md2->nVertices);
+	MD2_pack_snorm(fnf,md2->nFaces,md2->FNormalS+3*n*md2->nFaces);
+    }
+    free(vf);
+}
+
+
+
+/* sanity checks of the header against the size of the file, so no section reaches past its end */
+
+int MD2_checkheader (struct md2_model * md2, unsigned long size) {
+    if(md2->ID!=MD2_IDENT || md2->Version!=MD2_VERSION) {
+	fprintf(stderr,"Not a MD2 file (ID 0x%x, version %d)\n",md2->ID,md2->Version);
+	return(0);
+    }
+    if(md2->nFrames<1 || md2->nVertices<1
+    || md2->nVertices>MD2_MAXVERTICES
+    || md2->nFaces>MD2_MAXFACES
+    || md2->FrameSize<sizeof(struct md2_frameheader)-sizeof(struct md2_vertex)+(md2->nVertices*sizeof(struct md2_vertex))) {
+	fprintf(stderr,"Bad counts in header\n");
+	return(0);
+    }
+    if((unsigned long long)md2->TexOffset+64ULL*md2->nTextures>size
+    || (unsigned long long)md2->UVOffset+sizeof(struct md2_uv)*(unsigned long long)md2->nTexCoords>size
+    || (unsigned long long)md2->FaceOffset+sizeof(struct md2_face)*(unsigned long long)md2->nFaces>size
+    || (unsigned long long)md2->FrameOffset+(unsigned long long)md2->FrameSize*md2->nFrames>size
+    || (unsigned long long)md2->GLCmdOffset+4ULL*md2->nGLCommands>size) {
+	fprintf(stderr,"Bad offsets in header\n");
+	return(0);
+    }
+    return(1);
+}
+
+/* checks the faces and the glcommand stream, every index must be within its array */
+
+int MD2_checkdata (struct md2_model * md2) {
+    GLuint i,d,w;
+
+    for(i=0;i<(md2->nFaces);i++) {
+	for(d=0;d<3;d++) {
+	    if((&(md2->Faces[i]))->point[d]>=md2->nVertices
+	    || (&(md2->Faces[i]))->uv[d]>=md2->nTexCoords) {
+		fprintf(stderr,"Bad index in face %d\n",i);
+		return(0);
+	    }
+	}
+    }
+    i=0;
+    while(i<md2->nGLCommands) {
+	if(!(w=abs((GLint)md2->GLCmds[i++]))) return(1);
+	if(w<3) {
+	    fprintf(stderr,"Bad count in glcommands\n");
+	    return(0);
+	}
+	if(i+3*w>md2->nGLCommands) break;
+	for(d=0;d<w;d++,i+=3) {
+	    if(md2->GLCmds[i+2]>=md2->nVertices) {
+		fprintf(stderr,"Bad index in glcommands\n");
+		return(0);
+	    }
+	}
+    }
+    if(md2->nGLCommands) {
+	fprintf(stderr,"Unterminated glcommands\n");
+	return(0);
+    }
+    return(1);
+}
+
+
+
+/* bounding boxes, x1/y1/z1 are the maxima and x2/y2/z2 the minima. every keyframe gets its
+   exact box at load time and every animation sequence the union of the boxes of its frames,
+   so bounds are available without touching a vertex */
+
+void MD2_bb_init (struct md2_boundingbox * bb) {
+    bb->x1=bb->y1=bb->z1=-HUGE_VAL;
+    bb->x2=bb->y2=bb->z2=HUGE_VAL;
+}
+
+void MD2_bb_add (struct md2_boundingbox * bb, struct md2_vertexd * mv) {
+    if(mv->v[0]>bb->x1) bb->x1=mv->v[0];
+    if(mv->v[0]<bb->x2) bb->x2=mv->v[0];
+    if(mv->v[1]>bb->y1) bb->y1=mv->v[1];
+    if(mv->v[1]<bb->y2) bb->y2=mv->v[1];
+    if(mv->v[2]>bb->z1) bb->z1=mv->v[2];
+    if(mv->v[2]<bb->z2) bb->z2=mv->v[2];
+}
+
+void MD2_bb_union (struct md2_boundingbox * bb, struct md2_boundingbox * a) {
+    if(a->x1>bb->x1) bb->x1=a->x1;
+    if(a->x2<bb->x2) bb->x2=a->x2;
+    if(a->y1>bb->y1) bb->y1=a->y1;
+    if(a->y2<bb->y2) bb->y2=a->y2;
+    if(a->z1>bb->z1) bb->z1=a->z1;
+    if(a->z2<bb->z2) bb->z2=a->z2;
+}
+
+/* widens a range by a few float ulps, the rounding of the interpolation can overshoot a
+   keyframe by that much */
+
+void MD2_bb_pad (GLdouble * hi, GLdouble * lo) {
+    GLdouble e;
+
+    e=2*FLT_EPSILON*(fabs(*hi)+fabs(*lo));
+    *hi+=e; *lo-=e;
+}
+
+/* in the single precision of the poses, so they never poke out of the boxes. rounding
+   through a separate vertex */
+
+void MD2_build_frame_bb (void * arg, GLint n) {
+    struct md2_model *md2;
+    struct md2_vertexd vf,mv;
+    GLint c;
+
+    md2=(struct md2_model *)arg;
+    MD2_bb_init(&(md2->FrameBB[n]));
+    for(c=0;c<(md2->nVertices);c++) {
+	MD2_get_vertex(md2,n,c,&vf);
+	mv.v[0]=(GLfloat)vf.v[0]; mv.v[1]=(GLfloat)vf.v[1]; mv.v[2]=(GLfloat)vf.v[2];
+	MD2_bb_add(&(md2->FrameBB[n]),&mv);
+    }
+}
+
+/* sequences reaching past the last frame of the model get no box */
+
+void MD2_build_anim_bb (struct md2_model * md2) {
+    GLint a,f;
+
+    for(a=0;a<MD2A_MAXANIMATIONS;a++) {
+	if(MD2A_END[a]>=md2->nFrames) continue;
+	md2->AnimBB[a]=md2->FrameBB[MD2A_START[a]];
+	for(f=MD2A_START[a]+1;f<=MD2A_END[a];f++) MD2_bb_union(&(md2->AnimBB[a]),&(md2->FrameBB[f]));
+	MD2_bb_pad(&(md2->AnimBB[a].x1),&(md2->AnimBB[a].x2));
+	MD2_bb_pad(&(md2->AnimBB[a].y1),&(md2->AnimBB[a].y2));
+	MD2_bb_pad(&(md2->AnimBB[a].z1),&(md2->AnimBB[a].z2));
+    }
+}
+
+/* a box containing the pose between frames sf and ef for any s: the exact box of sf at s<=0,
+   else the padded union of both keyframe boxes (only ef at s>=1) */
+
+int MD2_get_bb (struct md2_model * md2, GLint sf, GLint ef, GLdouble s, struct md2_boundingbox * bb) {
+    if(sf<0 || ef<0 || sf>=md2->nFrames || ef>=md2->nFrames) return(0);
+    if(s<=0) {
+	*bb=md2->FrameBB[sf];
+    } else {
+	*bb=md2->FrameBB[ef];
+	if(s<1) MD2_bb_union(bb,&(md2->FrameBB[sf]));
+	MD2_bb_pad(&(bb->x1),&(bb->x2));
+	MD2_bb_pad(&(bb->y1),&(bb->y2));
+	MD2_bb_pad(&(bb->z1),&(bb->z2));
+    }
+    return(1);
+}
+
+/* a box containing every pose MD2_anim_display can show for the sequence anim */
+
+int MD2_anim_bb (struct md2_model * md2, GLint anim, struct md2_boundingbox * bb) {
+    if(anim<0 || anim>=MD2A_MAXANIMATIONS || MD2A_END[anim]>=md2->nFrames) return(0);
+    *bb=md2->AnimBB[anim];
+    return(1);
+}
+
+
+
+/* paging of the frames, see md2_paging. the loaders create it before MD2_expandframes, which
+   then carves the frame arrays out of the reserved region instead of allocating them */
+
+int MD2_page_create (struct md2_model * md2, GLint fd, struct md2_loadopts * opts) {
+    struct md2_paging *pg;
+
+    pg=calloc(1,sizeof(struct md2_paging));
+    if(!pg || !(pg->Seq=malloc(md2->nFrames*sizeof(GLint))) || !(pg->Seqs=calloc(md2->nFrames,sizeof(struct md2_pageseq)))) {
+	fprintf(stderr,"Out of memory, paging\n");
+	if(pg) free(pg->Seq);
+	free(pg);
+	if(fd>=0) close(fd);
+	return(0);
+    }
+    pg->fd=fd;
+    pg->Budget=opts->pagebudget;
+    pthread_mutex_init(&(pg->Lock),NULL);
+    md2->Paging=pg;
+    return(1);
+}
+
+void MD2_page_free (struct md2_model * md2) {
+    struct md2_paging *pg;
+
+    if(!(pg=md2->Paging)) return;
+    if(pg->Region) munmap(pg->Region,pg->RegionSize);
+    if(pg->fd>=0) close(pg->fd);
+    pthread_mutex_destroy(&(pg->Lock));
+    free(pg->Seqs); free(pg->Seq); free(pg);
+    md2->Paging=NULL;
+}
+
+/* room for the largest frame arrays any precision needs, each starting on a page */
+
+int MD2_page_reserve (struct md2_model * md2) {
+    struct md2_paging *pg;
+    size_t page;
+
+    pg=md2->Paging;
+    page=sysconf(_SC_PAGESIZE);
+    pg->RegionSize=(size_t)md2->nFrames*(2*md2->nVertices*sizeof(struct md2_vertexd)+md2->nFaces*sizeof(struct md2_vertexd)+md2->nVertices)+4*page;
+    pg->RegionSize=(pg->RegionSize+page-1)/page*page;
+    pg->Region=mmap(NULL,pg->RegionSize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+    if(pg->Region==MAP_FAILED) {
+	fprintf(stderr,"Cannot reserve %lu bytes, paging\n",(unsigned long)pg->RegionSize);
+	pg->Region=NULL;
+	return(0);
+    }
+    return(1);
+}
+
+void * MD2_frames_alloc (struct md2_model * md2, size_t size) {
+    struct md2_paging *pg;
+    size_t page;
+    void *p;
+
+    if(!(pg=md2->Paging)) return(MD2_arena_alloc(md2,size));
+    page=sysconf(_SC_PAGESIZE);
+    p=pg->Region+pg->RegionUsed;
+    pg->RegionUsed+=(size+page-1)/page*page;
+    pg->FrameBytes+=size/md2->nFrames;
+    return(p);
+}
+
+/* the positions of a model to be delta compressed are dropped after that, so they are not
+   taken from the arena */
+
+void * MD2_frames_vertex (struct md2_model * md2, size_t size) {
+    return((md2->Flags&MD2L_DELTAFRAMES)?malloc(size):MD2_frames_alloc(md2,size));
+}
+
+/* the frame arrays in use and their bytes per frame */
+
+GLint MD2_page_arrays (struct md2_model * md2, GLubyte ** base, size_t * per) {
+    GLint n;
+    size_t nv,nf;
+
+    n=0;
+    nv=md2->nVertices; nf=md2->nFaces;
+    if(md2->Vertex)   { base[n]=(GLubyte *)md2->Vertex;   per[n++]=nv*sizeof(struct md2_vertexd); }
+    if(md2->VertexF)  { base[n]=(GLubyte *)md2->VertexF;  per[n++]=3*nv*sizeof(GLfloat); }
+    if(md2->VNormal)  { base[n]=(GLubyte *)md2->VNormal;  per[n++]=nv*sizeof(struct md2_vertexd); }
+    if(md2->VNormalF) { base[n]=(GLubyte *)md2->VNormalF; per[n++]=3*nv*sizeof(GLfloat); }
+    if(md2->VNormalS) { base[n]=(GLubyte *)md2->VNormalS; per[n++]=3*nv*sizeof(GLshort); }
+    if(md2->FNormal)  { base[n]=(GLubyte *)md2->FNormal;  per[n++]=nf*sizeof(struct md2_vertexd); }
+    if(md2->FNormalF) { base[n]=(GLubyte *)md2->FNormalF; per[n++]=3*nf*sizeof(GLfloat); }
+    if(md2->FNormalS) { base[n]=(GLubyte *)md2->FNormalS; per[n++]=3*nf*sizeof(GLshort); }
+    if(md2->NormalIdx) { base[n]=md2->NormalIdx;          per[n++]=nv; }
+    return(n);
+}
+
+/* reads the raw records of n frames from frame first on, in place for mapped models */
+
+GLubyte * MD2_page_records (struct md2_model * md2, GLint first, GLint n, GLubyte ** buf) {
+    size_t size,done;
+    off_t off;
+    ssize_t r;
+
+    off=md2->FrameOffset+(off_t)first*md2->FrameSize;
+    size=(size_t)n*md2->FrameSize;
+    *buf=NULL;
+    if(md2->Map) return(md2->Map+off);
+    if(!(*buf=malloc(size))) {
+	fprintf(stderr,"Out of memory, paging\n");
+	return(NULL);
+    }
+    for(done=0;done<size;done+=r) {
+	if((r=pread(md2->Paging->fd,*buf+done,size-done,off+done))<=0) {
+	    fprintf(stderr,"Read error, paging\n");
+	    free(*buf); *buf=NULL;
+	    return(NULL);
+	}
+    }
+    return(*buf);
+}
+
+/* only the frame headers are read at load: the sequences by name and boxes from the range the
+   quantized vertices can span, they contain the exact boxes of MD2_build_frame_bb */
+
+int MD2_page_layout (struct md2_model * md2) {
+    struct md2_paging *pg;
+    struct md2_frameheader hb,*fh;
+    struct md2_vertexd mv;
+    GLubyte prev[16];
+    GLint f,d;
+
+    pg=md2->Paging;
+    for(f=0;f<(md2->nFrames);f++) {
+	if(md2->Map) {
+	    fh=(struct md2_frameheader *)(md2->Map+md2->FrameOffset+(size_t)f*md2->FrameSize);
+	} else {
+	    fh=&hb;
+	    if(pread(pg->fd,&hb,offsetof(struct md2_frameheader,vertex),md2->FrameOffset+(off_t)f*md2->FrameSize)!=offsetof(struct md2_frameheader,vertex)) {
+		fprintf(stderr,"Read error, paging\n");
+		return(0);
+	    }
+	}
+	if(!f || !MD2_same_sequence(fh->name,prev)) pg->Seqs[pg->nSeqs++].First=f;
+	memcpy(prev,fh->name,16);
+	pg->Seq[f]=pg->nSeqs-1;
+	pg->Seqs[pg->nSeqs-1].nFrames++;
+	MD2_bb_init(&(md2->FrameBB[f]));
+	for(d=0;d<3;d++) mv.v[d]=fh->translate[d];
+	MD2_bb_add(&(md2->FrameBB[f]),&mv);
+	for(d=0;d<3;d++) mv.v[d]=fh->translate[d]+255.0*fh->scale[d];
+	MD2_bb_add(&(md2->FrameBB[f]),&mv);
+	MD2_bb_pad(&(md2->FrameBB[f].x1),&(md2->FrameBB[f].x2));
+	MD2_bb_pad(&(md2->FrameBB[f].y1),&(md2->FrameBB[f].y2));
+	MD2_bb_pad(&(md2->FrameBB[f].z1),&(md2->FrameBB[f].z2));
+    }
+    return(1);
+}
+
+/* gives the pages lying completely inside the frames of sequence q back to the system, the
+   ones shared with a neighbour stay */
+
+void MD2_page_out (struct md2_model * md2, GLint q) {
+    struct md2_paging *pg;
+    struct md2_pageseq *seq;
+    GLubyte *base[9];
+    size_t per[9],page;
+    uintptr_t a,b;
+    GLint c,n;
+
+    pg=md2->Paging;
+    seq=&(pg->Seqs[q]);
+    page=sysconf(_SC_PAGESIZE);
+    n=MD2_page_arrays(md2,base,per);
+    for(c=0;c<n;c++) {
+	a=(uintptr_t)(base[c]+seq->First*per[c]);
+	b=(uintptr_t)(base[c]+(seq->First+seq->nFrames)*per[c]);
+	a=(a+page-1)/page*page; b=b/page*page;
+	if(a<b) madvise((void *)a,b-a,MADV_DONTNEED);
+    }
+    seq->Resident=0;
+    pg->Resident-=seq->nFrames*pg->FrameBytes;
+    pg->Evictions++;
+}
+
+/* drops the least recently used unpinned sequences until the budget is met */
+
+void MD2_page_trim (struct md2_model * md2) {
+    struct md2_paging *pg;
+    GLint c,q;
+
+    pg=md2->Paging;
+    while(pg->Budget && pg->Resident>pg->Budget) {
+	q=-1;
+	for(c=0;c<(pg->nSeqs);c++) {
+	    if(pg->Seqs[c].Resident && !pg->Seqs[c].Pins && (q<0 || pg->Seqs[c].Stamp<pg->Seqs[q].Stamp)) q=c;
+	}
+	if(q<0) return;
+	MD2_page_out(md2,q);
+    }
+}
+
+/* reads and expands sequence q on the calling thread, with MD2L_PREFETCH the system is asked
+   to read the next one ahead meanwhile */
+
+int MD2_page_in (struct md2_model * md2, GLint q) {
+    struct md2_paging *pg;
+    struct md2_pageseq *seq;
+    struct md2_framejob job;
+    GLubyte *records,*buf;
+    size_t page;
+    uintptr_t a;
+
+    pg=md2->Paging;
+    seq=&(pg->Seqs[q]);
+    if(!(records=MD2_page_records(md2,seq->First,seq->nFrames,&buf))) return(0);
+    job.md2=md2;
+    job.frames=records;
+    job.first=seq->First;
+    atomic_init(&(job.failed),0);
+    MD2_pool_run(NULL,MD2_build_frame_job,&job,seq->nFrames);
+    free(buf);
+    if(atomic_load(&(job.failed))) {
+	fprintf(stderr,"Out of memory, paging\n");
+	return(0);
+    }
+    seq->Resident=1;
+    pg->Resident+=seq->nFrames*pg->FrameBytes;
+    pg->PageIns++;
+    if((md2->Flags&MD2L_PREFETCH) && q+1<pg->nSeqs && !pg->Seqs[q+1].Resident) {
+	seq=&(pg->Seqs[q+1]);
+	if(md2->Map) {
+	    page=sysconf(_SC_PAGESIZE);
+	    a=(uintptr_t)(md2->Map+md2->FrameOffset+(size_t)seq->First*md2->FrameSize)/page*page;
+	    madvise((void *)a,(uintptr_t)(md2->Map+md2->FrameOffset)+(size_t)(seq->First+seq->nFrames)*md2->FrameSize-a,MADV_WILLNEED);
+	} else {
+	    posix_fadvise(pg->fd,md2->FrameOffset+(off_t)seq->First*md2->FrameSize,(off_t)seq->nFrames*md2->FrameSize,POSIX_FADV_WILLNEED);
+	}
+    }
+    return(1);
+}
+
+/* pins the sequence of frame f, paging it in if necessary. its frames stay valid until the
+   matching MD2_page_release, MD2_pose and the render functions do this themselves. a model
+   pages in one sequence at a time, other threads wait for it meanwhile */
+
+int MD2_page_acquire (struct md2_model * md2, GLint f) {
+    struct md2_paging *pg;
+    struct md2_pageseq *seq;
+
+    if(!(pg=md2->Paging)) return(1);
+    pthread_mutex_lock(&(pg->Lock));
+    seq=&(pg->Seqs[pg->Seq[f]]);
+    seq->Pins++;
+    seq->Stamp=++(pg->Clock);
+    if(!seq->Resident) {
+	if(!MD2_page_in(md2,pg->Seq[f])) {
+	    seq->Pins--;
+	    pthread_mutex_unlock(&(pg->Lock));
+	    return(0);
+	}
+	MD2_page_trim(md2);
+    }
+    pthread_mutex_unlock(&(pg->Lock));
+    return(1);
+}
+
+void MD2_page_release (struct md2_model * md2, GLint f) {
+    struct md2_paging *pg;
+
+    if(!(pg=md2->Paging)) return;
+    pthread_mutex_lock(&(pg->Lock));
+    pg->Seqs[pg->Seq[f]].Pins--;
+    MD2_page_trim(md2);
+    pthread_mutex_unlock(&(pg->Lock));
+}
+
+
+
+/* expanding all keyframes from the raw frame records, shared by both loaders.
+   on failure only the buffers allocated here are released */
+
+void MD2_freeframes (struct md2_model * md2) {
+    if(!md2->Paging) {
+	MD2_arena_drop(md2,md2->Vertex); MD2_arena_drop(md2,md2->VertexF);
+    }
+    md2->NormalIdx=NULL;
+    md2->FrameBB=NULL;
+    md2->Vertex=md2->VNormal=md2->FNormal=NULL;
+    md2->VertexF=md2->VNormalF=md2->FNormalF=NULL;
+    md2->VNormalS=md2->FNormalS=NULL;
+    MD2_delta_free(md2);
+}
+
+int MD2_expandframes (struct md2_model * md2, GLubyte * frames, struct md2_loadopts * opts) {
+    GLuint n,nv,nf;
+    struct md2_threadpool *pool;
+    struct md2_framejob job;
+
+    md2->Precision=opts?opts->precision:MD2P_DOUBLE;
+    md2->Flags=opts?opts->flags:0;
+    if(md2->Paging) md2->Flags&=~MD2L_DELTAFRAMES;
+    nv=md2->nFrames*md2->nVertices;
+    nf=md2->nFrames*md2->nFaces;
+    if(md2->Paging && !MD2_page_reserve(md2)) return(0);
+    /* one block for all of them after a miss of the cache file */
+    if(!MD2_arena_reserve(md2,MD2_arena_frames(md2,md2->Precision,md2->Flags))) return(0);
+    md2->NormalIdx=MD2_frames_alloc(md2,nv);
+    md2->FrameBB=MD2_arena_alloc(md2,md2->nFrames*sizeof(struct md2_boundingbox));
+    if(!md2->NormalIdx || !md2->FrameBB) {
+	fprintf(stderr,"Out of memory, frames (2)\n");
+	MD2_freeframes(md2); return(0);
+    }
+    if(md2->Flags&(MD2L_TABLENORMALS|MD2L_LAZYNORMALS)) {
+	if(md2->Precision!=MD2P_FLOAT && md2->Precision!=MD2P_SNORM16) md2->Precision=MD2P_DOUBLE;
+	if(md2->Precision==MD2P_DOUBLE) md2->Vertex=MD2_frames_vertex(md2,nv*sizeof(struct md2_vertexd));
+	else md2->VertexF=MD2_frames_vertex(md2,3*nv*sizeof(GLfloat));
+	n=md2->Vertex || md2->VertexF;
+    } else switch(md2->Precision) {
+	case MD2P_FLOAT:
+	    md2->VertexF=MD2_frames_vertex(md2,3*nv*sizeof(GLfloat));
+	    md2->VNormalF=MD2_frames_alloc(md2,3*nv*sizeof(GLfloat));
+	    md2->FNormalF=MD2_frames_alloc(md2,3*nf*sizeof(GLfloat));
+	    n=md2->VertexF && md2->VNormalF && md2->FNormalF;
+	    break;
+	case MD2P_SNORM16:
+	    md2->VertexF=MD2_frames_vertex(md2,3*nv*sizeof(GLfloat));
+	    md2->VNormalS=MD2_frames_alloc(md2,3*nv*sizeof(GLshort));
+	    md2->FNormalS=MD2_frames_alloc(md2,3*nf*sizeof(GLshort));
+	    n=md2->VertexF && md2->VNormalS && md2->FNormalS;
+	    break;
+	default:
+	    md2->Precision=MD2P_DOUBLE;
+	    md2->Vertex=MD2_frames_vertex(md2,nv*sizeof(struct md2_vertexd));
+	    md2->VNormal=MD2_frames_alloc(md2,nv*sizeof(struct md2_vertexd));
+	    md2->FNormal=MD2_frames_alloc(md2,nf*sizeof(struct md2_vertexd));
+	    n=md2->Vertex && md2->VNormal && md2->FNormal;
+	    break;
+    }
+    if(!n) {
+	fprintf(stderr,"Out of memory, frames (2)\n");
+	MD2_freeframes(md2); return(0);
+    }
+    if(!(md2->Flags&MD2L_TABLENORMALS) && !MD2_build_adjacency(md2)) {
+	MD2_freeframes(md2); return(0);
+    }
+    if(!(md2->Flags&MD2L_TABLENORMALS) && (md2->Flags&MD2L_LAZYNORMALS) && !MD2_ncache_create(md2,opts->normalcache)) {
+	md2->AdjFaces=md2->AdjIndex=NULL;
+	MD2_freeframes(md2); return(0);
+    }
+
+    if(md2->Paging) {
+	if(!MD2_page_layout(md2)) {
+	    md2->AdjFaces=md2->AdjIndex=NULL;
+	    MD2_ncache_free(md2); MD2_freeframes(md2); return(0);
+	}
+	MD2_build_anim_bb(md2);
+	return(1);
+    }
+
+    /* every frame is independent so they can be spread over threads */
+    job.md2=md2;
+    job.frames=frames;
+    job.first=0;
+    atomic_init(&(job.failed),0);
+    pool=NULL;
+    if(opts && opts->pool) pool=opts->pool;
+    else if(opts && opts->threads>1) pool=MD2_pool_create(opts->threads);
+    MD2_pool_run(pool,MD2_build_frame_job,&job,md2->nFrames);
+    /* the boxes are taken from the positions as they are decoded later */
+    if(!atomic_load(&(job.failed)) && (md2->Flags&MD2L_DELTAFRAMES)
+    && !MD2_delta_build(md2,frames,opts->maxerror>0?opts->maxerror:MD2_DELTAERROR)) atomic_store(&(job.failed),1);
+    if(!atomic_load(&(job.failed))) MD2_pool_run(pool,MD2_build_frame_bb,md2,md2->nFrames);
+    if(pool && pool!=opts->pool) MD2_pool_free(pool);
+    if(atomic_load(&(job.failed))) {
+	fprintf(stderr,"Out of memory, frames (3)\n");
+	md2->AdjFaces=md2->AdjIndex=NULL;
+	MD2_ncache_free(md2); MD2_freeframes(md2); return(0);
+    }
+    MD2_build_anim_bb(md2);
+    return(1);
+}
+
+
+
+/* welding: glcommand vertices with the same model vertex and texture coordinate become one,
+   the triangles are reordered with tipsify (Sander, Nehab, Barczak 2007) for a post transform
+   cache of MD2_CACHESIZE entries. the loaders decode the glcommands this way once, it needs
+   no gl context */
+
+GLfloat MD2_acmr (GLuint * index, GLuint n, GLuint nv) {
+    GLuint *stamp,c,t,misses;
+
+    if(!n) return(0);
+    if(!(stamp=calloc(nv,sizeof(GLuint)))) return(0);
+    /* a vertex is in the fifo while fewer than MD2_CACHESIZE misses happened since its own */
+    misses=0;
+    for(c=0;c<n;c++) {
+	t=index[c];
+	if(!stamp[t] || misses-stamp[t]>=MD2_CACHESIZE) stamp[t]=++misses;
+    }
+    free(stamp);
+    return(misses/(n/3.0f));
+}
+
+/* next fanning vertex: the live candidate that stays longest in the cache, else a dead end */
+
+GLint MD2_tipsify_next (GLuint * cand, GLuint nc, GLuint * live, GLuint * stamp, GLuint time, GLuint * dead, GLuint * nd, GLuint * cursor, GLuint nv) {
+    GLint n,m,p;
+    GLuint c,v;
+
+    n=-1; m=-1;
+    for(c=0;c<nc;c++) {
+	v=cand[c];
+	if(!live[v]) continue;
+	p=0;
+	if(time-stamp[v]+2*live[v]<=MD2_CACHESIZE) p=time-stamp[v];
+	if(p>m) { m=p; n=v; }
+    }
+    if(n>=0) return(n);
+    while(*nd) if(live[dead[--(*nd)]]) return(dead[*nd]);
+    while(*cursor<nv) {
+	if(live[*cursor]) return(*cursor);
+	(*cursor)++;
+    }
+    return(-1);
+}
+
+void MD2_tipsify (GLuint * index, GLuint n, GLuint nv, GLuint * out) {
+    GLuint *adjindex,*adj,*live,*stamp,*dead,*cand,*fill;
+    GLubyte *emitted;
+    GLuint c,d,t,v,nt,time,nd,nc,cursor,o;
+    GLint f;
+
+    nt=n/3;
+    adjindex=calloc(nv+1,sizeof(GLuint));
+    adj=malloc(n*sizeof(GLuint));
+    live=calloc(nv,sizeof(GLuint));
+    stamp=calloc(nv,sizeof(GLuint));
+    dead=malloc(n*sizeof(GLuint));
+    cand=malloc(n*sizeof(GLuint));
+    fill=malloc(nv*sizeof(GLuint));
+    emitted=calloc(nt,1);
+    if(!adjindex || !adj || !live || !stamp || !dead || !cand || !fill || !emitted) {
+	/* keeps the input order */
+	memcpy(out,index,n*sizeof(GLuint));
+    } else {
+	/* triangles of every vertex as compressed rows, like the adjacency of the normals */
+	for(c=0;c<n;c++) live[index[c]]++;
+	for(v=0;v<nv;v++) adjindex[v+1]=adjindex[v]+live[v];
+	memcpy(fill,adjindex,nv*sizeof(GLuint));
+	for(c=0;c<n;c++) adj[fill[index[c]]++]=c/3;
+
+	time=MD2_CACHESIZE+1; nd=0; cursor=0; o=0;
+	f=nt?index[0]:-1;
+	while(f>=0) {
+	    nc=0;
+	    for(c=adjindex[f];c<adjindex[f+1];c++) {
+		t=adj[c];
+		if(emitted[t]) continue;
+		for(d=0;d<3;d++) {
+		    v=index[3*t+d];
+		    out[o++]=v;
+		    dead[nd++]=v;
+		    cand[nc++]=v;
+		    live[v]--;
+		    if(time-stamp[v]>MD2_CACHESIZE) stamp[v]=time++;
+		}
+		emitted[t]=1;
+	    }
+	    f=MD2_tipsify_next(cand,nc,live,stamp,time,dead,&nd,&cursor,nv);
+	}
+    }
+    free(adjindex); free(adj); free(live); free(stamp);
+    free(dead); free(cand); free(fill); free(emitted);
+}
+
+/* the welded glcommands stay in the arena, only the model lets go of them */
+
+void MD2_weld_free (struct md2_model * md2) {
+    md2->Weld=NULL;
+}
+
+/* the sizes of the arrays of a weld, from the glcommands alone */
+
+void MD2_weld_count (struct md2_model * md2, GLuint * nraw, GLuint * nindices, GLuint * nstrip) {
+    GLuint i,cnt;
+    GLint fan;
+
+    *nraw=*nindices=*nstrip=0;
+    i=0; while(i<md2->nGLCommands && (cnt=md2->GLCmds[i++])) {
+	fan=((GLint)cnt<0); if(fan) cnt=-(GLint)cnt;
+	*nraw+=cnt;
+	i+=3*cnt;
+	if(cnt<3) continue;	/* no triangle, MD2_checkdata rejects these */
+	*nindices+=3*(cnt-2);
+	*nstrip+=fan?(cnt-2)/2*5+(cnt-2)%2*4:cnt+1;
+    }
+}
+
+int MD2_weld (struct md2_model * md2) {
+    struct md2_weld *w;
+    GLuint i,c,n,v,t,cnt,*head,*next,*id,*raw,*st;
+    GLint fan;
+
+    if(md2->Weld) return(1);
+    if(!(w=MD2_arena_alloc(md2,sizeof(struct md2_weld)))) {
+	fprintf(stderr,"Out of memory, weld\n");
+	return(0);
+    }
+    memset(w,0,sizeof(struct md2_weld));
+    md2->Weld=w;
+    MD2_weld_count(md2,&(w->nRaw),&(w->nIndices),&(w->nStrip));
+    if(MD2_arena_reserve(md2,MD2_ALIGNUP(w->nRaw*sizeof(GLuint))+MD2_ALIGNUP(2*w->nRaw*sizeof(GLfloat))
+			    +MD2_ALIGNUP(w->nIndices*sizeof(GLuint))+MD2_ALIGNUP(w->nStrip*sizeof(GLuint)))) {
+	w->Point=MD2_arena_alloc(md2,w->nRaw*sizeof(GLuint));
+	w->UV=MD2_arena_alloc(md2,2*w->nRaw*sizeof(GLfloat));
+	w->Index=MD2_arena_alloc(md2,w->nIndices*sizeof(GLuint));
+	w->Strip=MD2_arena_alloc(md2,w->nStrip*sizeof(GLuint));
+    }
+    head=malloc(md2->nVertices*sizeof(GLuint));
+    next=malloc(w->nRaw*sizeof(GLuint));
+    id=malloc(w->nRaw*sizeof(GLuint));
+    raw=malloc(w->nIndices*sizeof(GLuint));
+    if(!w->Point || !w->UV || !w->Index || !w->Strip || !head || !next || !id || !raw) {
+	fprintf(stderr,"Out of memory, weld\n");
+	free(head); free(next); free(id); free(raw);
+	MD2_weld_free(md2);
+	return(0);
+    }
+
+    /* welded vertices of a model vertex are chained from head, the coordinates compare bitwise */
+    memset(head,0xff,md2->nVertices*sizeof(GLuint));
+    i=0; n=0; while(i<md2->nGLCommands && (cnt=abs((GLint)md2->GLCmds[i++]))) {
+	for(c=0;c<cnt;c++,i+=3,n++) {
+	    for(v=head[md2->GLCmds[i+2]];v!=0xffffffff;v=next[v]) {
+		if(!memcmp(&(w->UV[2*v]),&(md2->GLCmds[i]),2*sizeof(GLfloat))) break;
+	    }
+	    if(v==0xffffffff) {
+		v=w->nVertices++;
+		w->Point[v]=md2->GLCmds[i+2];
+		memcpy(&(w->UV[2*v]),&(md2->GLCmds[i]),2*sizeof(GLfloat));
+		next[v]=head[w->Point[v]];
+		head[w->Point[v]]=v;
+	    }
+	    id[n]=v;
+	}
+    }
+    w->Last=n?id[n-1]:0;
+
+    /* the strips and fans become one triangle list, raw keeps the unwelded one for comparison.
+       a fan pair (0,t+1,t+2) (0,t+2,t+3) is the strip t+1,t+2,0,t+3 */
+    i=0; v=0; n=0; st=w->Strip; while(i<md2->nGLCommands && (cnt=md2->GLCmds[i++])) {
+	fan=((GLint)cnt<0); if(fan) cnt=-(GLint)cnt;
+	for(t=0;t+2<cnt;t++,n+=3) {
+	    if(fan) {
+		raw[n]=v; raw[n+1]=v+t+1; raw[n+2]=v+t+2;
+	    } else if(t&1) {
+		raw[n]=v+t+1; raw[n+1]=v+t; raw[n+2]=v+t+2;
+	    } else {
+		raw[n]=v+t; raw[n+1]=v+t+1; raw[n+2]=v+t+2;
+	    }
+	}
+	if(fan) {
+	    for(t=0;t+2<cnt;t+=2) {
+		*st++=id[v+t+1]; *st++=id[v+t+2]; *st++=id[v];
+		if(t+3<cnt) *st++=id[v+t+3];
+		*st++=MD2_RESTART;
+	    }
+	} else if(cnt>=3) {
+	    for(t=0;t<cnt;t++) *st++=id[v+t];
+	    *st++=MD2_RESTART;
+	}
+	v+=cnt; i+=3*cnt;
+    }
+    w->ACMRBefore=MD2_acmr(raw,w->nIndices,w->nRaw);
+    for(c=0;c<w->nIndices;c++) raw[c]=id[raw[c]];
+    MD2_tipsify(raw,w->nIndices,w->nVertices,w->Index);
+    w->ACMRAfter=MD2_acmr(w->Index,w->nIndices,w->nVertices);
+    free(head); free(next); free(id); free(raw);
+    return(1);
+}
+
+
+
+/* preprocessed model cache: everything the loaders derive from the frame records of a .md2 file
+   (expanded frames, normals, bounding boxes, adjacency, welded glcommands) in one file laid out
+   for mapping. a header keyed by a hash of the source file and the options that change the
+   derived data, then the arrays, each on a MD2C_ALIGN boundary. a loaded model uses the arrays
+   in place, so a warm start costs little more than paging them in. the arrays are hashed too
+   and their indices checked before use, a damaged file is rebuilt like a missing one */
+
+#define MD2C_IDENT		0x4332444d	/* "MD2C" */
+#define MD2C_VERSION		2
+#define MD2C_ALIGN		64
+#define MD2C_ABI		(sizeof(struct md2_vertexd)|sizeof(struct md2_boundingbox)<<8|sizeof(GLfloat)<<16|sizeof(GLshort)<<24)
+#define MD2_HASHSEED		0xcbf29ce484222325ULL
+
+#define MD2C_VERTEX		0
+#define MD2C_VNORMAL		1
+#define MD2C_FNORMAL		2
+#define MD2C_NORMALIDX		3
+#define MD2C_FRAMEBB		4
+#define MD2C_ADJINDEX		5
+#define MD2C_ADJFACES		6
+#define MD2C_WELDPOINT		7
+#define MD2C_WELDUV		8
+#define MD2C_WELDINDEX		9
+#define MD2C_WELDSTRIP		10
+#define MD2C_SECTIONS		11
+
+struct md2_cacheheader {
+    GLuint		Ident;
+    GLuint		Version;
+    GLuint		ABI;
+    GLint		Precision;
+    GLint		Flags;		/* MD2L_TABLENORMALS and MD2L_LAZYNORMALS */
+    GLuint		nVertices;
+    GLuint		nFaces;
+    GLuint		nFrames;
+    unsigned long long	Hash;		/* fnv-1a of the whole source file */
+    unsigned long long	SourceSize;
+    unsigned long long	PayloadHash;	/* fnv-1a of the sections in order, without padding */
+    GLuint		nWeldVertices,nWeldIndices,nWeldRaw,nWeldStrip,WeldLast;
+    GLfloat		ACMRBefore,ACMRAfter;
+    unsigned long long	Offset[MD2C_SECTIONS];
+    unsigned long long	Size[MD2C_SECTIONS];
+};
+
+unsigned long long MD2_hash (const GLubyte * p, size_t n, unsigned long long h) {
+    for(;n;n--) h=(h^*p++)*0x100000001b3ULL;
+    return(h);
+}
+
+unsigned long long MD2_hashfile (FILE * file) {
+    GLubyte buf[16384];
+    unsigned long long h;
+    size_t n;
+
+    h=MD2_HASHSEED;
+    fseek(file,0,SEEK_SET);
+    while((n=fread(buf,1,sizeof(buf),file))) h=MD2_hash(buf,n,h);
+    return(h);
+}
+
+/* the key of a cache file besides the source hash, the loaders fall back to double precision */
+
+GLint MD2_cache_precision (struct md2_loadopts * opts) {
+    return((opts->precision==MD2P_FLOAT || opts->precision==MD2P_SNORM16)?opts->precision:MD2P_DOUBLE);
+}
+
+GLubyte * MD2_cache_path (GLubyte * fn, struct md2_loadopts * opts) {
+    GLubyte *path,*base;
+
+    base=fn;
+    if(opts->cachedir && strrchr(fn,'/')) base=strrchr(fn,'/')+1;
+    path=malloc((opts->cachedir?strlen(opts->cachedir)+1:0)+strlen(base)+32);
+    if(!path) return(NULL);
+    sprintf(path,"%s%s%s.%d-%d.md2c",opts->cachedir?(char *)opts->cachedir:"",opts->cachedir?"/":"",base,
+	MD2_cache_precision(opts),opts->flags&(MD2L_TABLENORMALS|MD2L_LAZYNORMALS));
+    return(path);
+}
+
+/* size of a section as the counts, precision and flags of a header require */
+
+unsigned long long MD2_cache_size (struct md2_cacheheader * h, GLint section) {
+    unsigned long long nv,nf,pv,pn;
+
+    nv=(unsigned long long)h->nFrames*h->nVertices;
+    nf=(unsigned long long)h->nFrames*h->nFaces;
+    pv=h->Precision==MD2P_DOUBLE?sizeof(struct md2_vertexd):3*sizeof(GLfloat);
+    pn=h->Precision==MD2P_DOUBLE?sizeof(struct md2_vertexd):h->Precision==MD2P_FLOAT?3*sizeof(GLfloat):3*sizeof(GLshort);
+    switch(section) {
+	case MD2C_VERTEX:	return(nv*pv);
+	case MD2C_VNORMAL:	return((h->Flags&(MD2L_TABLENORMALS|MD2L_LAZYNORMALS))?0:nv*pn);
+	case MD2C_FNORMAL:	return((h->Flags&(MD2L_TABLENORMALS|MD2L_LAZYNORMALS))?0:nf*pn);
+	case MD2C_NORMALIDX:	return(nv);
+	case MD2C_FRAMEBB:	return(h->nFrames*sizeof(struct md2_boundingbox));
+	case MD2C_ADJINDEX:	return((h->Flags&MD2L_TABLENORMALS)?0:(h->nVertices+1ULL)*sizeof(GLuint));
+	case MD2C_ADJFACES:	return((h->Flags&MD2L_TABLENORMALS)?0:3ULL*h->nFaces*sizeof(GLuint));
+	case MD2C_WELDPOINT:	return(h->nWeldVertices*sizeof(GLuint));
+	case MD2C_WELDUV:	return(2ULL*h->nWeldVertices*sizeof(GLfloat));
+	case MD2C_WELDINDEX:	return(h->nWeldIndices*sizeof(GLuint));
+	default:		return(h->nWeldStrip*sizeof(GLuint));
+    }
+}
+
+void * MD2_cache_get (struct md2_model * md2, GLint section) {
+    switch(section) {
+	case MD2C_VERTEX:	return(md2->Precision==MD2P_DOUBLE?(void *)md2->Vertex:(void *)md2->VertexF);
+	case MD2C_VNORMAL:	return(md2->VNormal?(void *)md2->VNormal:md2->VNormalF?(void *)md2->VNormalF:(void *)md2->VNormalS);
+	case MD2C_FNORMAL:	return(md2->FNormal?(void *)md2->FNormal:md2->FNormalF?(void *)md2->FNormalF:(void *)md2->FNormalS);
+	case MD2C_NORMALIDX:	return(md2->NormalIdx);
+	case MD2C_FRAMEBB:	return(md2->FrameBB);
+	case MD2C_ADJINDEX:	return(md2->AdjIndex);
+	case MD2C_ADJFACES:	return(md2->AdjFaces);
+	case MD2C_WELDPOINT:	return(md2->Weld->Point);
+	case MD2C_WELDUV:	return(md2->Weld->UV);
+	case MD2C_WELDINDEX:	return(md2->Weld->Index);
+	default:		return(md2->Weld->Strip);
+    }
+}
+
+void MD2_cache_set (struct md2_model * md2, GLint section, void * p) {
+    switch(section) {
+	case MD2C_VERTEX:
+	    if(md2->Precision==MD2P_DOUBLE) md2->Vertex=p; else md2->VertexF=p;
+	    break;
+	case MD2C_VNORMAL:
+	    if(md2->Precision==MD2P_DOUBLE) md2->VNormal=p; else if(md2->Precision==MD2P_FLOAT) md2->VNormalF=p; else md2->VNormalS=p;
+	    break;
+	case MD2C_FNORMAL:
+	    if(md2->Precision==MD2P_DOUBLE) md2->FNormal=p; else if(md2->Precision==MD2P_FLOAT) md2->FNormalF=p; else md2->FNormalS=p;
+	    break;
+	case MD2C_NORMALIDX:	md2->NormalIdx=p; break;
+	case MD2C_FRAMEBB:	md2->FrameBB=p; break;
+	case MD2C_ADJINDEX:	md2->AdjIndex=p; break;
+	case MD2C_ADJFACES:	md2->AdjFaces=p; break;
+	case MD2C_WELDPOINT:	md2->Weld->Point=p; break;
+	case MD2C_WELDUV:	md2->Weld->UV=p; break;
+	case MD2C_WELDINDEX:	md2->Weld->Index=p; break;
+	default:		md2->Weld->Strip=p; break;
+    }
+}
+
+/* drops the views into the cache file, the arrays are not freed one by one then */
+
+void MD2_cache_unmap (struct md2_model * md2) {
+    GLint c;
+
+    if(!md2->CacheMap) return;
+    for(c=0;c<MD2C_SECTIONS;c++) MD2_cache_set(md2,c,NULL);
+    munmap(md2->CacheMap,md2->CacheMapSize);
+    md2->CacheMap=NULL;
+}
+
+/* the contents of a cache file whose layout is valid: the payload hash, then every index the
+   render and pose functions follow without a bounds check of their own */
+
+int MD2_cache_check (struct md2_model * md2, struct md2_cacheheader * h, GLubyte * map) {
+    unsigned long long hash;
+    GLuint c,nraw,nindices,nstrip,*p;
+    GLubyte *ni;
+
+    hash=MD2_HASHSEED;
+    for(c=0;c<MD2C_SECTIONS;c++) hash=MD2_hash(map+h->Offset[c],h->Size[c],hash);
+    if(hash!=h->PayloadHash) return(0);
+    MD2_weld_count(md2,&nraw,&nindices,&nstrip);
+    if(	h->nWeldRaw!=nraw
+    ||	h->nWeldIndices!=nindices
+    ||	h->nWeldStrip!=nstrip
+    ||	h->nWeldVertices>nraw
+    ||	(h->nWeldVertices?h->WeldLast>=h->nWeldVertices:h->WeldLast!=0) ) return(0);
+    ni=map+h->Offset[MD2C_NORMALIDX];
+    for(c=0;c<h->Size[MD2C_NORMALIDX];c++) if(ni[c]>=MD2_NUMNORMALS) return(0);
+    p=(GLuint *)(map+h->Offset[MD2C_WELDPOINT]);
+    for(c=0;c<h->nWeldVertices;c++) if(p[c]>=md2->nVertices) return(0);
+    p=(GLuint *)(map+h->Offset[MD2C_WELDINDEX]);
+    for(c=0;c<h->nWeldIndices;c++) if(p[c]>=h->nWeldVertices) return(0);
+    p=(GLuint *)(map+h->Offset[MD2C_WELDSTRIP]);
+    for(c=0;c<h->nWeldStrip;c++) if(p[c]>=h->nWeldVertices && p[c]!=MD2_RESTART) return(0);
+    if(h->Size[MD2C_ADJINDEX]) {
+	p=(GLuint *)(map+h->Offset[MD2C_ADJINDEX]);
+	if(p[0]) return(0);
+	for(c=0;c<md2->nVertices;c++) if(p[c+1]<p[c]) return(0);
+	if(p[md2->nVertices]>3*md2->nFaces) return(0);
+	p=(GLuint *)(map+h->Offset[MD2C_ADJFACES]);
+	for(c=0;c<3*md2->nFaces;c++) if(p[c]>=md2->nFaces) return(0);
+    }
+    return(1);
+}
+
+/* fills the derived data of a checked model from its cache file, 0 if there is no valid one */
+
+int MD2_cache_load (struct md2_model * md2, GLubyte * fn, unsigned long long hash, unsigned long long size, struct md2_loadopts * opts) {
+    struct md2_cacheheader *h;
+    struct stat st;
+    GLubyte *path,*map;
+    GLint fd,c;
+
+    if(!opts || (opts->flags&(MD2L_CACHE|MD2L_DELTAFRAMES|MD2L_PAGED))!=MD2L_CACHE || !(path=MD2_cache_path(fn,opts))) return(0);
+    fd=open(path,O_RDONLY);
+    free(path);
+    if(fd<0) return(0);
+    if(fstat(fd,&st) || st.st_size<sizeof(struct md2_cacheheader)) {
+	close(fd); return(0);
+    }
+    map=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(map==MAP_FAILED) return(0);
+    h=(struct md2_cacheheader *)map;
+    if(h->Ident!=MD2C_IDENT || h->Version!=MD2C_VERSION || h->ABI!=MD2C_ABI
+    || h->Hash!=hash || h->SourceSize!=size
+    || h->Precision!=MD2_cache_precision(opts) || h->Flags!=(opts->flags&(MD2L_TABLENORMALS|MD2L_LAZYNORMALS))
+    || h->nVertices!=md2->nVertices || h->nFaces!=md2->nFaces || h->nFrames!=md2->nFrames) {
+	munmap(map,st.st_size); return(0);
+    }
+    for(c=0;c<MD2C_SECTIONS;c++) {
+	if(h->Size[c]!=MD2_cache_size(h,c) || h->Offset[c]%MD2C_ALIGN || h->Offset[c]+h->Size[c]>st.st_size) {
+	    munmap(map,st.st_size); return(0);
+	}
+    }
+    if(!MD2_cache_check(md2,h,map)) {
+	fprintf(stderr,"Damaged cache file for %s, rebuilding it\n",fn);
+	munmap(map,st.st_size); return(0);
+    }
+    if(!(md2->Weld=MD2_arena_alloc(md2,sizeof(struct md2_weld)))) {
+	munmap(map,st.st_size); return(0);
+    }
+    memset(md2->Weld,0,sizeof(struct md2_weld));
+    md2->Precision=h->Precision;
+    md2->Flags=opts->flags;
+    md2->Weld->nVertices=h->nWeldVertices;
+    md2->Weld->nIndices=h->nWeldIndices;
+    md2->Weld->nRaw=h->nWeldRaw;
+    md2->Weld->nStrip=h->nWeldStrip;
+    md2->Weld->Last=h->WeldLast;
+    md2->Weld->ACMRBefore=h->ACMRBefore;
+    md2->Weld->ACMRAfter=h->ACMRAfter;
+    for(c=0;c<MD2C_SECTIONS;c++) MD2_cache_set(md2,c,h->Size[c]?map+h->Offset[c]:NULL);
+    md2->CacheMap=map;
+    md2->CacheMapSize=st.st_size;
+    madvise(map,st.st_size,MADV_WILLNEED);
+    MD2_build_anim_bb(md2);
+    if(!(md2->Flags&MD2L_TABLENORMALS) && (md2->Flags&MD2L_LAZYNORMALS) && !MD2_ncache_create(md2,opts->normalcache)) {
+	MD2_cache_unmap(md2); MD2_weld_free(md2); return(0);
+    }
+    return(1);
+}
+
+/* header of the derived data of a model, without source key and section layout */
+
+void MD2_cache_header (struct md2_model * md2, struct md2_cacheheader * h) {
+    memset(h,0,sizeof(struct md2_cacheheader));
+    h->Ident=MD2C_IDENT;
+    h->Version=MD2C_VERSION;
+    h->ABI=MD2C_ABI;
+    h->Precision=md2->Precision;
+    h->Flags=md2->Flags&(MD2L_TABLENORMALS|MD2L_LAZYNORMALS);
+    h->nVertices=md2->nVertices;
+    h->nFaces=md2->nFaces;
+    h->nFrames=md2->nFrames;
+    h->nWeldVertices=md2->Weld->nVertices;
+    h->nWeldIndices=md2->Weld->nIndices;
+    h->nWeldRaw=md2->Weld->nRaw;
+    h->nWeldStrip=md2->Weld->nStrip;
+    h->WeldLast=md2->Weld->Last;
+    h->ACMRBefore=md2->Weld->ACMRBefore;
+    h->ACMRAfter=md2->Weld->ACMRAfter;
+}
+
+/* writes the derived data of a freshly loaded model, through a temporary file so that a reader
+   never sees half of it. a failure only costs the next start the full preprocessing */
+
+void MD2_cache_save (struct md2_model * md2, GLubyte * fn, unsigned long long hash, unsigned long long size, struct md2_loadopts * opts) {
+    struct md2_cacheheader h;
+    static const GLubyte zero[MD2C_ALIGN];
+    unsigned long long off;
+    GLubyte *path,*tmp;
+    FILE *file;
+    GLint c,ok,fd;
+
+    if(!opts || (opts->flags&(MD2L_CACHE|MD2L_DELTAFRAMES|MD2L_PAGED))!=MD2L_CACHE || !(path=MD2_cache_path(fn,opts))) return;
+    if(!(tmp=malloc(strlen(path)+8))) {
+	free(path); return;
+    }
+    sprintf(tmp,"%s.XXXXXX",path);
+    MD2_cache_header(md2,&h);
+    h.Hash=hash;
+    h.SourceSize=size;
+    h.PayloadHash=MD2_HASHSEED;
+    off=(sizeof(h)+MD2C_ALIGN-1)/MD2C_ALIGN*MD2C_ALIGN;
+    for(c=0;c<MD2C_SECTIONS;c++) {
+	h.Offset[c]=off;
+	h.Size[c]=MD2_cache_size(&h,c);
+	h.PayloadHash=MD2_hash(MD2_cache_get(md2,c),h.Size[c],h.PayloadHash);
+	off=(off+h.Size[c]+MD2C_ALIGN-1)/MD2C_ALIGN*MD2C_ALIGN;
+    }
+    /* a unique name per writer, loads of the same model on several threads may save at once.
+       mkstemp makes it private, the cache is meant to be shared like the model */
+    ok=0;
+    if((fd=mkstemp(tmp))>=0 && (fchmod(fd,0644) || !(file=fdopen(fd,"wb")))) {
+	close(fd); remove(tmp); fd=-1;
+    }
+    if(fd>=0) {
+	ok=fwrite(&h,sizeof(h),1,file)==1;
+	off=sizeof(h);
+	for(c=0;c<MD2C_SECTIONS && ok;c++) {
+	    if(h.Offset[c]>off) ok=fwrite(zero,h.Offset[c]-off,1,file)==1;
+	    if(ok && h.Size[c]) ok=fwrite(MD2_cache_get(md2,c),h.Size[c],1,file)==1;
+	    off=h.Offset[c]+h.Size[c];
+	}
+	if(fclose(file)) ok=0;
+	if(ok) ok=!rename(tmp,path);
+	if(!ok) remove(tmp);
+    }
+    if(!ok) fprintf(stderr,"Cannot write cache file %s\n",path);
+    free(tmp);
+    free(path);
+}
+
+
+
+/* loading the model through a read only mapping of the file. texture names, uvs, faces and
+   glcommands stay views into the mapping, the frames are expanded straight from it */
+
+struct md2_model * MD2_mapmodel (GLubyte * fn, struct md2_loadopts * opts) {
+    struct md2_model hd,*md2;
+    struct stat st;
+    GLubyte *map;
+    GLint fd;
+    unsigned long long hash;
+
+    fd=open(fn,O_RDONLY);
+    if(fd<0) {
+	fprintf(stderr,"Cannot load %s\n",fn);
+	return(NULL);
+    }
+    if(fstat(fd,&st) || st.st_size<MD2_HEADERSIZE) {
+	fprintf(stderr,"Read error, header\n");
+	close(fd); return(NULL);
+    }
+    map=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(map==MAP_FAILED) {
+	fprintf(stderr,"Cannot map %s\n",fn);
+	return(NULL);
+    }
+    memcpy(&hd,map,MD2_HEADERSIZE);
+    if(!MD2_checkheader(&hd,st.st_size)) {
+	munmap(map,st.st_size); return(NULL);
+    }
+    if((hd.UVOffset%__alignof__(struct md2_uv))
+    || (hd.FaceOffset%__alignof__(struct md2_face))
+    || (hd.GLCmdOffset%__alignof__(GLuint))
+    || (hd.FrameOffset%__alignof__(struct md2_frameheader))
+    || (hd.FrameSize%__alignof__(struct md2_frameheader))) {
+	fprintf(stderr,"Misaligned sections, cannot map %s\n",fn);
+	munmap(map,st.st_size); return(NULL);
+    }
+    if(!(md2=MD2_arena_create(&hd,opts,1))) {
+	munmap(map,st.st_size); return(NULL);
+    }
+    md2->Map=map;
+    md2->MapSize=st.st_size;
+    md2->TexNames=map+md2->TexOffset;
+    md2->UV=(struct md2_uv *)(map+md2->UVOffset);
+    md2->Faces=(struct md2_face *)(map+md2->FaceOffset);
+    md2->GLCmds=(GLuint *)(map+md2->GLCmdOffset);
+    if(!MD2_checkdata(md2)) {
+	munmap(map,st.st_size); MD2_arena_free(md2); return(NULL);
+    }
+    hash=(opts && (opts->flags&MD2L_CACHE))?MD2_hash(map,st.st_size,MD2_HASHSEED):0;
+    if(MD2_cache_load(md2,fn,hash,st.st_size,opts)) return(md2);
+    if(opts && (opts->flags&MD2L_PAGED) && !MD2_page_create(md2,-1,opts)) {
+	munmap(map,st.st_size); MD2_arena_free(md2); return(NULL);
+    }
+    if(!MD2_weld(md2) || !MD2_expandframes(md2,map+md2->FrameOffset,opts)) {
+	MD2_page_free(md2); munmap(map,st.st_size); MD2_arena_free(md2); return(NULL);
+    }
+    MD2_cache_save(md2,fn,hash,st.st_size,opts);
+    return(md2);
+}
+
+
+
+/* loading the model itself */
+
+struct md2_model * MD2_loadmodel_ex (GLubyte * fn, struct md2_loadopts * opts) {
+    FILE *file;
+    struct md2_model hd,*md2;
+    GLuint n;
+    GLubyte *frames;
+    unsigned long size;
+    unsigned long long hash;
+
+    if(opts && (opts->flags&MD2L_MMAP)) return(MD2_mapmodel(fn,opts));
+
+    file=fopen(fn,"rb");
+    if(!file) {
+	fprintf(stderr,"Cannot load %s\n",fn);
+	return(NULL);
+    }
+    fseek(file,0,SEEK_END);
+    size=ftell(file);
+    fseek(file,0,SEEK_SET);
+    
+    /* loading header, everything else is sized after it */
+    n=MD2_HEADERSIZE;
+    if(n!=fread((void *)&hd,1,n,file)) {
+	fprintf(stderr,"Read error, header\n");
+	fclose(file); return(NULL);
+    }
+    if(!MD2_checkheader(&hd,size) || !(md2=MD2_arena_create(&hd,opts,0))) {
+	fclose(file); return(NULL);
+    }
+
+    /* loading texture names */
+    n=64*(md2->nTextures);
+    fseek(file,md2->TexOffset,SEEK_SET);
+    if(n!=fread(md2->TexNames,1,n,file)) {
+	fprintf(stderr,"Read error, tex names\n");
+	fclose(file); MD2_arena_free(md2); return(NULL);
+    }
+    
+    /* loading texture coordinates */
+    n=2*2*(md2->nTexCoords);
+    fseek(file,md2->UVOffset,SEEK_SET);
+    if(n!=fread(md2->UV,1,n,file)) {
+	fprintf(stderr,"Read error, tex coo\n");
+	fclose(file); MD2_arena_free(md2); return(NULL);
+    }
+
+    /* loading glcommands */
+    n=4*(md2->nGLCommands);
+    fseek(file,md2->GLCmdOffset,SEEK_SET);
+    if(n!=fread(md2->GLCmds,1,n,file)) {
+	fprintf(stderr,"Read error, glcommands\n");
+	fclose(file); MD2_arena_free(md2); return(NULL);
+    }
+
+    /* loading faces */
+    n=2*6*(md2->nFaces);
+    fseek(file,md2->FaceOffset,SEEK_SET);
+    if(n!=fread(md2->Faces,1,n,file)) {
+	fprintf(stderr,"Read error, faces\n");
+	fclose(file); MD2_arena_free(md2); return(NULL);
+    }
+    
+    /* a valid cache file has everything derived from the frames, they are not read then */
+    if(!MD2_checkdata(md2)) {
+	fclose(file); MD2_arena_free(md2); return(NULL);
+    }
+    hash=(opts && (opts->flags&MD2L_CACHE))?MD2_hashfile(file):0;
+    if(MD2_cache_load(md2,fn,hash,size,opts)) {
+	fclose(file); return(md2);
+    }
+
+    /* paged models keep the file open for the frames and read only their headers now */
+    if(opts && (opts->flags&MD2L_PAGED)) {
+	n=dup(fileno(file)); fclose(file);
+	if((GLint)n<0 || !MD2_page_create(md2,n,opts)) {
+	    MD2_arena_free(md2); return(NULL);
+	}
+	if(!MD2_weld(md2) || !MD2_expandframes(md2,NULL,opts)) {
+	    MD2_page_free(md2); MD2_arena_free(md2); return(NULL);
+	}
+	return(md2);
+    }
+
+    /* loading frames */
+    n=md2->FrameSize*md2->nFrames; frames=malloc(n);
+    if(!frames) {
+	fprintf(stderr,"Out of memory, frames (1)\n");
+	fclose(file); MD2_arena_free(md2); return(NULL);
+    }
+    fseek(file,md2->FrameOffset,SEEK_SET);
+    if(n!=fread(frames,1,n,file)) {
+	fprintf(stderr,"Read error, frames\n");
+	fclose(file); free(frames); MD2_arena_free(md2); return(NULL);
+    }
+    fclose(file);
+    if(!MD2_weld(md2) || !MD2_expandframes(md2,frames,opts)) {
+	free(frames); MD2_arena_free(md2); return(NULL);
+    }
+
+    free(frames);
+    MD2_cache_save(md2,fn,hash,size,opts);
+    return(md2);
+}
+
+struct md2_model * MD2_loadmodel (GLubyte * fn) {
+    return(MD2_loadmodel_ex(fn,NULL));
+}
+
+
+
+/* a model from the image of its file in memory, the image stays with the caller */
+
+struct md2_model * MD2_loadbuffer (GLubyte * fn, GLubyte * data, size_t size, struct md2_loadopts * opts) {
+    struct md2_model hd,*md2;
+    unsigned long long hash;
+
+    if(size<MD2_HEADERSIZE) {
+	fprintf(stderr,"Read error, header\n");
+	return(NULL);
+    }
+    memcpy(&hd,data,MD2_HEADERSIZE);
+    if(!MD2_checkheader(&hd,size) || !(md2=MD2_arena_create(&hd,opts,0))) return(NULL);
+    memcpy(md2->TexNames,data+md2->TexOffset,64*md2->nTextures);
+    memcpy(md2->UV,data+md2->UVOffset,2*2*md2->nTexCoords);
+    memcpy(md2->GLCmds,data+md2->GLCmdOffset,4*md2->nGLCommands);
+    memcpy(md2->Faces,data+md2->FaceOffset,2*6*md2->nFaces);
+    if(!MD2_checkdata(md2)) {
+	MD2_arena_free(md2); return(NULL);
+    }
+    hash=(opts && (opts->flags&MD2L_CACHE))?MD2_hash(data,size,MD2_HASHSEED):0;
+    if(MD2_cache_load(md2,fn,hash,size,opts)) return(md2);
+    if(!MD2_weld(md2) || !MD2_expandframes(md2,data+md2->FrameOffset,opts)) {
+	MD2_arena_free(md2); return(NULL);
+    }
+    MD2_cache_save(md2,fn,hash,size,opts);
+    return(md2);
+}
+
+
+
+/* loading many models at once, e.g. a whole map. every file is read in one piece, header and
+   sections together, and preprocessed with MD2_loadbuffer. through io_uring all reads are
+   submitted up front, MD2_URINGDEPTH files at a time, and a file is preprocessed as soon as its
+   read completes while the others are still in flight. without io_uring, and for MD2L_MMAP and
+   MD2L_PAGED which read on their own, the files are spread over a thread pool instead */
+
+#define MD2_URINGDEPTH		64
+
+struct md2_batchfile {
+    GLubyte *		Path;
+    GLint		fd;
+    GLubyte *		Data;
+    size_t		Size;
+    size_t		Done;		/* bytes read so far */
+    GLint		InFlight;	/* a read of the ring may still write to Data */
+    GLint		Finished;
+    GLdouble		Start;
+    GLdouble		Latency;
+    struct md2_model *	Model;
+};
+
+struct md2_batchload {
+    struct md2_batchfile * Files;
+    struct md2_loadopts	Opts;		/* per file, the frames of a file stay on its thread */
+    GLint *		Ready;		/* read, to be preprocessed */
+    GLint		nReady;
+};
+
+GLdouble MD2_seconds (void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return(ts.tv_sec+ts.tv_nsec/1e9);
+}
+
+int MD2_batch_open (struct md2_batchfile * bf) {
+    struct stat st;
+
+    bf->Start=MD2_seconds();
+    bf->fd=open(bf->Path,O_RDONLY);
+    if(bf->fd<0) {
+	fprintf(stderr,"Cannot load %s\n",bf->Path);
+	return(0);
+    }
+    if(fstat(bf->fd,&st) || st.st_size<MD2_HEADERSIZE) {
+	fprintf(stderr,"Read error, header\n");
+	return(0);
+    }
+    bf->Size=st.st_size;
+    if(!(bf->Data=malloc(bf->Size))) {
+	fprintf(stderr,"Out of memory, file %s\n",bf->Path);
+	return(0);
+    }
+    return(1);
+}
+
+/* reads what is missing of an opened file */
+
+void MD2_batch_pread (struct md2_batchfile * bf) {
+    ssize_t n;
+
+    while(bf->Data && bf->Done<bf->Size) {
+	n=pread(bf->fd,bf->Data+bf->Done,bf->Size-bf->Done,bf->Done);
+	if(n<0 && errno==EINTR) continue;
+	if(n<=0) break;
+	bf->Done+=n;
+    }
+}
+
+void MD2_batch_finish (struct md2_batchfile * bf, struct md2_loadopts * opts) {
+    if(bf->Data && bf->Done==bf->Size) bf->Model=MD2_loadbuffer(bf->Path,bf->Data,bf->Size,opts);
+    else if(bf->Data) fprintf(stderr,"Read error, %s\n",bf->Path);
+    free(bf->Data);
+    bf->Data=NULL;
+    if(bf->fd>=0) close(bf->fd);
+    bf->fd=-1;
+    bf->Latency=MD2_seconds()-bf->Start;
+    bf->Finished=1;
+}
+
+void MD2_batch_job (void * arg, GLint n) {
+    struct md2_batchload *b;
+    struct md2_batchfile *bf;
+    struct stat st;
+
+    b=arg;
+    bf=b->Files+n;
+    if(b->Opts.flags&(MD2L_MMAP|MD2L_PAGED)) {
+	/* the file is mapped or read in parts by the loader, its size stands for the bytes read */
+	bf->Start=MD2_seconds();
+	bf->Model=MD2_loadmodel_ex(bf->Path,&(b->Opts));
+	if(bf->Model && !stat(bf->Path,&st)) bf->Done=st.st_size;
+	bf->Latency=MD2_seconds()-bf->Start;
+	bf->Finished=1;
+	return;
+    }
+    if(MD2_batch_open(bf)) MD2_batch_pread(bf);
+    MD2_batch_finish(bf,&(b->Opts));
+}
+
+void MD2_batch_ready (void * arg, GLint n) {
+    struct md2_batchload *b;
+
+    b=arg;
+    MD2_batch_finish(b->Files+b->Ready[n],&(b->Opts));
+}
+
+#ifdef MD2_URING
+
+/* a bare io_uring over the system calls: the submission and completion rings and the array
+   of submission entries are mapped from the kernel, the rings' heads and tails are shared */
+
+struct md2_uring {
+    GLint		fd;
+    GLubyte *		SQ;
+    GLubyte *		CQ;		/* the same mapping as SQ with IORING_FEAT_SINGLE_MMAP */
+    size_t		SQSize;
+    size_t		CQSize;
+    struct io_uring_sqe *	SQEs;
+    size_t		SQESize;
+    GLuint *		SQHead;
+    GLuint *		SQTail;
+    GLuint *		SQMask;
+    GLuint *		SQArray;
+    GLuint *		CQHead;
+    GLuint *		CQTail;
+    GLuint *		CQMask;
+    struct io_uring_cqe *	CQEs;
+    GLuint		Pending;	/* entries not yet submitted */
+};
+
+void MD2_uring_free (struct md2_uring * u) {
+    if(u->SQEs) munmap(u->SQEs,u->SQESize);
+    if(u->CQ && u->CQ!=u->SQ) munmap(u->CQ,u->CQSize);
+    if(u->SQ) munmap(u->SQ,u->SQSize);
+    close(u->fd);
+}
+
+int MD2_uring_create (struct md2_uring * u, GLuint entries) {
+    struct io_uring_params p;
+    void *m;
+
+    memset(u,0,sizeof(struct md2_uring));
+    memset(&p,0,sizeof(p));
+    u->fd=syscall(__NR_io_uring_setup,entries,&p);
+    if(u->fd<0) return(0);
+    u->SQSize=p.sq_off.array+p.sq_entries*sizeof(GLuint);
+    u->CQSize=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+    if(p.features&IORING_FEAT_SINGLE_MMAP) u->SQSize=u->CQSize=u->SQSize>u->CQSize?u->SQSize:u->CQSize;
+    m=mmap(NULL,u->SQSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,u->fd,IORING_OFF_SQ_RING);
+    if(m==MAP_FAILED) {
+	MD2_uring_free(u); return(0);
+    }
+    u->SQ=m;
+    if(p.features&IORING_FEAT_SINGLE_MMAP) {
+	u->CQ=u->SQ;
+    } else {
+	m=mmap(NULL,u->CQSize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,u->fd,IORING_OFF_CQ_RING);
+	if(m==MAP_FAILED) {
+	    MD2_uring_free(u); return(0);
+	}
+	u->CQ=m;
+    }
+    u->SQESize=p.sq_entries*sizeof(struct io_uring_sqe);
+    m=mmap(NULL,u->SQESize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,u->fd,IORING_OFF_SQES);
+    if(m==MAP_FAILED) {
+	MD2_uring_free(u); return(0);
+    }
+    u->SQEs=m;
+    u->SQHead=(GLuint *)(u->SQ+p.sq_off.head);
+    u->SQTail=(GLuint *)(u->SQ+p.sq_off.tail);
+    u->SQMask=(GLuint *)(u->SQ+p.sq_off.ring_mask);
+    u->SQArray=(GLuint *)(u->SQ+p.sq_off.array);
+    u->CQHead=(GLuint *)(u->CQ+p.cq_off.head);
+    u->CQTail=(GLuint *)(u->CQ+p.cq_off.tail);
+    u->CQMask=(GLuint *)(u->CQ+p.cq_off.ring_mask);
+    u->CQEs=(struct io_uring_cqe *)(u->CQ+p.cq_off.cqes);
+    return(1);
+}
+
+/* queues a read, submitted by the next MD2_uring_enter. returns 0 if the ring is full */
+
+int MD2_uring_read (struct md2_uring * u, GLint fd, void * buf, size_t len, size_t off, GLuint tag) {
+    struct io_uring_sqe *sqe;
+    GLuint tail,i;
+
+    tail=*(u->SQTail);
+    if(tail-__atomic_load_n(u->SQHead,__ATOMIC_ACQUIRE)>*(u->SQMask)) return(0);
+    i=tail&*(u->SQMask);
+    sqe=u->SQEs+i;
+    memset(sqe,0,sizeof(struct io_uring_sqe));
+    sqe->opcode=IORING_OP_READ;
+    sqe->fd=fd;
+    sqe->addr=(unsigned long)buf;
+    sqe->len=len>0x7ffff000?0x7ffff000:len;
+    sqe->off=off;
+    sqe->user_data=tag;
+    u->SQArray[i]=i;
+    __atomic_store_n(u->SQTail,tail+1,__ATOMIC_RELEASE);
+    u->Pending++;
+    return(1);
+}
+
+/* submits the queued reads and waits for wait completions */
+
+int MD2_uring_enter (struct md2_uring * u, GLuint wait) {
+    long r;
+
+    for(;;) {
+	r=syscall(__NR_io_uring_enter,u->fd,u->Pending,wait,wait?IORING_ENTER_GETEVENTS:0,NULL,0);
+	if(r>=0) break;
+	if(errno!=EINTR) {
+	    fprintf(stderr,"io_uring error %d\n",errno);
+	    return(0);
+	}
+    }
+    u->Pending-=r;
+    return(1);
+}
+
+/* returns 0 if there is no io_uring. a read that fails, e.g. as the kernel is too old for
+   IORING_OP_READ, or comes up short is finished with pread. the files read are preprocessed
+   on the pool, one per job. after an error of the ring itself the reads in flight are waited
+   for if it still allows that, otherwise their buffers are given up as the kernel may still
+   write to them */
+
+int MD2_batch_uring (struct md2_batchload * b, GLint n, struct md2_threadpool * pool) {
+    struct md2_uring u;
+    struct md2_batchfile *bf,*files;
+    struct io_uring_cqe *cqe;
+    GLint next,inflight,broken,c;
+    GLuint head;
+
+    if(!MD2_uring_create(&u,MD2_URINGDEPTH)) return(0);
+    files=b->Files;
+    next=inflight=broken=0;
+    while(next<n || inflight || b->nReady) {
+	while(next<n && inflight<MD2_URINGDEPTH) {
+	    bf=files+next;
+	    if(!MD2_batch_open(bf)) {
+		MD2_batch_finish(bf,&(b->Opts));
+	    } else if(MD2_uring_read(&u,bf->fd,bf->Data,bf->Size,0,next)) {
+		bf->InFlight=1;
+		inflight++;
+	    } else {
+		MD2_batch_pread(bf);
+		b->Ready[b->nReady++]=next;
+	    }
+	    next++;
+	}
+	if(!MD2_uring_enter(&u,0)) { broken=1; break; }
+	/* the reads in flight go on meanwhile */
+	MD2_pool_run(pool,MD2_batch_ready,b,b->nReady);
+	b->nReady=0;
+	if(!inflight) continue;
+	if(!MD2_uring_enter(&u,1)) { broken=1; break; }
+	head=*(u.CQHead);
+	while(head!=__atomic_load_n(u.CQTail,__ATOMIC_ACQUIRE)) {
+	    cqe=u.CQEs+(head&*(u.CQMask));
+	    bf=files+cqe->user_data;
+	    if(cqe->res>0) bf->Done+=cqe->res;
+	    if(cqe->res<=0 || bf->Done==bf->Size
+	    || !MD2_uring_read(&u,bf->fd,bf->Data+bf->Done,bf->Size-bf->Done,bf->Done,cqe->user_data)) {
+		bf->InFlight=0;
+		MD2_batch_pread(bf);
+		b->Ready[b->nReady++]=cqe->user_data;
+		inflight--;
+	    }
+	    head++;
+	}
+	__atomic_store_n(u.CQHead,head,__ATOMIC_RELEASE);
+    }
+    while(broken && inflight && MD2_uring_enter(&u,1)) {
+	head=*(u.CQHead);
+	while(head!=__atomic_load_n(u.CQTail,__ATOMIC_ACQUIRE)) {
+	    cqe=u.CQEs+(head&*(u.CQMask));
+	    bf=files+cqe->user_data;
+	    if(cqe->res>0) bf->Done+=cqe->res;
+	    bf->InFlight=0;
+	    inflight--;
+	    head++;
+	}
+	__atomic_store_n(u.CQHead,head,__ATOMIC_RELEASE);
+    }
+    MD2_uring_free(&u);
+    /* only after an error of the ring itself */
+    for(c=0;c<n;c++) {
+	if(files[c].Finished) continue;
+	if(files[c].InFlight) {
+	    fprintf(stderr,"Read error, %s\n",files[c].Path);
+	    files[c].Data=NULL;
+	}
+	else if(files[c].Data || MD2_batch_open(files+c)) MD2_batch_pread(files+c);
+	MD2_batch_finish(files+c,&(b->Opts));
+    }
+    return(1);
+}
+
+#else
+
+int MD2_batch_uring (struct md2_batchload * b, GLint n, struct md2_threadpool * pool) {
+    return(0);
+}
+
+#endif
+
+int MD2_batch_cmp (const void * a, const void * b) {
+    return((*(GLdouble *)a>*(GLdouble *)b)-(*(GLdouble *)a<*(GLdouble *)b));
+}
+
+/* loads the n files of fn with opts (may be NULL) into models, NULL for those that failed.
+   stats (may be NULL) gets the throughput and the latency distribution. returns the number
+   of models loaded */
+
+int MD2_loadmodels (GLubyte ** fn, GLint n, struct md2_loadopts * opts, struct md2_model ** models, struct md2_loadstats * stats) {
+    struct md2_batchload b;
+    struct md2_loadstats st;
+    struct md2_threadpool *pool,*run;
+    GLdouble t0,*lat;
+    GLint c;
+
+    t0=MD2_seconds();
+    memset(&st,0,sizeof(st));
+    b.Files=calloc(n+1,sizeof(struct md2_batchfile));
+    b.Ready=malloc((n+1)*sizeof(GLint));
+    b.nReady=0;
+    lat=malloc((n+1)*sizeof(GLdouble));
+    if(!b.Files || !b.Ready || !lat) {
+	fprintf(stderr,"Out of memory, batch\n");
+	free(b.Files); free(b.Ready); free(lat); return(0);
+    }
+    for(c=0;c<n;c++) {
+	b.Files[c].Path=fn[c];
+	b.Files[c].fd=-1;
+    }
+    if(opts) b.Opts=*opts; else memset(&(b.Opts),0,sizeof(b.Opts));
+    /* files in parallel rather than the frames of one file */
+    pool=NULL;
+    if(!(run=b.Opts.pool)) run=pool=MD2_pool_create(b.Opts.threads>1?b.Opts.threads:0);
+    b.Opts.pool=NULL;
+    b.Opts.threads=0;
+    if(!(b.Opts.flags&(MD2L_MMAP|MD2L_PAGED))) st.uring=MD2_batch_uring(&b,n,run);
+    if(!st.uring) MD2_pool_run(run,MD2_batch_job,&b,n);
+    if(pool) MD2_pool_free(pool);
+
+    for(c=0;c<n;c++) {
+	models[c]=b.Files[c].Model;
+	st.bytes+=b.Files[c].Done;
+	if(models[c]) lat[st.loaded++]=b.Files[c].Latency; else st.failed++;
+    }
+    if(st.loaded) {
+	qsort(lat,st.loaded,sizeof(GLdouble),MD2_batch_cmp);
+	st.latency[0]=lat[0];
+	st.latency[1]=lat[(st.loaded*50+99)/100-1];
+	st.latency[2]=lat[(st.loaded*90+99)/100-1];
+	st.latency[3]=lat[(st.loaded*99+99)/100-1];
+	st.latency[4]=lat[st.loaded-1];
+    }
+    st.seconds=MD2_seconds()-t0;
+    st.mbps=st.seconds>0?st.bytes/st.seconds/1e6:0;
+    free(b.Files); free(b.Ready); free(lat);
+    if(stats) *stats=st;
+    return(st.loaded);
+}
+
+
+
+/* pose evaluation: interpolates the positions and normals of a whole frame into caller provided
+   float arrays without any gl call, so it works without a context, e.g. on a server. the arrays
+   are SoA like the compact frames: all x, then all y, then all z. the kernels are vectorized,
+   the widest instruction set the cpu supports is picked on first use, MD2_pose_isa forces one */
+
+#define MD2I_SCALAR		0
+#define MD2I_SSE2		1
+#define MD2I_AVX2		2
+#define MD2I_AVX512		3
+
+const char *MD2I_NAME[]={"scalar","sse2","avx2","avx512"};
+
+#define MD2_SNORM		(1.0f/32767.0f)
+#define MD2_POSECHUNK		256	/* vertices per deinterleaving step of double frames */
+
+struct md2_kernels {
+    void (*lerp_f)(const GLfloat *, const GLfloat *, GLfloat, GLfloat *, GLuint);
+    void (*lerp_s)(const GLshort *, const GLshort *, GLfloat, GLfloat *, GLuint);
+    void (*lerp_d)(const GLdouble *, const GLdouble *, GLdouble, GLfloat *, GLuint);
+    void (*bounds)(const GLfloat *, GLuint, GLfloat *, GLfloat *);
+    void (*delta_b)(const GLfloat *, const signed char *, GLfloat, GLfloat *, GLuint);
+    void (*delta_s)(const GLfloat *, const GLshort *, GLfloat, GLfloat *, GLuint);
+};
+
+/* none of the kernels may contract a multiply and add into fma, whatever the flags of the
+   program including this file, or the levels would differ */
+
+#pragma GCC push_options
+#pragma GCC optimize ("fp-contract=off")
+
+/* scalar kernels, also used for the tails of the vector ones. r=a+s*(b-a) over n elements,
+   the vector kernels do the same operations in the same order, so all levels agree bit for bit */
+
+void MD2_lerp_f (const GLfloat * a, const GLfloat * b, GLfloat s, GLfloat * r, GLuint n) {
+    GLuint c;
+
+    for(c=0;c<n;c++) r[c]=a[c]+s*(b[c]-a[c]);
+}
+
+void MD2_lerp_s (const GLshort * a, const GLshort * b, GLfloat s, GLfloat * r, GLuint n) {
+    GLuint c;
+    GLfloat fa,fb;
+
+    for(c=0;c<n;c++) {
+	fa=a[c]*MD2_SNORM; fb=b[c]*MD2_SNORM;
+	r[c]=fa+s*(fb-fa);
+    }
+}
+
+void MD2_lerp_d (const GLdouble * a, const GLdouble * b, GLdouble s, GLfloat * r, GLuint n) {
+    GLuint c;
+
+    for(c=0;c<n;c++) r[c]=a[c]+s*(b[c]-a[c]);
+}
+
+void MD2_bounds (const GLfloat * a, GLuint n, GLfloat * lo, GLfloat * hi) {
+    GLuint c;
+
+    for(c=0;c<n;c++) {
+	if(a[c]<*lo) *lo=a[c];
+	if(a[c]>*hi) *hi=a[c];
+    }
+}
+
+/* decoding compressed positions, r=ref+step*code */
+
+void MD2_delta_b (const GLfloat * ref, const signed char * code, GLfloat step, GLfloat * r, GLuint n) {
+    GLuint c;
+
+    for(c=0;c<n;c++) r[c]=ref[c]+step*code[c];
+}
+
+void MD2_delta_s (const GLfloat * ref, const GLshort * code, GLfloat step, GLfloat * r, GLuint n) {
+    GLuint c;
+
+    for(c=0;c<n;c++) r[c]=ref[c]+step*code[c];
+}
+
+#ifdef MD2_X86
+
+__attribute__((target("sse2"))) void MD2_lerp_f_sse2 (const GLfloat * a, const GLfloat * b, GLfloat s, GLfloat * r, GLuint n) {
+    GLuint c;
+    __m128 vs,va;
+
+    vs=_mm_set1_ps(s);
+    for(c=0;c+4<=n;c+=4) {
+	va=_mm_loadu_ps(a+c);
+	_mm_storeu_ps(r+c,_mm_add_ps(va,_mm_mul_ps(vs,_mm_sub_ps(_mm_loadu_ps(b+c),va))));
+    }
+    MD2_lerp_f(a+c,b+c,s,r+c,n-c);
+}
+
+__attribute__((target("sse2"))) __m128 MD2_snorm_sse2 (__m128i v) {
+    return(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(v,16)),_mm_set1_ps(MD2_SNORM)));
+}
+
+__attribute__((target("sse2"))) void MD2_lerp_s_sse2 (const GLshort * a, const GLshort * b, GLfloat s, GLfloat * r, GLuint n) {
+    GLuint c;
+    __m128i ia,ib;
+    __m128 vs,fa,fb;
+
+    vs=_mm_set1_ps(s);
+    for(c=0;c+8<=n;c+=8) {
+	ia=_mm_loadu_si128((const __m128i *)(a+c));
+	ib=_mm_loadu_si128((const __m128i *)(b+c));
+	fa=MD2_snorm_sse2(_mm_unpacklo_epi16(ia,ia));
+	fb=MD2_snorm_sse2(_mm_unpacklo_epi16(ib,ib));
+	_mm_storeu_ps(r+c,_mm_add_ps(fa,_mm_mul_ps(vs,_mm_sub_ps(fb,fa))));
+	fa=MD2_snorm_sse2(_mm_unpackhi_epi16(ia,ia));
+	fb=MD2_snorm_sse2(_mm_unpackhi_epi16(ib,ib));
+	_mm_storeu_ps(r+c+4,_mm_add_ps(fa,_mm_mul_ps(vs,_mm_sub_ps(fb,fa))));
+    }
+    MD2_lerp_s(a+c,b+c,s,r+c,n-c);
+}
+
+__attribute__((target("sse2"))) void MD2_lerp_d_sse2 (const GLdouble * a, const GLdouble * b, GLdouble s, GLfloat * r, GLuint n) {
+    GLuint c;
+    __m128d vs,va,lo,hi;
+
+    vs=_mm_set1_pd(s);
+    for(c=0;c+4<=n;c+=4) {
+	va=_mm_loadu_pd(a+c);
+	lo=_mm_add_pd(va,_mm_mul_pd(vs,_mm_sub_pd(_mm_loadu_pd(b+c),va)));
+	va=_mm_loadu_pd(a+c+2);
+	hi=_mm_add_pd(va,_mm_mul_pd(vs,_mm_sub_pd(_mm_loadu_pd(b+c+2),va)));
+	_mm_storeu_ps(r+c,_mm_movelh_ps(_mm_cvtpd_ps(lo),_mm_cvtpd_ps(hi)));
+    }
+    MD2_lerp_d(a+c,b+c,s,r+c,n-c);
+}
+
+__attribute__((target("sse2"))) void MD2_bounds_sse2 (const GLfloat * a, GLuint n, GLfloat * lo, GLfloat * hi) {
+    GLuint c;
+    GLfloat l[4],h[4];
+    __m128 vl,vh,va;
+
+    vl=_mm_set1_ps(*lo); vh=_mm_set1_ps(*hi);
+    for(c=0;c+4<=n;c+=4) {
+	va=_mm_loadu_ps(a+c);
+	vl=_mm_min_ps(vl,va); vh=_mm_max_ps(vh,va);
+    }
+    _mm_storeu_ps(l,vl); _mm_storeu_ps(h,vh);
+    MD2_bounds(l,4,lo,hi);
+    MD2_bounds(h,4,lo,hi);
+    MD2_bounds(a+c,n-c,lo,hi);
+}
+
+__attribute__((target("sse2"))) void MD2_delta_b_sse2 (const GLfloat * ref, const signed char * code, GLfloat step, GLfloat * r, GLuint n) {
+    GLuint c,i;
+    __m128i v,w[2];
+    __m128 vs;
+
+    vs=_mm_set1_ps(step);
+    for(c=0;c+16<=n;c+=16) {
+	v=_mm_loadu_si128((const __m128i *)(code+c));
+	w[0]=_mm_unpacklo_epi8(v,v); w[1]=_mm_unpackhi_epi8(v,v);
+	for(i=0;i<2;i++) {
+	    _mm_storeu_ps(r+c+8*i,_mm_add_ps(_mm_loadu_ps(ref+c+8*i),_mm_mul_ps(vs,_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(w[i],w[i]),24)))));
+	    _mm_storeu_ps(r+c+8*i+4,_mm_add_ps(_mm_loadu_ps(ref+c+8*i+4),_mm_mul_ps(vs,_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(w[i],w[i]),24)))));
+	}
+    }
+    MD2_delta_b(ref+c,code+c,step,r+c,n-c);
+}
+
+__attribute__((target("sse2"))) void MD2_delta_s_sse2 (const GLfloat * ref, const GLshort * code, GLfloat step, GLfloat * r, GLuint n) {
+    GLuint c;
+    __m128i v;
+    __m128 vs;
+
+    vs=_mm_set1_ps(step);
+    for(c=0;c+8<=n;c+=8) {
+	v=_mm_loadu_si128((const __m128i *)(code+c));
+	_mm_storeu_ps(r+c,_mm_add_ps(_mm_loadu_ps(ref+c),_mm_mul_ps(vs,_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v,v),16)))));
+	_mm_storeu_ps(r+c+4,_mm_add_ps(_mm_loadu_ps(ref+c+4),_mm_mul_ps(vs,_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v,v),16)))));
+    }
+    MD2_delta_s(ref+c,code+c,step,r+c,n-c);
+}
+
+__attribute__((target("avx2"))) void MD2_lerp_f_avx2 (const GLfloat * a, const GLfloat * b, GLfloat s, GLfloat * r, GLuint n) {
+    GLuint c;
+    __m256 vs,va;
+
+    vs=_mm256_set1_ps(s);
+    for(c=0;c+8<=n;c+=8) {
+	va=_mm256_loadu_ps(a+c);
+	_mm256_storeu_ps(r+c,_mm256_add_ps(va,_mm256_mul_ps(vs,_mm256_sub_ps(_mm256_loadu_ps(b+c),va))));
+    }
+    MD2_lerp_f(a+c,b+c,s,r+c,n-c);
+}
+
+__attribute__((target("avx2"))) void MD2_lerp_s_avx2 (const GLshort * a, const GLshort * b, GLfloat s, GLfloat * r, GLuint n) {
+    GLuint c;
+    __m256 vs,vk,fa,fb;
+
+    vs=_mm256_set1_ps(s); vk=_mm256_set1_ps(MD2_SNORM);
+    for(c=0;c+8<=n;c+=8) {
+	fa=_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(a+c)))),vk);
+	fb=_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(b+c)))),vk);
+	_mm256_storeu_ps(r+c,_mm256_add_ps(fa,_mm256_mul_ps(vs,_mm256_sub_ps(fb,fa))));
+    }
+    MD2_lerp_s(a+c,b+c,s,r+c,n-c);
+}
+
+__attribute__((target("avx2"))) void MD2_lerp_d_avx2 (const GLdouble * a, const GLdouble * b, GLdouble s, GLfloat * r, GLuint n) {
+    GLuint c;
+    __m256d vs,va;
+
+    vs=_mm256_set1_pd(s);
+    for(c=0;c+4<=n;c+=4) {
+	va=_mm256_loadu_pd(a+c);
+	_mm_storeu_ps(r+c,_mm256_cvtpd_ps(_mm256_add_pd(va,_mm256_mul_pd(vs,_mm256_sub_pd(_mm256_loadu_pd(b+c),va)))));
+    }
+    MD2_lerp_d(a+c,b+c,s,r+c,n-c);
+}
+
+__attribute__((target("avx2"))) void MD2_bounds_avx2 (const GLfloat * a, GLuint n, GLfloat * lo, GLfloat * hi) {
+    GLuint c;
+    GLfloat l[8],h[8];
+    __m256 vl,vh,va;
+
+    vl=_mm256_set1_ps(*lo); vh=_mm256_set1_ps(*hi);
+    for(c=0;c+8<=n;c+=8) {
+	va=_mm256_loadu_ps(a+c);
+	vl=_mm256_min_ps(vl,va); vh=_mm256_max_ps(vh,va);
+    }
+    _mm256_storeu_ps(l,vl); _mm256_storeu_ps(h,vh);
+    MD2_bounds(l,8,lo,hi);
+    MD2_bounds(h,8,lo,hi);
+    MD2_bounds(a+c,n-c,lo,hi);
+}
+
+__attribute__((target("avx2"))) void MD2_delta_b_avx2 (const GLfloat * ref, const signed char * code, GLfloat step, GLfloat * r, GLuint n) {
+    GLuint c;
+    __m256 vs;
+
+    vs=_mm256_set1_ps(step);
+    for(c=0;c+8<=n;c+=8) {
+	_mm256_storeu_ps(r+c,_mm256_add_ps(_mm256_loadu_ps(ref+c),_mm256_mul_ps(vs,_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)(code+c)))))));
+    }
+    MD2_delta_b(ref+c,code+c,step,r+c,n-c);
+}
+
+__attribute__((target("avx2"))) void MD2_delta_s_avx2 (const GLfloat * ref, const GLshort * code, GLfloat step, GLfloat * r, GLuint n) {
+    GLuint c;
+    __m256 vs;
+
+    vs=_mm256_set1_ps(step);
+    for(c=0;c+8<=n;c+=8) {
+	_mm256_storeu_ps(r+c,_mm256_add_ps(_mm256_loadu_ps(ref+c),_mm256_mul_ps(vs,_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(code+c)))))));
+    }
+    MD2_delta_s(ref+c,code+c,step,r+c,n-c);
+}
+
+__attribute__((target("avx512f"))) void MD2_lerp_f_avx512 (const GLfloat * a, const GLfloat * b, GLfloat s, GLfloat * r, GLuint n) {
+    GLuint c;
+    __m512 vs,va;
+
+    vs=_mm512_set1_ps(s);
+    for(c=0;c+16<=n;c+=16) {
+	va=_mm512_loadu_ps(a+c);
+	_mm512_storeu_ps(r+c,_mm512_add_ps(va,_mm512_mul_ps(vs,_mm512_sub_ps(_mm512_loadu_ps(b+c),va))));
+    }
+    MD2_lerp_f(a+c,b+c,s,r+c,n-c);
+}
+
+__attribute__((target("avx512f"))) void MD2_lerp_s_avx512 (const GLshort * a, const GLshort * b, GLfloat s, GLfloat * r, GLuint n) {
+    GLuint c;
+    __m512 vs,vk,fa,fb;
+
+    vs=_mm512_set1_ps(s); vk=_mm512_set1_ps(MD2_SNORM);
+    for(c=0;c+16<=n;c+=16) {
+	fa=_mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *)(a+c)))),vk);
+	fb=_mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *)(b+c)))),vk);
+	_mm512_storeu_ps(r+c,_mm512_add_ps(fa,_mm512_mul_ps(vs,_mm512_sub_ps(fb,fa))));
+    }
+    MD2_lerp_s(a+c,b+c,s,r+c,n-c);
+}
+
+__attribute__((target("avx512f"))) void MD2_lerp_d_avx512 (const GLdouble * a, const GLdouble * b, GLdouble s, GLfloat * r, GLuint n) {
+    GLuint c;
+    __m512d vs,va;
+
+    vs=_mm512_set1_pd(s);
+    for(c=0;c+8<=n;c+=8) {
+	va=_mm512_loadu_pd(a+c);
+	_mm256_storeu_ps(r+c,_mm512_cvtpd_ps(_mm512_add_pd(va,_mm512_mul_pd(vs,_mm512_sub_pd(_mm512_loadu_pd(b+c),va)))));
+    }
+    MD2_lerp_d(a+c,b+c,s,r+c,n-c);
+}
+
+__attribute__((target("avx512f"))) void MD2_bounds_avx512 (const GLfloat * a, GLuint n, GLfloat * lo, GLfloat * hi) {
+    GLuint c;
+    GLfloat l[16],h[16];
+    __m512 vl,vh,va;
+
+    vl=_mm512_set1_ps(*lo); vh=_mm512_set1_ps(*hi);
+    for(c=0;c+16<=n;c+=16) {
+	va=_mm512_loadu_ps(a+c);
+	vl=_mm512_min_ps(vl,va); vh=_mm512_max_ps(vh,va);
+    }
+    _mm512_storeu_ps(l,vl); _mm512_storeu_ps(h,vh);
+    MD2_bounds(l,16,lo,hi);
+    MD2_bounds(h,16,lo,hi);
+    MD2_bounds(a+c,n-c,lo,hi);
+}
+
+__attribute__((target("avx512f"))) void MD2_delta_b_avx512 (const GLfloat * ref, const signed char * code, GLfloat step, GLfloat * r, GLuint n) {
+    GLuint c;
+    __m512 vs;
+
+    vs=_mm512_set1_ps(step);
+    for(c=0;c+16<=n;c+=16) {
+	_mm512_storeu_ps(r+c,_mm512_add_ps(_mm512_loadu_ps(ref+c),_mm512_mul_ps(vs,_mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)(code+c)))))));
+    }
+    MD2_delta_b(ref+c,code+c,step,r+c,n-c);
+}
+
+__attribute__((target("avx512f"))) void MD2_delta_s_avx512 (const GLfloat * ref, const GLshort * code, GLfloat step, GLfloat * r, GLuint n) {
+    GLuint c;
+    __m512 vs;
+
+    vs=_mm512_set1_ps(step);
+    for(c=0;c+16<=n;c+=16) {
+	_mm512_storeu_ps(r+c,_mm512_add_ps(_mm512_loadu_ps(ref+c),_mm512_mul_ps(vs,_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *)(code+c)))))));
+    }
+    MD2_delta_s(ref+c,code+c,step,r+c,n-c);
+}
+
+#endif
+
+#pragma GCC pop_options
+
+#ifdef MD2_X86
+
+struct md2_kernels MD2_KERNELS[]={
+    { MD2_lerp_f, MD2_lerp_s, MD2_lerp_d, MD2_bounds, MD2_delta_b, MD2_delta_s },
+    { MD2_lerp_f_sse2, MD2_lerp_s_sse2, MD2_lerp_d_sse2, MD2_bounds_sse2, MD2_delta_b_sse2, MD2_delta_s_sse2 },
+    { MD2_lerp_f_avx2, MD2_lerp_s_avx2, MD2_lerp_d_avx2, MD2_bounds_avx2, MD2_delta_b_avx2, MD2_delta_s_avx2 },
+    { MD2_lerp_f_avx512, MD2_lerp_s_avx512, MD2_lerp_d_avx512, MD2_bounds_avx512, MD2_delta_b_avx512, MD2_delta_s_avx512 }
+};
+
+#else
+
+struct md2_kernels MD2_KERNELS[]={
+    { MD2_lerp_f, MD2_lerp_s, MD2_lerp_d, MD2_bounds, MD2_delta_b, MD2_delta_s }
+};
+
+#endif
+
+atomic_int MD2_isa=-1;
+
+/* selects the kernels, level is one of MD2I_*, a negative or unsupported level picks the
+   widest one available. returns the level in use */
+
+GLint MD2_pose_isa (GLint level) {
+    GLint max;
+
+    max=MD2I_SCALAR;
+#ifdef MD2_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")) max=MD2I_SSE2;
+    if(__builtin_cpu_supports("avx2")) max=MD2I_AVX2;
+    if(__builtin_cpu_supports("avx512f")) max=MD2I_AVX512;
+#endif
+    if(level<0 || level>max) level=max;
+    atomic_store(&MD2_isa,level);
+    return(level);
+}
+
+struct md2_kernels * MD2_pose_kernels (void) {
+    GLint level;
+
+    if((level=atomic_load(&MD2_isa))<0) level=MD2_pose_isa(-1);
+    return(&(MD2_KERNELS[level]));
+}
+
+/* interpolates the triples first..first+m-1 of count SoA triples from frame a to b stored
+   in the given precision, double frames are AoS and get deinterleaved chunk by chunk */
+
+void MD2_pose_lerp (struct md2_kernels * k, GLint precision, const void * a, const void * b, GLuint count, GLuint first, GLuint m, GLdouble s, GLfloat * r) {
+    GLfloat t[3*MD2_POSECHUNK];
+    GLuint c,d,i,l;
+
+    switch(precision) {
+	case MD2P_FLOAT:
+	    if(first==0 && m==count) k->lerp_f(a,b,s,r,3*count);
+	    else for(d=0;d<3;d++) k->lerp_f((const GLfloat *)a+d*count+first,(const GLfloat *)b+d*count+first,s,r+d*count+first,m);
+	    break;
+	case MD2P_SNORM16:
+	    if(first==0 && m==count) k->lerp_s(a,b,s,r,3*count);
+	    else for(d=0;d<3;d++) k->lerp_s((const GLshort *)a+d*count+first,(const GLshort *)b+d*count+first,s,r+d*count+first,m);
+	    break;
+	default:
+	    for(c=first;c<first+m;c+=l) {
+		l=first+m-c; if(l>MD2_POSECHUNK) l=MD2_POSECHUNK;
+		k->lerp_d(((const struct md2_vertexd *)a)[c].v,((const struct md2_vertexd *)b)[c].v,s,t,3*l);
+		for(i=0;i<l;i++) {
+		    r[c+i]=t[3*i]; r[count+c+i]=t[3*i+1]; r[2*count+c+i]=t[3*i+2];
+		}
+	    }
+	    break;
+    }
+}
+
+/* the same for compressed positions, both frames are decoded chunk by chunk on the way */
+
+void MD2_pose_decode (struct md2_kernels * k, struct md2_model * md2, GLint f, GLint d, GLuint first, GLuint m, GLfloat * r) {
+    struct md2_deltaseq *seq;
+    size_t off;
+
+    seq=&(md2->Delta->Seqs[md2->Delta->Seq[f]]);
+    off=((size_t)(f-seq->First)*3+d)*md2->nVertices+first;
+    if(seq->Wide) k->delta_s(seq->Ref+d*md2->nVertices+first,(const GLshort *)seq->Codes+off,seq->Step[d],r,m);
+    else k->delta_b(seq->Ref+d*md2->nVertices+first,(const signed char *)seq->Codes+off,seq->Step[d],r,m);
+}
+
+void MD2_pose_delta (struct md2_kernels * k, struct md2_model * md2, GLint sf, GLint ef, GLuint first, GLuint m, GLdouble s, GLfloat * r) {
+    GLfloat ta[MD2_POSECHUNK],tb[MD2_POSECHUNK];
+    GLuint c,d,l,nv;
+
+    nv=md2->nVertices;
+    for(d=0;d<3;d++) {
+	for(c=first;c<first+m;c+=l) {
+	    l=first+m-c; if(l>MD2_POSECHUNK) l=MD2_POSECHUNK;
+	    MD2_pose_decode(k,md2,sf,d,c,l,ta);
+	    MD2_pose_decode(k,md2,ef,d,c,l,tb);
+	    k->lerp_f(ta,tb,s,r+d*nv+c,l);
+	}
+    }
+}
+
+/* start of frame f in one of the frame arrays, by precision */
+
+const void * MD2_pose_frame (struct md2_vertexd * d, GLfloat * fl, GLshort * sh, GLuint count, GLint f) {
+    if(d) return(d+f*count);
+    if(fl) return(fl+3*count*f);
+    return(sh+3*count*f);
+}
+
+/* table normals have no vector kernel, the lookup is a gather */
+
+void MD2_pose_tnormals (struct md2_model * md2, GLint sf, GLint ef, GLdouble s, GLfloat * vnrm, GLuint first, GLuint m) {
+    GLuint c,d,nv;
+    const GLfloat *an,*bn;
+
+    nv=md2->nVertices;
+    for(c=first;c<first+m;c++) {
+	an=MD2_ANORMS[md2->NormalIdx[c+sf*nv]];
+	bn=MD2_ANORMS[md2->NormalIdx[c+ef*nv]];
+	for(d=0;d<3;d++) vnrm[d*nv+c]=-(an[d]+s*(bn[d]-an[d]));
+    }
+}
+
+/* evaluates vertices v0..v1-1 and faces f0..f1-1 of the pose between frames sf and ef into
+   the full size arrays of MD2_pose, bb gets the bounds of just these vertices */
+
+void MD2_pose_range (struct md2_model * md2, GLint sf, GLint ef, GLdouble s, GLfloat * pos, GLfloat * vnrm, GLfloat * fnrm, struct md2_boundingbox * bb, GLuint v0, GLuint v1, GLuint f0, GLuint f1) {
+    struct md2_kernels *k;
+    struct md2_normalcache *nc;
+    struct md2_vertexd sn,en;
+    GLubyte *sd,*ed;
+    GLuint nv,nf,c,scale;
+    GLfloat lo,hi;
+
+    k=MD2_pose_kernels();
+    nv=md2->nVertices;
+    nf=md2->nFaces;
+    if(pos && md2->Delta) {
+	MD2_pose_delta(k,md2,sf,ef,v0,v1-v0,s,pos);
+    } else if(pos) {
+	MD2_pose_lerp(k,md2->Precision==MD2P_DOUBLE?MD2P_DOUBLE:MD2P_FLOAT,
+	    MD2_pose_frame(md2->Vertex,md2->VertexF,NULL,nv,sf),
+	    MD2_pose_frame(md2->Vertex,md2->VertexF,NULL,nv,ef),nv,v0,v1-v0,s,pos);
+    }
+    if(bb && v1>v0) {
+	lo=hi=pos[v0]; k->bounds(pos+v0,v1-v0,&lo,&hi); bb->x2=lo; bb->x1=hi;
+	lo=hi=pos[nv+v0]; k->bounds(pos+nv+v0,v1-v0,&lo,&hi); bb->y2=lo; bb->y1=hi;
+	lo=hi=pos[2*nv+v0]; k->bounds(pos+2*nv+v0,v1-v0,&lo,&hi); bb->z2=lo; bb->z1=hi;
+    } else if(bb) MD2_bb_init(bb);
+    if(md2->Flags&MD2L_TABLENORMALS) {
+	if(vnrm) MD2_pose_tnormals(md2,sf,ef,s,vnrm,v0,v1-v0);
+	if(fnrm) {
+	    for(c=f0;c<f1;c++) {
+		MD2_get_fnormal(md2,sf,c,&sn);
+		MD2_get_fnormal(md2,ef,c,&en);
+		fnrm[c]=sn.v[0]+s*(en.v[0]-sn.v[0]);
+		fnrm[nf+c]=sn.v[1]+s*(en.v[1]-sn.v[1]);
+		fnrm[2*nf+c]=sn.v[2]+s*(en.v[2]-sn.v[2]);
+	    }
+	}
+    } else if((nc=md2->NCache)) {
+	if(!vnrm && !fnrm) return;
+	/* the cache keeps at least two slots, the second lookup cannot evict the first */
+	scale=md2->Precision==MD2P_DOUBLE?sizeof(struct md2_vertexd):md2->Precision==MD2P_FLOAT?sizeof(GLfloat):sizeof(GLshort);
+	pthread_mutex_lock(&(nc->Lock));
+	sd=nc->Data+MD2_ncache_frame(md2,sf)*nc->SlotSize;
+	ed=nc->Data+MD2_ncache_frame(md2,ef)*nc->SlotSize;
+	if(vnrm) MD2_pose_lerp(k,md2->Precision,sd,ed,nv,v0,v1-v0,s,vnrm);
+	if(md2->Precision!=MD2P_DOUBLE) scale*=3;
+	if(fnrm) MD2_pose_lerp(k,md2->Precision,sd+nv*scale,ed+nv*scale,nf,f0,f1-f0,s,fnrm);
+	pthread_mutex_unlock(&(nc->Lock));
+    } else {
+	if(vnrm) {
+	    MD2_pose_lerp(k,md2->Precision,
+		MD2_pose_frame(md2->VNormal,md2->VNormalF,md2->VNormalS,nv,sf),
+		MD2_pose_frame(md2->VNormal,md2->VNormalF,md2->VNormalS,nv,ef),nv,v0,v1-v0,s,vnrm);
+	}
+	if(fnrm) {
+	    MD2_pose_lerp(k,md2->Precision,
+		MD2_pose_frame(md2->FNormal,md2->FNormalF,md2->FNormalS,nf,sf),
+		MD2_pose_frame(md2->FNormal,md2->FNormalF,md2->FNormalS,nf,ef),nf,f0,f1-f0,s,fnrm);
+	}
+    }
+}
+
+/* evaluates the pose between frames sf and ef. pos and vnrm take 3*nVertices floats, fnrm
+   3*nFaces, any of them may be NULL. bb is the exact box of the interpolated vertices and
+   needs pos. vertex normals follow MD2_get_vnormal, so models loaded with MD2L_TABLENORMALS
+   get the table ones. safe to call from several threads on the same model */
+
+int MD2_pose (struct md2_model * md2, GLint sf, GLint ef, GLdouble s, GLfloat * pos, GLfloat * vnrm, GLfloat * fnrm, struct md2_boundingbox * bb) {
+
+    if(sf<0 || ef<0 || sf>=md2->nFrames || ef>=md2->nFrames) {
+	fprintf(stderr,"Frame out of range, pose\n");
+	return(0);
+    }
+    if(bb && !pos) {
+	fprintf(stderr,"Bounding box without positions, pose\n");
+	return(0);
+    }
+    if(!MD2_page_acquire(md2,sf)) return(0);
+    if(!MD2_page_acquire(md2,ef)) {
+	MD2_page_release(md2,sf);
+	return(0);
+    }
+    MD2_pose_range(md2,sf,ef,s,pos,vnrm,fnrm,bb,0,md2->nVertices,0,md2->nFaces);
+    MD2_page_release(md2,ef);
+    MD2_page_release(md2,sf);
+    return(1);
+}
+
+/* batch pose evaluation. small jobs are grouped into tasks of about MD2_BATCHBYTES of frame
+   and output data, bigger models are cut into vertex and face ranges of that size so one
+   entity can keep several threads busy. the pieces of a split box are merged at the end */
+
+#define MD2_BATCHBYTES		(256*1024)
+#define MD2_BATCHMIN		512		/* fewest vertices in a piece of a split model */
+
+struct md2_posetask {
+    GLint		First,Last;	/* whole jobs First..Last-1, or piece Piece of nPieces of job First */
+    GLint		Piece,nPieces;
+    GLint		Part;		/* first partial box of a split job */
+};
+
+struct md2_posebatch {
+    struct md2_posejob *	Jobs;
+    struct md2_posetask *	Tasks;
+    struct md2_boundingbox *	Parts;
+};
+
+size_t MD2_batch_bytes (struct md2_posejob * job) {
+    size_t nv,nf;
+
+    nv=job->md2->nVertices; nf=job->md2->nFaces;
+    /* two frames in, one pose out */
+    return(3*3*sizeof(GLfloat)*((job->pos?nv:0)+(job->vnrm?nv:0)+(job->fnrm?nf:0))+1);
+}
+
+GLint MD2_batch_pieces (struct md2_posejob * job) {
+    GLint n,max;
+
+    n=(MD2_batch_bytes(job)+MD2_BATCHBYTES-1)/MD2_BATCHBYTES;
+    max=job->md2->nVertices/MD2_BATCHMIN;
+    if(n>max) n=max;
+    return(n<1?1:n);
+}
+
+void MD2_batch_task (void * arg, GLint t) {
+    struct md2_posebatch *b;
+    struct md2_posetask *tk;
+    struct md2_posejob *j;
+    GLuint nv,nf;
+
+    b=(struct md2_posebatch *)arg;
+    tk=&(b->Tasks[t]);
+    if(tk->nPieces==1) {
+	for(j=b->Jobs+tk->First;j<b->Jobs+tk->Last;j++) {
+	    if(j->ok) MD2_pose_range(j->md2,j->sf,j->ef,j->s,j->pos,j->vnrm,j->fnrm,j->bb,0,j->md2->nVertices,0,j->md2->nFaces);
+	}
+    } else {
+	j=b->Jobs+tk->First;
+	nv=j->md2->nVertices; nf=j->md2->nFaces;
+	MD2_pose_range(j->md2,j->sf,j->ef,j->s,j->pos,j->vnrm,j->fnrm,j->bb?b->Parts+tk->Part+tk->Piece:NULL,
+	    (GLint64)nv*tk->Piece/tk->nPieces,(GLint64)nv*(tk->Piece+1)/tk->nPieces,
+	    (GLint64)nf*tk->Piece/tk->nPieces,(GLint64)nf*(tk->Piece+1)/tk->nPieces);
+    }
+}
+
+/* evaluates n poses over the threads of pool (NULL: in the calling thread), the result of every
+   job is the same as that of MD2_pose. jobs are independent, several may write the same model.
+   only models with MD2L_LAZYNORMALS take a lock, the normal cache one. stats may be NULL.
+   returns 1 if every job was valid */
+
+void MD2_batch_release (struct md2_posejob * jobs, GLint n) {
+    GLint c;
+
+    for(c=0;c<n;c++) {
+	if(!jobs[c].ok) continue;
+	MD2_page_release(jobs[c].md2,jobs[c].ef);
+	MD2_page_release(jobs[c].md2,jobs[c].sf);
+    }
+}
+
+int MD2_pose_batch (struct md2_threadpool * pool, struct md2_posejob * jobs, GLint n, struct md2_batchstats * stats) {
+    struct md2_posebatch b;
+    struct md2_batchstats st;
+    struct timespec t0,t1;
+    GLint c,p,nt,np,ntasks,nparts;
+    size_t bytes;
+
+    clock_gettime(CLOCK_MONOTONIC,&t0);
+    memset(&st,0,sizeof(st));
+    ntasks=nparts=0;
+    for(c=0;c<n;c++) {
+	jobs[c].ok=jobs[c].sf>=0 && jobs[c].ef>=0 && jobs[c].sf<jobs[c].md2->nFrames && jobs[c].ef<jobs[c].md2->nFrames
+	    && (jobs[c].pos || !jobs[c].bb);
+	/* paged models get their sequences in before the threads start */
+	if(jobs[c].ok && !MD2_page_acquire(jobs[c].md2,jobs[c].sf)) jobs[c].ok=0;
+	else if(jobs[c].ok && !MD2_page_acquire(jobs[c].md2,jobs[c].ef)) {
+	    MD2_page_release(jobs[c].md2,jobs[c].sf);
+	    jobs[c].ok=0;
+	}
+	if(!jobs[c].ok) { st.failed++; continue; }
+	if((np=MD2_batch_pieces(&(jobs[c])))>1) { ntasks+=np; nparts+=np; }
+	else ntasks++;
+    }
+    b.Jobs=jobs;
+    b.Tasks=malloc(MD2_ALIGNUP(ntasks*sizeof(struct md2_posetask))+nparts*sizeof(struct md2_boundingbox));
+    if(!b.Tasks && ntasks) {
+	fprintf(stderr,"Out of memory, pose batch\n");
+	MD2_batch_release(jobs,n);
+	return(0);
+    }
+    b.Parts=(struct md2_boundingbox *)((GLubyte *)b.Tasks+MD2_ALIGNUP(ntasks*sizeof(struct md2_posetask)));
+
+    nt=nparts=0; bytes=0;
+    for(c=0;c<n;c++) {
+	if(!jobs[c].ok) continue;
+	if((np=MD2_batch_pieces(&(jobs[c])))>1) {
+	    for(p=0;p<np;p++,nt++) {
+		b.Tasks[nt].First=c; b.Tasks[nt].Last=c+1;
+		b.Tasks[nt].Piece=p; b.Tasks[nt].nPieces=np;
+		b.Tasks[nt].Part=nparts;
+	    }
+	    nparts+=np;
+	    st.split++;
+	    continue;
+	}
+	/* extends the open chunk until it holds MD2_BATCHBYTES */
+	if(bytes && nt && b.Tasks[nt-1].nPieces==1 && b.Tasks[nt-1].Last==c) {
+	    b.Tasks[nt-1].Last=c+1;
+	} else {
+	    b.Tasks[nt].First=c; b.Tasks[nt].Last=c+1;
+	    b.Tasks[nt].Piece=0; b.Tasks[nt].nPieces=1;
+	    nt++; bytes=0;
+	}
+	bytes+=MD2_batch_bytes(&(jobs[c]));
+	if(bytes>=MD2_BATCHBYTES) bytes=0;
+    }
+
+    MD2_pool_run(pool,MD2_batch_task,&b,nt);
+    if(pool && pool->nThreads && nt>1) st.steals=atomic_load(&(pool->Steals));
+
+    for(c=0;c<nt;c+=b.Tasks[c].nPieces) {
+	if(b.Tasks[c].nPieces==1 || !jobs[b.Tasks[c].First].bb) continue;
+	MD2_bb_init(jobs[b.Tasks[c].First].bb);
+	for(p=0;p<b.Tasks[c].nPieces;p++) MD2_bb_union(jobs[b.Tasks[c].First].bb,b.Parts+b.Tasks[c].Part+p);
+    }
+    free(b.Tasks);
+    MD2_batch_release(jobs,n);
+    clock_gettime(CLOCK_MONOTONIC,&t1);
+    st.tasks=nt;
+    st.seconds=(t1.tv_sec-t0.tv_sec)+(t1.tv_nsec-t0.tv_nsec)/1e9;
+    if(stats) *stats=st;
+    return(st.failed==0);
+}
+
+/* pose for the render functions, evaluated into the scratch array of the model: positions,
+   vertex normals (table normals for MD2D_TABLENORMALS), face normals, only what mode needs.
+   bb gets the exact box of the pose */
+
+GLfloat * MD2_pose_mode (struct md2_model * md2, GLint sf, GLint ef, GLdouble s, GLint mode, struct md2_boundingbox * bb) {
+    GLfloat *p;
+    GLuint nv;
+
+    nv=md2->nVertices;
+    if(!md2->Pose && !(md2->Pose=malloc(3*(2*nv+md2->nFaces)*sizeof(GLfloat)))) {
+	fprintf(stderr,"Out of memory, pose\n");
+	return(NULL);
+    }
+    p=md2->Pose;
+    if(!MD2_pose(md2,sf,ef,s,p,
+	    (mode==MD2D_VERTEXNORMALS || mode==MD2D_AVERAGENORMALS || mode==MD2D_WIREFRAME)?p+3*nv:NULL,
+	    (mode==MD2D_FACENORMALS || mode==MD2D_AVERAGENORMALS)?p+6*nv:NULL,bb)) return(NULL);
+    if(mode==MD2D_TABLENORMALS) MD2_pose_tnormals(md2,sf,ef,s,p+3*nv,0,nv);
+    return(p);
+}
+
+
+
+/* different render functions, average normals means the average of per vertex and per face normals.
+   they draw the pose MD2_pose_mode evaluates */
+
+int MD2_display_average_normals (struct md2_model * md2, struct md2_texture * tex, GLint sf, GLint ef, GLdouble s, struct md2_boundingbox * bb) {
+    GLint n,c,p;
+    GLuint nv,nf;
+    GLfloat *pos,*vn,*fn,map[4];
     struct md2_uv *uv;
 
-    if(bb) bb->x1=bb->x2=bb->y1=bb->y2=bb->z1=bb->z2=0;
+    if(!(pos=MD2_pose_mode(md2,sf,ef,s,MD2D_AVERAGENORMALS,bb))) return(0);
+    MD2_texture_map(md2,tex,1,map);
+    nv=md2->nVertices; nf=md2->nFaces;
+    vn=pos+3*nv; fn=pos+6*nv;
     glBegin(GL_TRIANGLES);
     for(n=0;n<(md2->nFaces);n++) {
         for(c=0;c<3;c++) {
-            svf=&(md2->Vertex[(&(md2->Faces[n]))->point[c]+(sf*(md2->nVertices))]);
-            evf=&(md2->Vertex[(&(md2->Faces[n]))->point[c]+(ef*(md2->nVertices))]);
-            snf=&(md2->FNormal[n+(sf*(md2->nFaces))]);
-            enf=&(md2->FNormal[n+(ef*(md2->nFaces))]);
-            saf=&(md2->VNormal[(&(md2->Faces[n]))->point[c]+(sf*(md2->nVertices))]);
-            eaf=&(md2->VNormal[(&(md2->Faces[n]))->point[c]+(ef*(md2->nVertices))]);
-            mv.v[0]=svf->v[0]+s*(evf->v[0]-svf->v[0]);
-            mv.v[1]=svf->v[1]+s*(evf->v[1]-svf->v[1]);
-            mv.v[2]=svf->v[2]+s*(evf->v[2]-svf->v[2]);
-	    if(bb) {
-		if		(mv.v[0]>bb->x1) bb->x1=mv.v[0];
-		else if 	(mv.v[0]<bb->x2) bb->x2=mv.v[0];
-		if		(mv.v[1]>bb->y1) bb->y1=mv.v[1];
-		else if 	(mv.v[1]<bb->y2) bb->y2=mv.v[1];
-		if		(mv.v[2]>bb->z1) bb->z1=mv.v[2];
-		else if 	(mv.v[2]<bb->z2) bb->z2=mv.v[2];
-	    }
-            nv.v[0]=snf->v[0]+s*(enf->v[0]-snf->v[0]);
-            nv.v[1]=snf->v[1]+s*(enf->v[1]-snf->v[1]);
-            nv.v[2]=snf->v[2]+s*(enf->v[2]-snf->v[2]);
-            av.v[0]=saf->v[0]+s*(eaf->v[0]-saf->v[0]);
-            av.v[1]=saf->v[1]+s*(eaf->v[1]-saf->v[1]);
-            av.v[2]=saf->v[2]+s*(eaf->v[2]-saf->v[2]);
-	    nv.v[0]=(nv.v[0]+av.v[0])/2;
-	    nv.v[1]=(nv.v[1]+av.v[1])/2;
-	    nv.v[2]=(nv.v[2]+av.v[2])/2;
+	    p=(&(md2->Faces[n]))->point[c];
             if(tex) {
                 uv=&(md2->UV[(&(md2->Faces[n]))->uv[c]]);
-                glTexCoord2s(uv->u,uv->v);
+                glTexCoord2f(map[0]+uv->u*map[2],map[1]+uv->v*map[3]);
             }
-            glNormal3f(nv.v[0],nv.v[1],nv.v[2]);
-            glVertex3f(mv.v[0],mv.v[1],mv.v[2]);
+            glNormal3f((fn[n]+vn[p])/2,(fn[nf+n]+vn[nv+p])/2,(fn[2*nf+n]+vn[2*nv+p])/2);
+            glVertex3f(pos[p],pos[nv+p],pos[2*nv+p]);
         }
     }
     glEnd();
@@ -426,38 +4771,25 @@ int MD2_display_average_normals (struct md2_model * md2, struct md2_texture * te
 /* render function, per face normals only */
 
 int MD2_display_per_face_normals (struct md2_model * md2, struct md2_texture * tex, GLint sf, GLint ef, GLdouble s, struct md2_boundingbox * bb) {
-    GLint n,c;
-    struct md2_vertexd *svf,*evf,*snf,*enf,mv,nv;
+    GLint n,c,p;
+    GLuint nv,nf;
+    GLfloat *pos,*fn,map[4];
     struct md2_uv *uv;
 
-    if(bb) bb->x1=bb->x2=bb->y1=bb->y2=bb->z1=bb->z2=0;
+    if(!(pos=MD2_pose_mode(md2,sf,ef,s,MD2D_FACENORMALS,bb))) return(0);
+    MD2_texture_map(md2,tex,1,map);
+    nv=md2->nVertices; nf=md2->nFaces;
+    fn=pos+6*nv;
     glBegin(GL_TRIANGLES);
     for(n=0;n<(md2->nFaces);n++) {
         for(c=0;c<3;c++) {
-            svf=&(md2->Vertex[(&(md2->Faces[n]))->point[c]+(sf*(md2->nVertices))]);
-            evf=&(md2->Vertex[(&(md2->Faces[n]))->point[c]+(ef*(md2->nVertices))]);
-            snf=&(md2->FNormal[n+(sf*(md2->nFaces))]);
-            enf=&(md2->FNormal[n+(ef*(md2->nFaces))]);
-    	    mv.v[0]=svf->v[0]+s*(evf->v[0]-svf->v[0]);
-            mv.v[1]=svf->v[1]+s*(evf->v[1]-svf->v[1]);
-            mv.v[2]=svf->v[2]+s*(evf->v[2]-svf->v[2]);
-	    if(bb) {
-		if		(mv.v[0]>bb->x1) bb->x1=mv.v[0];
-		else if 	(mv.v[0]<bb->x2) bb->x2=mv.v[0];
-		if		(mv.v[1]>bb->y1) bb->y1=mv.v[1];
-		else if 	(mv.v[1]<bb->y2) bb->y2=mv.v[1];
-		if		(mv.v[2]>bb->z1) bb->z1=mv.v[2];
-		else if 	(mv.v[2]<bb->z2) bb->z2=mv.v[2];
-	    }
-            nv.v[0]=snf->v[0]+s*(enf->v[0]-snf->v[0]);
-            nv.v[1]=snf->v[1]+s*(enf->v[1]-snf->v[1]);
-            nv.v[2]=snf->v[2]+s*(enf->v[2]-snf->v[2]);
+	    p=(&(md2->Faces[n]))->point[c];
             if(tex) {
                 uv=&(md2->UV[(&(md2->Faces[n]))->uv[c]]);
-                glTexCoord2s(uv->u,uv->v);
+                glTexCoord2f(map[0]+uv->u*map[2],map[1]+uv->v*map[3]);
             }
-            glNormal3f(nv.v[0],nv.v[1],nv.v[2]);
-            glVertex3f(mv.v[0],mv.v[1],mv.v[2]);
+            glNormal3f(fn[n],fn[nf+n],fn[2*nf+n]);
+            glVertex3f(pos[p],pos[nv+p],pos[2*nv+p]);
         }
     }
     glEnd();
@@ -466,81 +4798,123 @@ int MD2_display_per_face_normals (struct md2_model * md2, struct md2_texture * t
 
 
 
-/* render function, per vertex normals only */
+/* interleaved vertex arrays of the glcommand and the buffered path, a vertex is MD2_STRIDE
+   floats: position, normal, texture coordinate */
 
-int MD2_display_per_vertex_normals (struct md2_model * md2, struct md2_texture * tex, GLint sf, GLint ef, GLdouble s, struct md2_boundingbox * bb) {
-    GLint c,i,w;
-    struct md2_vertexd *svf,*evf,*snf,*enf,mv,nv;
+#define MD2_STRIDE		8
 
-    if(bb) bb->x1=bb->x2=bb->y1=bb->y2=bb->z1=bb->z2=0;
-    i=0; while((w=(md2->GLCmds[i++]))) {
-	if(w>0) {
-	    glBegin(GL_TRIANGLE_STRIP);
-	} else {
-	    glBegin(GL_TRIANGLE_FAN); w=abs(w);
-	}
-	for(c=0;c<w;c++) {
-	    if(tex) 
-		glTexCoord2f(((GLfloat *)md2->GLCmds)[i+0]*tex->w,((GLfloat *)md2->GLCmds)[i+1]*tex->h); i+=2;
-	    svf=&(md2->Vertex[md2->GLCmds[i]+(sf*(md2->nVertices))]);
-	    evf=&(md2->Vertex[md2->GLCmds[i]+(ef*(md2->nVertices))]);
-	    snf=&(md2->VNormal[md2->GLCmds[i]+(sf*(md2->nVertices))]);
-	    enf=&(md2->VNormal[md2->GLCmds[i]+(ef*(md2->nVertices))]);
-	    mv.v[0]=svf->v[0]+s*(evf->v[0]-svf->v[0]);
-	    mv.v[1]=svf->v[1]+s*(evf->v[1]-svf->v[1]);
-	    mv.v[2]=svf->v[2]+s*(evf->v[2]-svf->v[2]);
-	    if(bb) {
-		if		(mv.v[0]>bb->x1) bb->x1=mv.v[0];
-		else if 	(mv.v[0]<bb->x2) bb->x2=mv.v[0];
-		if		(mv.v[1]>bb->y1) bb->y1=mv.v[1];
-		else if 	(mv.v[1]<bb->y2) bb->y2=mv.v[1];
-		if		(mv.v[2]>bb->z1) bb->z1=mv.v[2];
-		else if 	(mv.v[2]<bb->z2) bb->z2=mv.v[2];
-	    }
-	    nv.v[0]=snf->v[0]+s*(enf->v[0]-snf->v[0]);
-	    nv.v[1]=snf->v[1]+s*(enf->v[1]-snf->v[1]);
-	    nv.v[2]=snf->v[2]+s*(enf->v[2]-snf->v[2]);
-	    glNormal3f(nv.v[0],nv.v[1],nv.v[2]);
-	    glVertex3f(mv.v[0],mv.v[1],mv.v[2]);
-	    i++;
-	}	
-	glEnd();
+/* writes vertex i of the pose with normal j of the SoA normal array nrm (count entries) */
+
+void MD2_buffer_put (GLfloat * p, GLfloat * pos, GLuint nv, GLint i, GLfloat * nrm, GLuint count, GLint j, GLfloat u, GLfloat v) {
+    p[0]=pos[i]; p[1]=pos[nv+i]; p[2]=pos[2*nv+i];
+    p[3]=nrm[j]; p[4]=nrm[count+j]; p[5]=nrm[2*count+j];
+    p[6]=u; p[7]=v;
+}
+
+/* fills one vertex per welded glcommand vertex into p */
+
+void MD2_buffer_fill_glcmds (struct md2_model * md2, struct md2_texture * tex, GLfloat * pos, GLfloat * p) {
+    GLuint c,nv;
+    GLfloat u,v,map[4];
+    struct md2_weld *w;
+
+    nv=md2->nVertices;
+    w=md2->Weld;
+    MD2_texture_map(md2,tex,0,map);
+    for(c=0;c<(w->nVertices);c++,p+=MD2_STRIDE) {
+	u=v=0;
+	if(tex) {
+	    u=map[0]+w->UV[2*c]*map[2];
+	    v=map[1]+w->UV[2*c+1]*map[3];
+	}
+	MD2_buffer_put(p,pos,nv,w->Point[c],pos+3*nv,nv,w->Point[c],u,v);
+    }
+}
+
+/* render function along the glcommands, mode MD2D_VERTEXNORMALS or MD2D_TABLENORMALS picks the normals.
+   the welded glcommand vertices are drawn from client arrays as restart separated strips in one call */
+
+GLint MD2_restart=-1;
+
+int MD2_display_glcmds (struct md2_model * md2, struct md2_texture * tex, GLint sf, GLint ef, GLdouble s, struct md2_boundingbox * bb, GLint mode) {
+    const GLubyte *version;
+    GLfloat *pos;
+    GLsizei stride;
+
+    if(!(pos=MD2_pose_mode(md2,sf,ef,s,mode,bb))) return(0);
+    if(!md2->Arrays && !(md2->Arrays=malloc(md2->Weld->nVertices*MD2_STRIDE*sizeof(GLfloat)))) {
+	fprintf(stderr,"Out of memory, arrays\n");
+	return(0);
+    }
+    MD2_buffer_fill_glcmds(md2,tex,pos,md2->Arrays);
+
+    /* primitive restart is core since opengl 3.1, older contexts draw the welded triangle list */
+    if(MD2_restart<0) {
+	version=glGetString(GL_VERSION);
+	MD2_restart=version && (atoi(version)>3 || (atoi(version)==3 && strchr(version,'.') && atoi(strchr(version,'.')+1)>=1));
+    }
+    stride=MD2_STRIDE*sizeof(GLfloat);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glVertexPointer(3,GL_FLOAT,stride,md2->Arrays);
+    glNormalPointer(GL_FLOAT,stride,md2->Arrays+3);
+    if(tex) {
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(2,GL_FLOAT,stride,md2->Arrays+6);
+    }
+    if(MD2_restart) {
+	glPrimitiveRestartIndex(MD2_RESTART);
+	glEnable(GL_PRIMITIVE_RESTART);
+	glDrawElements(GL_TRIANGLE_STRIP,md2->Weld->nStrip,GL_UNSIGNED_INT,md2->Weld->Strip);
+	glDisable(GL_PRIMITIVE_RESTART);
+    } else {
+	glDrawElements(GL_TRIANGLES,md2->Weld->nIndices,GL_UNSIGNED_INT,md2->Weld->Index);
+    }
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    if(tex) {
+	/* the current texture coordinate is undefined after an array draw, wireframe and points
+	   use it, so it is left as glTexCoord per vertex would */
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoord2fv(md2->Arrays+md2->Weld->Last*MD2_STRIDE+6);
     }
     return(1);
 }
 
 
 
+/* render function, per vertex normals only */
+
+int MD2_display_per_vertex_normals (struct md2_model * md2, struct md2_texture * tex, GLint sf, GLint ef, GLdouble s, struct md2_boundingbox * bb) {
+    return(MD2_display_glcmds(md2,tex,sf,ef,s,bb,MD2D_VERTEXNORMALS));
+}
+
+
+
+/* render function, normals from the precomputed table of the file */
+
+int MD2_display_table_normals (struct md2_model * md2, struct md2_texture * tex, GLint sf, GLint ef, GLdouble s, struct md2_boundingbox * bb) {
+    return(MD2_display_glcmds(md2,tex,sf,ef,s,bb,MD2D_TABLENORMALS));
+}
+
+
+
 /* render function, suitable for rendering as wireframe */
 
 int MD2_wire_display (struct md2_model * md2, GLint sf, GLint ef, GLfloat s, struct md2_boundingbox * bb) {
-    GLint n,c;
-    struct md2_vertexd *svf,*evf,*snf,*enf,mv,nv;
+    GLint n,c,p;
+    GLuint nv;
+    GLfloat *pos,*vn;
 
-    if(bb) bb->x1=bb->x2=bb->y1=bb->y2=bb->z1=bb->z2=0;
+    if(!(pos=MD2_pose_mode(md2,sf,ef,s,MD2D_WIREFRAME,bb))) return(0);
+    nv=md2->nVertices;
+    vn=pos+3*nv;
     for(n=0;n<(md2->nFaces);n++) {
 	glBegin(GL_LINE_STRIP);
 	for(c=0;c<3;c++) {
-	    svf=&(md2->Vertex[(&(md2->Faces[n]))->point[c]+(sf*(md2->nVertices))]);
-	    evf=&(md2->Vertex[(&(md2->Faces[n]))->point[c]+(ef*(md2->nVertices))]);
-	    snf=&(md2->VNormal[(&(md2->Faces[n]))->point[c]+(sf*(md2->nVertices))]);
-	    enf=&(md2->VNormal[(&(md2->Faces[n]))->point[c]+(ef*(md2->nVertices))]);
-	    mv.v[0]=svf->v[0]+s*(evf->v[0]-svf->v[0]);
-	    mv.v[1]=svf->v[1]+s*(evf->v[1]-svf->v[1]);
-	    mv.v[2]=svf->v[2]+s*(evf->v[2]-svf->v[2]);
-	    if(bb) {
-		if		(mv.v[0]>bb->x1) bb->x1=mv.v[0];
-		else if 	(mv.v[0]<bb->x2) bb->x2=mv.v[0];
-		if		(mv.v[1]>bb->y1) bb->y1=mv.v[1];
-		else if 	(mv.v[1]<bb->y2) bb->y2=mv.v[1];
-		if		(mv.v[2]>bb->z1) bb->z1=mv.v[2];
-		else if 	(mv.v[2]<bb->z2) bb->z2=mv.v[2];
-	    }
-	    nv.v[0]=snf->v[0]+s*(enf->v[0]-snf->v[0]);
-	    nv.v[1]=snf->v[1]+s*(enf->v[1]-snf->v[1]);
-	    nv.v[2]=snf->v[2]+s*(enf->v[2]-snf->v[2]);
-	    glNormal3f(nv.v[0],nv.v[1],nv.v[2]);
-	    glVertex3f(mv.v[0],mv.v[1],mv.v[2]);
+	    p=(&(md2->Faces[n]))->point[c];
+	    glNormal3f(vn[p],vn[nv+p],vn[2*nv+p]);
+	    glVertex3f(pos[p],pos[nv+p],pos[2*nv+p]);
 	}
 	glEnd();
     }
@@ -551,30 +4925,663 @@ int MD2_wire_display (struct md2_model * md2, GLint sf, GLint ef, GLfloat s, str
 
 /* render function, suitable to render the points only */
 
-int MD2_point_display (struct md2_model * md2, GLint sf, GLint ef, GLfloat s, struct md2_boundingbox * bb) {
-    GLint n;
-    struct md2_vertexd *svf,*evf,mv;
-    
-    if(bb) bb->x1=bb->x2=bb->y1=bb->y2=bb->z1=bb->z2=0;
-    glBegin(GL_POINTS);
-    for(n=0;n<(md2->nVertices);n++) {
-	    svf=&(md2->Vertex[n+(sf*(md2->nVertices))]);
-	    evf=&(md2->Vertex[n+(ef*(md2->nVertices))]);
-	    mv.v[0]=svf->v[0]+s*(evf->v[0]-svf->v[0]);
-	    mv.v[1]=svf->v[1]+s*(evf->v[1]-svf->v[1]);
-	    mv.v[2]=svf->v[2]+s*(evf->v[2]-svf->v[2]);
-	    if(bb) {
-		if		(mv.v[0]>bb->x1) bb->x1=mv.v[0];
-		else if 	(mv.v[0]<bb->x2) bb->x2=mv.v[0];
-		if		(mv.v[1]>bb->y1) bb->y1=mv.v[1];
-		else if 	(mv.v[1]<bb->y2) bb->y2=mv.v[1];
-		if		(mv.v[2]>bb->z1) bb->z1=mv.v[2];
-		else if 	(mv.v[2]<bb->z2) bb->z2=mv.v[2];
-	    }
-	    glNormal3f(mv.v[0],mv.v[1],mv.v[2]);
-	    glVertex3f(mv.v[0],mv.v[1],mv.v[2]);
+int MD2_point_display (struct md2_model * md2, GLint sf, GLint ef, GLfloat s, struct md2_boundingbox * bb) {
+    GLint n;
+    GLuint nv;
+    GLfloat *pos;
+    
+    if(!(pos=MD2_pose_mode(md2,sf,ef,s,MD2D_POINTS,bb))) return(0);
+    nv=md2->nVertices;
+    glBegin(GL_POINTS);
+    for(n=0;n<(md2->nVertices);n++) {
+	    glNormal3f(pos[n],pos[nv+n],pos[2*nv+n]);
+	    glVertex3f(pos[n],pos[nv+n],pos[2*nv+n]);
+    }
+    glEnd();
+    return(1);
+}
+
+
+
+/* buffered rendering: the interpolated frame is written into an interleaved staging array,
+   streamed into a vertex buffer object (orphaning the old storage) and drawn with one call */
+
+int MD2_buffer_create (struct md2_model * md2) {
+    struct md2_buffer *buf;
+    GLuint c,n,max;
+    GLushort *sh;
+
+    buf=calloc(1,sizeof(struct md2_buffer));
+    if(!buf) {
+	fprintf(stderr,"Out of memory, buffer\n");
+	return(0);
+    }
+    buf->nGLVertices=md2->Weld->nVertices;
+    buf->nGLIndices=md2->Weld->nIndices;
+    max=3*md2->nFaces;
+    if(buf->nGLVertices>max) max=buf->nGLVertices;
+    if(md2->nVertices>max) max=md2->nVertices;
+    buf->StreamSize=max;
+    buf->Stream=malloc(max*MD2_STRIDE*sizeof(GLfloat));
+    buf->Index=malloc((buf->nGLIndices+4*md2->nFaces)*sizeof(GLuint));
+    if(!buf->Stream || !buf->Index) {
+	fprintf(stderr,"Out of memory, buffer\n");
+	free(buf->Stream); free(buf->Index); free(buf);
+	return(0);
+    }
+    memcpy(buf->Index,md2->Weld->Index,buf->nGLIndices*sizeof(GLuint));
+    n=buf->nGLIndices;
+    /* the wireframe draws the first two edges of every face like the line strips of MD2_wire_display */
+    for(c=0;c<(md2->nFaces);c++) {
+	buf->Index[n++]=3*c; buf->Index[n++]=3*c+1;
+	buf->Index[n++]=3*c+1; buf->Index[n++]=3*c+2;
+    }
+    /* both vertex orders fit 16 bit indices for any model within the format limits */
+    buf->IndexType=GL_UNSIGNED_INT; buf->IndexSize=sizeof(GLuint);
+    if(buf->nGLVertices<=65536 && 3*md2->nFaces<=65536) {
+	buf->IndexType=GL_UNSIGNED_SHORT; buf->IndexSize=sizeof(GLushort);
+	sh=(GLushort *)buf->Index;
+	for(c=0;c<n;c++) sh[c]=buf->Index[c];
+    }
+    glGenBuffers(1,&(buf->VBO));
+    glGenBuffers(1,&(buf->IBO));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,buf->IBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,n*buf->IndexSize,buf->Index,GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+    md2->Buffer=buf;
+    return(1);
+}
+
+void MD2_buffer_free (struct md2_model * md2) {
+    struct md2_buffer *buf;
+
+    if(!(buf=md2->Buffer)) return;
+    glDeleteBuffers(1,&(buf->VBO));
+    glDeleteBuffers(1,&(buf->IBO));
+    free(buf->Stream);
+    free(buf->Index);
+    free(buf);
+    md2->Buffer=NULL;
+}
+
+/* uploads count vertices of the staging array and draws them, with indices from offset if nindices>0 */
+
+void MD2_buffer_draw (struct md2_model * md2, GLenum prim, GLuint count, GLuint offset, GLuint nindices, GLint textured) {
+    struct md2_buffer *buf;
+    GLsizei stride;
+
+    buf=md2->Buffer;
+    stride=MD2_STRIDE*sizeof(GLfloat);
+    glBindBuffer(GL_ARRAY_BUFFER,buf->VBO);
+    glBufferData(GL_ARRAY_BUFFER,buf->StreamSize*stride,NULL,GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER,0,count*stride,buf->Stream);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glVertexPointer(3,GL_FLOAT,stride,(GLvoid *)0);
+    glNormalPointer(GL_FLOAT,stride,(GLvoid *)(3*sizeof(GLfloat)));
+    if(textured) {
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(2,GL_FLOAT,stride,(GLvoid *)(6*sizeof(GLfloat)));
+    }
+    if(nindices) {
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,buf->IBO);
+	glDrawElements(prim,nindices,buf->IndexType,(GLvoid *)(size_t)(offset*buf->IndexSize));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+    } else {
+	glDrawArrays(prim,0,count);
+    }
+    if(textured) glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+}
+
+/* fills one vertex per face corner, normals: MD2D_FACENORMALS, MD2D_AVERAGENORMALS or MD2D_WIREFRAME (vertex normals) */
+
+void MD2_buffer_fill_faces (struct md2_model * md2, struct md2_texture * tex, GLfloat * pos, GLint normals) {
+    GLint n,c,i;
+    GLuint nv,nf;
+    GLfloat *p,*vn,*fn,u,v,map[4];
+    struct md2_uv *uv;
+
+    nv=md2->nVertices; nf=md2->nFaces;
+    vn=pos+3*nv; fn=pos+6*nv;
+    p=md2->Buffer->Stream;
+    MD2_texture_map(md2,tex,1,map);
+    for(n=0;n<(md2->nFaces);n++) {
+	for(c=0;c<3;c++,p+=MD2_STRIDE) {
+	    i=(&(md2->Faces[n]))->point[c];
+	    uv=&(md2->UV[(&(md2->Faces[n]))->uv[c]]);
+	    u=map[0]+uv->u*map[2];
+	    v=map[1]+uv->v*map[3];
+	    if(normals==MD2D_WIREFRAME) {
+		MD2_buffer_put(p,pos,nv,i,vn,nv,i,u,v);
+	    } else {
+		MD2_buffer_put(p,pos,nv,i,fn,nf,n,u,v);
+		if(normals==MD2D_AVERAGENORMALS) {
+		    p[3]=(p[3]+vn[i])/2;
+		    p[4]=(p[4]+vn[nv+i])/2;
+		    p[5]=(p[5]+vn[2*nv+i])/2;
+		}
+	    }
+	}
+    }
+}
+
+/* fills one vertex per model vertex, the normal is the position as in MD2_point_display */
+
+void MD2_buffer_fill_points (struct md2_model * md2, GLfloat * pos) {
+    GLint n;
+    GLuint nv;
+    GLfloat *p;
+
+    nv=md2->nVertices;
+    p=md2->Buffer->Stream;
+    for(n=0;n<(md2->nVertices);n++,p+=MD2_STRIDE) {
+	MD2_buffer_put(p,pos,nv,n,pos,nv,n,0,0);
+    }
+}
+
+/* buffered counterpart of the render functions above, selected by MD2D_BUFFERED in the mode.
+   the buffers are created on first use, so a gl context has to be current */
+
+int MD2_display_buffered (struct md2_model * md2, struct md2_texture * tex, GLint sf, GLint ef, GLdouble s, GLint mode, struct md2_boundingbox * bb) {
+    struct md2_buffer *buf;
+    GLfloat *pos;
+
+    if(!md2->Buffer && !MD2_buffer_create(md2)) return(0);
+    buf=md2->Buffer;
+    if(mode==MD2D_WIREFRAME || mode==MD2D_POINTS) s=(GLfloat)s;
+    if(!(pos=MD2_pose_mode(md2,sf,ef,s,mode,bb))) return(0);
+    switch (mode) {
+	case MD2D_WIREFRAME:
+	    MD2_buffer_fill_faces(md2,NULL,pos,MD2D_WIREFRAME);
+	    MD2_buffer_draw(md2,GL_LINES,3*md2->nFaces,buf->nGLIndices,4*md2->nFaces,0);
+	    break;
+	case MD2D_POINTS:
+	    MD2_buffer_fill_points(md2,pos);
+	    MD2_buffer_draw(md2,GL_POINTS,md2->nVertices,0,0,0);
+	    break;
+	case MD2D_VERTEXNORMALS:
+	case MD2D_TABLENORMALS:
+	    MD2_buffer_fill_glcmds(md2,tex,pos,buf->Stream);
+	    MD2_buffer_draw(md2,GL_TRIANGLES,buf->nGLVertices,0,buf->nGLIndices,tex!=NULL);
+	    break;
+	case MD2D_AVERAGENORMALS:
+	    MD2_buffer_fill_faces(md2,tex,pos,MD2D_AVERAGENORMALS);
+	    MD2_buffer_draw(md2,GL_TRIANGLES,3*md2->nFaces,0,0,tex!=NULL);
+	    break;
+	case MD2D_FACENORMALS:
+	default:
+	    MD2_buffer_fill_faces(md2,tex,pos,MD2D_FACENORMALS);
+	    MD2_buffer_draw(md2,GL_TRIANGLES,3*md2->nFaces,0,0,tex!=NULL);
+	    break;
+    }
+    return(1);
+}
+
+
+
+/* shader render path: all keyframes are uploaded once into static buffers, one per vertex order
+   and kind of normal. the start and end frame are bound as two attribute streams and the vertex
+   shader interpolates between them, so drawing costs no per vertex work on the cpu. the shader
+   follows the fixed function lighting of the current gl state (lights, materials, light model) */
+
+/* the fixed function lighting, shared by both vertex shaders */
+
+const GLchar *MD2_LIGHTSHADER=
+    "uniform int lighting,localviewer,normalizing;\n"
+    "uniform int lights[8];\n"
+    "vec4 md2_light(vec4 ep, vec3 n) {\n"
+    "    vec3 vp,h;\n"
+    "    vec4 c,l;\n"
+    "    float att,nd,sd,d;\n"
+    "    int i;\n"
+    "    if(lighting==0) return(gl_Color);\n"
+    "    n=gl_NormalMatrix*n;\n"
+    "    if(normalizing!=0) n=normalize(n);\n"
+    "    c=gl_FrontLightModelProduct.sceneColor;\n"
+    "    for(i=0;i<8;i++) {\n"
+    "        if(lights[i]==0) continue;\n"
+    "        att=1.0;\n"
+    "        if(gl_LightSource[i].position.w==0.0) {\n"
+    "            vp=normalize(gl_LightSource[i].position.xyz);\n"
+    "        } else {\n"
+    "            vp=gl_LightSource[i].position.xyz/gl_LightSource[i].position.w-ep.xyz/ep.w;\n"
+    "            d=length(vp); vp/=d;\n"
+    "            att=1.0/(gl_LightSource[i].constantAttenuation+gl_LightSource[i].linearAttenuation*d+gl_LightSource[i].quadraticAttenuation*d*d);\n"
+    "            if(gl_LightSource[i].spotCutoff!=180.0) {\n"
+    "                sd=dot(-vp,normalize(gl_LightSource[i].spotDirection));\n"
+    "                att*=(sd<gl_LightSource[i].spotCosCutoff)?0.0:pow(sd,gl_LightSource[i].spotExponent);\n"
+    "            }\n"
+    "        }\n"
+    "        nd=max(dot(n,vp),0.0);\n"
+    "        l=gl_FrontLightProduct[i].ambient+nd*gl_FrontLightProduct[i].diffuse;\n"
+    "        if(nd>0.0) {\n"
+    "            h=normalize(vp+((localviewer!=0)?normalize(-ep.xyz):vec3(0.0,0.0,1.0)));\n"
+    "            l+=pow(max(dot(n,h),0.0),gl_FrontMaterial.shininess)*gl_FrontLightProduct[i].specular;\n"
+    "        }\n"
+    "        c+=att*l;\n"
+    "    }\n"
+    "    return(vec4(clamp(c.rgb,0.0,1.0),gl_FrontMaterial.diffuse.a));\n"
+    "}\n";
+
+const GLchar *MD2_VERTEXSHADER=
+    "attribute vec3 pos0,nrm0,pos1,nrm1;\n"
+    "attribute vec2 uv;\n"
+    "uniform float s;\n"
+    "uniform vec4 texmap;\n"
+    "varying vec2 texcoord;\n"
+    "void main() {\n"
+    "    vec4 ep=gl_ModelViewMatrix*vec4(pos0+s*(pos1-pos0),1.0);\n"
+    "    gl_Position=gl_ProjectionMatrix*ep;\n"
+    "    texcoord=texmap.xy+uv*texmap.zw;\n"
+    "    gl_FrontColor=md2_light(ep,nrm0+s*(nrm1-nrm0));\n"
+    "}\n";
+
+/* the instanced one fetches both keyframes of its instance from a buffer texture, a vertex is
+   two texels (position, normal) and a frame count vertices */
+
+const GLchar *MD2_INSTVERTEXSHADER=
+    "attribute mat4 transform;\n"
+    "attribute vec3 frame;\n"
+    "attribute vec2 uv;\n"
+    "uniform samplerBuffer frames;\n"
+    "uniform int count;\n"
+    "uniform vec4 texmap;\n"
+    "varying vec2 texcoord;\n"
+    "void main() {\n"
+    "    int a=2*(int(frame.x)*count+gl_VertexID),b=2*(int(frame.y)*count+gl_VertexID);\n"
+    "    vec3 pos0=texelFetch(frames,a).xyz,nrm0=texelFetch(frames,a+1).xyz;\n"
+    "    vec3 pos1=texelFetch(frames,b).xyz,nrm1=texelFetch(frames,b+1).xyz;\n"
+    "    vec4 ep=gl_ModelViewMatrix*(transform*vec4(pos0+frame.z*(pos1-pos0),1.0));\n"
+    "    gl_Position=gl_ProjectionMatrix*ep;\n"
+    "    texcoord=texmap.xy+uv*texmap.zw;\n"
+    "    gl_FrontColor=md2_light(ep,transpose(inverse(mat3(transform)))*(nrm0+frame.z*(nrm1-nrm0)));\n"
+    "}\n";
+
+const GLchar *MD2_FRAGMENTSHADER=
+    "#extension GL_ARB_texture_rectangle : enable\n"
+    "uniform sampler2DRect tex;\n"
+    "uniform sampler2D tex2d;\n"
+    "uniform int texturing;\n"
+    "varying vec2 texcoord;\n"
+    "void main() {\n"
+    "    vec4 c=gl_Color;\n"
+    "    if(texturing==1) c*=texture2DRect(tex,texcoord);\n"
+    "    if(texturing==2) c*=texture2D(tex2d,texcoord);\n"
+    "    gl_FragColor=c;\n"
+    "}\n";
+
+/* glsl 1.20 for the plain program, the instanced one needs 1.40 for buffer textures,
+   gl_VertexID and inverse */
+
+struct md2_program MD2_program={"#version 120\n"};
+struct md2_program MD2_instprogram={"#version 140\n"};
+
+GLuint MD2_compile_shader (GLenum type, GLsizei n, const GLchar ** src) {
+    GLuint sh;
+    GLint ok;
+    GLchar log[1024];
+
+    sh=glCreateShader(type);
+    glShaderSource(sh,n,src,NULL);
+    glCompileShader(sh);
+    glGetShaderiv(sh,GL_COMPILE_STATUS,&ok);
+    if(!ok) {
+	glGetShaderInfoLog(sh,sizeof(log),NULL,log);
+	fprintf(stderr,"Cannot compile shader: %s\n",log);
+	glDeleteShader(sh); return(0);
+    }
+    return(sh);
+}
+
+int MD2_program_create (struct md2_program * pr, const GLchar * vertex) {
+    const GLchar *src[3];
+    GLuint vs,fs;
+    GLint ok;
+    GLchar log[1024];
+
+    if(pr->Program) return(1);
+    src[0]=pr->Version; src[1]=MD2_LIGHTSHADER; src[2]=vertex;
+    if(!(vs=MD2_compile_shader(GL_VERTEX_SHADER,3,src))) return(0);
+    src[1]=MD2_FRAGMENTSHADER;
+    if(!(fs=MD2_compile_shader(GL_FRAGMENT_SHADER,2,src))) {
+	glDeleteShader(vs); return(0);
+    }
+    pr->Program=glCreateProgram();
+    glAttachShader(pr->Program,vs);
+    glAttachShader(pr->Program,fs);
+    glBindAttribLocation(pr->Program,0,"pos0");
+    glBindAttribLocation(pr->Program,1,"nrm0");
+    glBindAttribLocation(pr->Program,2,"pos1");
+    glBindAttribLocation(pr->Program,3,"nrm1");
+    glBindAttribLocation(pr->Program,4,"uv");
+    glBindAttribLocation(pr->Program,5,"transform");	/* takes 5 to 8 */
+    glBindAttribLocation(pr->Program,9,"frame");
+    glLinkProgram(pr->Program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    glGetProgramiv(pr->Program,GL_LINK_STATUS,&ok);
+    if(!ok) {
+	glGetProgramInfoLog(pr->Program,sizeof(log),NULL,log);
+	fprintf(stderr,"Cannot link shader program: %s\n",log);
+	glDeleteProgram(pr->Program); pr->Program=0; return(0);
+    }
+    pr->uS=glGetUniformLocation(pr->Program,"s");
+    pr->uTexMap=glGetUniformLocation(pr->Program,"texmap");
+    pr->uLighting=glGetUniformLocation(pr->Program,"lighting");
+    pr->uLocalViewer=glGetUniformLocation(pr->Program,"localviewer");
+    pr->uNormalizing=glGetUniformLocation(pr->Program,"normalizing");
+    pr->uLights=glGetUniformLocation(pr->Program,"lights");
+    pr->uTexturing=glGetUniformLocation(pr->Program,"texturing");
+    pr->uTex=glGetUniformLocation(pr->Program,"tex");
+    pr->uTex2D=glGetUniformLocation(pr->Program,"tex2d");
+    pr->uFrames=glGetUniformLocation(pr->Program,"frames");
+    pr->uCount=glGetUniformLocation(pr->Program,"count");
+    return(1);
+}
+
+/* number of vertices per frame of a kind of static buffer */
+
+GLuint MD2_gpu_count (struct md2_model * md2, GLint kind) {
+    switch(kind) {
+	case MD2K_VERTEX:
+	case MD2K_TABLE:	return(md2->Buffer->nGLVertices);
+	case MD2K_POINTS:	return(md2->nVertices);
+	default:		return(3*md2->nFaces);
+    }
+}
+
+/* uploads position and normal of every vertex of every frame in the vertex order of the kind */
+
+int MD2_gpu_build (struct md2_model * md2, GLint kind) {
+    GLuint count,f,n,c,p;
+    GLfloat *data,*d;
+    struct md2_vertexd vf,nf,af;
+
+    count=MD2_gpu_count(md2,kind);
+    data=malloc(md2->nFrames*count*6*sizeof(GLfloat));
+    if(!data) {
+	fprintf(stderr,"Out of memory, gpu frames\n");
+	return(0);
+    }
+    d=data;
+    for(f=0;f<(md2->nFrames);f++) {
+	if(!MD2_page_acquire(md2,f)) {
+	    free(data);
+	    return(0);
+	}
+	if(kind==MD2K_VERTEX || kind==MD2K_TABLE) {
+	    for(n=0;n<(md2->Weld->nVertices);n++,d+=6) {
+		p=md2->Weld->Point[n];
+		MD2_get_vertex(md2,f,p,&vf);
+		if(kind==MD2K_TABLE) MD2_get_tnormal(md2,f,p,&nf);
+		else MD2_get_vnormal(md2,f,p,&nf);
+		d[0]=vf.v[0]; d[1]=vf.v[1]; d[2]=vf.v[2];
+		d[3]=nf.v[0]; d[4]=nf.v[1]; d[5]=nf.v[2];
+	    }
+	} else if(kind==MD2K_POINTS) {
+	    for(n=0;n<(md2->nVertices);n++,d+=6) {
+		MD2_get_vertex(md2,f,n,&vf);
+		d[0]=d[3]=vf.v[0]; d[1]=d[4]=vf.v[1]; d[2]=d[5]=vf.v[2];
+	    }
+	} else {
+	    for(n=0;n<(md2->nFaces);n++) {
+		MD2_get_fnormal(md2,f,n,&nf);
+		for(c=0;c<3;c++,d+=6) {
+		    p=(&(md2->Faces[n]))->point[c];
+		    MD2_get_vertex(md2,f,p,&vf);
+		    d[0]=vf.v[0]; d[1]=vf.v[1]; d[2]=vf.v[2];
+		    if(kind==MD2K_FACE) {
+			d[3]=nf.v[0]; d[4]=nf.v[1]; d[5]=nf.v[2];
+		    } else {
+			MD2_get_vnormal(md2,f,p,&af);
+			if(kind==MD2K_AVERAGE) {
+			    d[3]=(nf.v[0]+af.v[0])/2; d[4]=(nf.v[1]+af.v[1])/2; d[5]=(nf.v[2]+af.v[2])/2;
+			} else {
+			    d[3]=af.v[0]; d[4]=af.v[1]; d[5]=af.v[2];
+			}
+		    }
+		}
+	    }
+	}
+	MD2_page_release(md2,f);
+    }
+    glGenBuffers(1,&(md2->GPU->Frames[kind]));
+    glBindBuffer(GL_ARRAY_BUFFER,md2->GPU->Frames[kind]);
+    glBufferData(GL_ARRAY_BUFFER,md2->nFrames*count*6*sizeof(GLfloat),data,GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+    free(data);
+    return(1);
+}
+
+/* texture coordinates are the same for all frames: texels per face corner, normalized ones per welded glcommand vertex */
+
+int MD2_gpu_create (struct md2_model * md2) {
+    GLuint n,c;
+    GLfloat *uv,*d;
+
+    if(!md2->Buffer && !MD2_buffer_create(md2)) return(0);
+    md2->GPU=calloc(1,sizeof(struct md2_gpu));
+    uv=malloc(2*3*md2->nFaces*sizeof(GLfloat));
+    if(!md2->GPU || !uv) {
+	fprintf(stderr,"Out of memory, gpu\n");
+	free(md2->GPU); free(uv); md2->GPU=NULL; return(0);
+    }
+    glGenBuffers(1,&(md2->GPU->FaceUV));
+    glGenBuffers(1,&(md2->GPU->GLCmdUV));
+    d=uv;
+    for(n=0;n<(md2->nFaces);n++) {
+	for(c=0;c<3;c++,d+=2) {
+	    d[0]=md2->UV[(&(md2->Faces[n]))->uv[c]].u;
+	    d[1]=md2->UV[(&(md2->Faces[n]))->uv[c]].v;
+	}
+    }
+    glBindBuffer(GL_ARRAY_BUFFER,md2->GPU->FaceUV);
+    glBufferData(GL_ARRAY_BUFFER,3*md2->nFaces*2*sizeof(GLfloat),uv,GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER,md2->GPU->GLCmdUV);
+    glBufferData(GL_ARRAY_BUFFER,md2->Weld->nVertices*2*sizeof(GLfloat),md2->Weld->UV,GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+    free(uv);
+    return(1);
+}
+
+void MD2_gpu_free (struct md2_model * md2) {
+    if(!md2->GPU) return;
+    glDeleteBuffers(MD2K_MAX,md2->GPU->Frames);
+    glDeleteBuffers(1,&(md2->GPU->FaceUV));
+    glDeleteBuffers(1,&(md2->GPU->GLCmdUV));
+    glDeleteBuffers(1,&(md2->GPU->Instances));
+    glDeleteTextures(MD2K_MAX,md2->GPU->FrameTex);
+    free(md2->GPU);
+    md2->GPU=NULL;
+}
+
+/* sets the uniforms that mirror the fixed function state. the sampler of the other texture
+   target is moved to unit 2, two sampler types must not share a unit */
+
+void MD2_program_state (struct md2_program * pr, struct md2_model * md2, struct md2_texture * tex, GLint kind, GLdouble s) {
+    GLint c,lights[8],lv,rect;
+    GLfloat map[4];
+
+    glUniform1f(pr->uS,s);
+    MD2_texture_map(md2,tex,kind!=MD2K_VERTEX && kind!=MD2K_TABLE,map);
+    glUniform4fv(pr->uTexMap,1,map);
+    glUniform1i(pr->uLighting,glIsEnabled(GL_LIGHTING));
+    glGetIntegerv(GL_LIGHT_MODEL_LOCAL_VIEWER,&lv);
+    glUniform1i(pr->uLocalViewer,lv);
+    glUniform1i(pr->uNormalizing,glIsEnabled(GL_NORMALIZE));
+    for(c=0;c<8;c++) lights[c]=glIsEnabled(GL_LIGHT0+c);
+    glUniform1iv(pr->uLights,8,lights);
+    rect=!tex || tex->target!=GL_TEXTURE_2D;
+    glUniform1i(pr->uTexturing,tex && glIsEnabled(rect?GL_TEXTURE_RECTANGLE_NV:GL_TEXTURE_2D)?(rect?1:2):0);
+    glUniform1i(pr->uTex,rect?0:2);
+    glUniform1i(pr->uTex2D,rect?2:0);
+}
+
+/* kind of static buffer for a render mode */
+
+GLint MD2_gpu_kind (GLint mode) {
+    switch(mode) {
+	case MD2D_WIREFRAME:	 return(MD2K_WIRE);
+	case MD2D_POINTS:	 return(MD2K_POINTS);
+	case MD2D_VERTEXNORMALS: return(MD2K_VERTEX);
+	case MD2D_TABLENORMALS:	 return(MD2K_TABLE);
+	case MD2D_AVERAGENORMALS: return(MD2K_AVERAGE);
+	default:		 return(MD2K_FACE);
+    }
+}
+
+/* binds the texture coordinates and draws count vertices of a kind n times */
+
+void MD2_gpu_draw (struct md2_model * md2, GLint kind, GLuint count, GLsizei n) {
+    GLfloat uv[4];
+
+    if(kind==MD2K_WIRE || kind==MD2K_POINTS) {
+	glGetFloatv(GL_CURRENT_TEXTURE_COORDS,uv);
+	glVertexAttrib2fv(4,uv);
+    } else {
+	glBindBuffer(GL_ARRAY_BUFFER,(kind==MD2K_VERTEX || kind==MD2K_TABLE)?md2->GPU->GLCmdUV:md2->GPU->FaceUV);
+	glVertexAttribPointer(4,2,GL_FLOAT,GL_FALSE,0,(GLvoid *)0);
+	glEnableVertexAttribArray(4);
+    }
+    switch(kind) {
+	case MD2K_VERTEX:
+	case MD2K_TABLE:
+	    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,md2->Buffer->IBO);
+	    glDrawElementsInstanced(GL_TRIANGLES,md2->Buffer->nGLIndices,md2->Buffer->IndexType,(GLvoid *)0,n);
+	    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+	    break;
+	case MD2K_WIRE:
+	    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,md2->Buffer->IBO);
+	    glDrawElementsInstanced(GL_LINES,4*md2->nFaces,md2->Buffer->IndexType,(GLvoid *)(size_t)(md2->Buffer->nGLIndices*md2->Buffer->IndexSize),n);
+	    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+	    break;
+	case MD2K_POINTS:
+	    glDrawArraysInstanced(GL_POINTS,0,count,n);
+	    break;
+	default:
+	    glDrawArraysInstanced(GL_TRIANGLES,0,count,n);
+	    break;
+    }
+}
+
+/* shader counterpart of the render functions, selected by MD2D_SHADER in the mode */
+
+int MD2_display_shader (struct md2_model * md2, struct md2_texture * tex, GLint sf, GLint ef, GLdouble s, GLint mode, struct md2_boundingbox * bb) {
+    GLint kind,n;
+    GLuint count;
+    GLsizei stride;
+
+    kind=MD2_gpu_kind(mode);
+    if(!MD2_program_create(&MD2_program,MD2_VERTEXSHADER)) return(0);
+    if(!md2->GPU && !MD2_gpu_create(md2)) return(0);
+    if(!md2->GPU->Frames[kind] && !MD2_gpu_build(md2,kind)) return(0);
+
+    /* the bounding box still needs the interpolated vertices, wire and points interpolate in single precision */
+    if(kind==MD2K_WIRE || kind==MD2K_POINTS) s=(GLfloat)s;
+    if(bb && !MD2_pose_mode(md2,sf,ef,s,MD2D_POINTS,bb)) return(0);
+
+    count=MD2_gpu_count(md2,kind);
+    stride=6*sizeof(GLfloat);
+    glUseProgram(MD2_program.Program);
+    MD2_program_state(&MD2_program,md2,tex,kind,s);
+    glBindBuffer(GL_ARRAY_BUFFER,md2->GPU->Frames[kind]);
+    glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,stride,(GLvoid *)((size_t)sf*count*stride));
+    glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,stride,(GLvoid *)((size_t)sf*count*stride+3*sizeof(GLfloat)));
+    glVertexAttribPointer(2,3,GL_FLOAT,GL_FALSE,stride,(GLvoid *)((size_t)ef*count*stride));
+    glVertexAttribPointer(3,3,GL_FLOAT,GL_FALSE,stride,(GLvoid *)((size_t)ef*count*stride+3*sizeof(GLfloat)));
+    for(n=0;n<4;n++) glEnableVertexAttribArray(n);
+    MD2_gpu_draw(md2,kind,count,1);
+    for(n=0;n<5;n++) glDisableVertexAttribArray(n);
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+    glUseProgram(0);
+    return(1);
+}
+
+/* the keyframe buffer of a kind as buffer texture for the instanced program */
+
+int MD2_gpu_frametex (struct md2_model * md2, GLint kind) {
+    GLint max;
+
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE,&max);
+    if((GLdouble)md2->nFrames*MD2_gpu_count(md2,kind)*2>max) {
+	fprintf(stderr,"Keyframes exceed the buffer texture size\n");
+	return(0);
+    }
+    glGenTextures(1,&(md2->GPU->FrameTex[kind]));
+    glBindTexture(GL_TEXTURE_BUFFER,md2->GPU->FrameTex[kind]);
+    glTexBuffer(GL_TEXTURE_BUFFER,GL_RGB32F,md2->GPU->Frames[kind]);
+    glBindTexture(GL_TEXTURE_BUFFER,0);
+    return(1);
+}
+
+/* draws n instances of the model in one call, each with its own transform and frames,
+   the transforms apply on top of the current modelview matrix */
+
+int MD2_display_instanced (struct md2_model * md2, struct md2_texture * tex, struct md2_instance * inst, GLint n, GLint mode) {
+    GLint kind,c,i;
+    GLuint count;
+    GLsizei stride;
+    GLfloat *d;
+
+    for(i=0;i<n;i++) {
+	if( inst[i].sf>=(md2->nFrames)
+	||  inst[i].ef>=(md2->nFrames)
+	||  inst[i].s>1.0
+	||  inst[i].s<0.0
+	||  inst[i].ef<0
+	||  inst[i].sf<0 ) return(0);
+    }
+    if(n<1) return(1);
+
+    kind=MD2_gpu_kind(mode&~(MD2D_SHADER|MD2D_BUFFERED));
+    if(!MD2_program_create(&MD2_instprogram,MD2_INSTVERTEXSHADER)) return(0);
+    if(!md2->GPU && !MD2_gpu_create(md2)) return(0);
+    if(!md2->GPU->Frames[kind] && !MD2_gpu_build(md2,kind)) return(0);
+    if(!md2->GPU->FrameTex[kind] && !MD2_gpu_frametex(md2,kind)) return(0);
+    if(!md2->GPU->Instances) glGenBuffers(1,&(md2->GPU->Instances));
+
+    /* the instance stream is orphaned on every call so the driver never waits for the last draw */
+    stride=20*sizeof(GLfloat);
+    glBindBuffer(GL_ARRAY_BUFFER,md2->GPU->Instances);
+    glBufferData(GL_ARRAY_BUFFER,n*stride,NULL,GL_STREAM_DRAW);
+    d=glMapBufferRange(GL_ARRAY_BUFFER,0,n*stride,GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT);
+    if(!d) {
+	fprintf(stderr,"Cannot map instance buffer\n");
+	glBindBuffer(GL_ARRAY_BUFFER,0); return(0);
+    }
+    for(i=0;i<n;i++,d+=20) {
+	memcpy(d,inst[i].transform,16*sizeof(GLfloat));
+	d[16]=inst[i].sf; d[17]=inst[i].ef; d[18]=inst[i].s; d[19]=0;
+    }
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    for(c=0;c<5;c++) {
+	glVertexAttribPointer(5+c,c<4?4:3,GL_FLOAT,GL_FALSE,stride,(GLvoid *)(size_t)(4*c*sizeof(GLfloat)));
+	glVertexAttribDivisor(5+c,1);
+	glEnableVertexAttribArray(5+c);
+    }
+
+    count=MD2_gpu_count(md2,kind);
+    glUseProgram(MD2_instprogram.Program);
+    MD2_program_state(&MD2_instprogram,md2,tex,kind,0);
+    glUniform1i(MD2_instprogram.uFrames,1);
+    glUniform1i(MD2_instprogram.uCount,count);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER,md2->GPU->FrameTex[kind]);
+    glActiveTexture(GL_TEXTURE0);
+    MD2_gpu_draw(md2,kind,count,n);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER,0);
+    glActiveTexture(GL_TEXTURE0);
+    for(c=5;c<10;c++) {
+	glVertexAttribDivisor(c,0);
+	glDisableVertexAttribArray(c);
     }
-    glEnd();
+    glDisableVertexAttribArray(4);
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+    glUseProgram(0);
     return(1);
 }
 
@@ -591,6 +5598,9 @@ int MD2_display (struct md2_model * md2, struct md2_texture * tex, GLint sf, GLi
     ||	ef<0
     ||	sf<0 ) return(0);
 
+    if(mode&MD2D_SHADER) return(MD2_display_shader(md2, tex, sf, ef, s, mode&~(MD2D_SHADER|MD2D_BUFFERED), bb));
+    if(mode&MD2D_BUFFERED) return(MD2_display_buffered(md2, tex, sf, ef, s, mode&~MD2D_BUFFERED, bb));
+
     switch (mode) {
 	case MD2D_WIREFRAME:
 	    MD2_wire_display (md2, sf, ef, s, bb);
@@ -604,6 +5614,9 @@ int MD2_display (struct md2_model * md2, struct md2_texture * tex, GLint sf, GLi
 	case MD2D_AVERAGENORMALS:
 	    MD2_display_average_normals (md2, tex, sf, ef, s, bb); 
 	    break;
+	case MD2D_TABLENORMALS:
+	    MD2_display_table_normals (md2, tex, sf, ef, s, bb); 
+	    break;
 	case MD2D_FACENORMALS:
 	default:
 	    MD2_display_per_face_normals(md2, tex, sf, ef, s, bb); 
@@ -616,34 +5629,311 @@ int MD2_display (struct md2_model * md2, struct md2_texture * tex, GLint sf, GLi
 
 /* super render function, easier access to usual md2 animation sequences */
 
-int MD2_anim_display (struct md2_model * md2, struct md2_texture * tex, GLint anim, GLdouble s, GLint mode, struct md2_boundingbox * bb) {
-    GLint sf,ef;
+/* start and end frame and their interpolation for time s of a usual md2 animation sequence */
+
+int MD2_anim_frames (struct md2_model * md2, GLint anim, GLdouble * s, GLint * sf, GLint * ef) {
     GLdouble t;
 
     if(	anim<0
     ||	anim>MD2A_MAXANIMATIONS
     ||	md2->nFrames<198
-    ||	s<0 ) return(0);
+    ||	*s<0 ) return(0);
 
-    sf=floor(((GLdouble)MD2A_LEN[anim])*s)+MD2A_START[anim];
-    if(sf==MD2A_END[anim]) ef=MD2A_START[anim];
-    else ef=sf+1;
+    *sf=floor(((GLdouble)MD2A_LEN[anim])*(*s))+MD2A_START[anim];
+    if(*sf==MD2A_END[anim]) *ef=MD2A_START[anim];
+    else *ef=*sf+1;
     
     t=1/((GLdouble)MD2A_LEN[anim]);
-    s=(s-(floor(s/t)*t))/t;
+    *s=(*s-(floor(*s/t)*t))/t;
+    return(1);
+}
+
+int MD2_anim_display (struct md2_model * md2, struct md2_texture * tex, GLint anim, GLdouble s, GLint mode, struct md2_boundingbox * bb) {
+    GLint sf,ef;
+
+    if(!MD2_anim_frames(md2, anim, &s, &sf, &ef)) return(0);
     
     MD2_display(md2, tex, sf, ef, s, mode, bb);
     
     return(1);
 }
 
+/* fills the frames of an instance from a usual md2 animation sequence, the transform is left alone */
+
+int MD2_anim_instance (struct md2_model * md2, GLint anim, GLdouble s, struct md2_instance * inst) {
+    GLint sf,ef;
+
+    if(!MD2_anim_frames(md2, anim, &s, &sf, &ef)) return(0);
+    inst->sf=sf; inst->ef=ef; inst->s=s;
+    return(1);
+}
+
+
+
+/* animation of many entities, the state of each is kept in the arrays of a md2_animator so
+   MD2_animator_tick advances all of them in one linear pass the compiler can vectorize.
+   the keyframes it produces go to MD2_display, MD2_pose_batch or MD2_display_instanced */
+
+/* points the arrays into block, returns the size of the block needed for capacity entities */
+
+size_t MD2_animator_layout (struct md2_animator * an, GLubyte * block, GLint capacity) {
+    size_t size,n;
+
+    n=capacity;
+    size=0;
+    an->Model=(struct md2_model **)(block+size);	size+=MD2_ALIGNUP(n*sizeof(struct md2_model *));
+    an->Anim=(GLint *)(block+size);		size+=MD2_ALIGNUP(n*sizeof(GLint));
+    an->First=(GLint *)(block+size);		size+=MD2_ALIGNUP(n*sizeof(GLint));
+    an->Len=(GLint *)(block+size);		size+=MD2_ALIGNUP(n*sizeof(GLint));
+    an->Fps=(GLfloat *)(block+size);		size+=MD2_ALIGNUP(n*sizeof(GLfloat));
+    an->Rate=(GLfloat *)(block+size);		size+=MD2_ALIGNUP(n*sizeof(GLfloat));
+    an->Phase=(GLfloat *)(block+size);		size+=MD2_ALIGNUP(n*sizeof(GLfloat));
+    an->Mode=(GLint *)(block+size);		size+=MD2_ALIGNUP(n*sizeof(GLint));
+    an->SF=(GLint *)(block+size);		size+=MD2_ALIGNUP(n*sizeof(GLint));
+    an->EF=(GLint *)(block+size);		size+=MD2_ALIGNUP(n*sizeof(GLint));
+    an->S=(GLfloat *)(block+size);		size+=MD2_ALIGNUP(n*sizeof(GLfloat));
+    an->Done=(GLint *)(block+size);		size+=MD2_ALIGNUP(n*sizeof(GLint));
+    return(size);
+}
+
+int MD2_animator_grow (struct md2_animator * an, GLint capacity) {
+    struct md2_animator old;
+    GLubyte *block;
+    size_t n;
+
+    old=*an;
+    if(!(block=aligned_alloc(MD2_ARENAALIGN,MD2_animator_layout(an,NULL,capacity)))) {
+	*an=old;
+	fprintf(stderr,"Out of memory, animator of %d entities\n",capacity);
+	return(0);
+    }
+    MD2_animator_layout(an,block,capacity);
+    n=an->nEntities;
+    if(n) {
+	memcpy(an->Model,old.Model,n*sizeof(struct md2_model *));
+	memcpy(an->Anim,old.Anim,n*sizeof(GLint));
+	memcpy(an->First,old.First,n*sizeof(GLint));
+	memcpy(an->Len,old.Len,n*sizeof(GLint));
+	memcpy(an->Fps,old.Fps,n*sizeof(GLfloat));
+	memcpy(an->Rate,old.Rate,n*sizeof(GLfloat));
+	memcpy(an->Phase,old.Phase,n*sizeof(GLfloat));
+	memcpy(an->Mode,old.Mode,n*sizeof(GLint));
+	memcpy(an->SF,old.SF,n*sizeof(GLint));
+	memcpy(an->EF,old.EF,n*sizeof(GLint));
+	memcpy(an->S,old.S,n*sizeof(GLfloat));
+	memcpy(an->Done,old.Done,n*sizeof(GLint));
+    }
+    free(old.Block);
+    an->Block=block;
+    an->Capacity=capacity;
+    return(1);
+}
+
+/* capacity is only the initial one, 0 takes a default */
+
+struct md2_animator * MD2_animator_create (GLint capacity) {
+    struct md2_animator *an;
+
+    if(capacity<=0) capacity=64;
+    if(!(an=calloc(1,sizeof(struct md2_animator)))) {
+	fprintf(stderr,"Out of memory, animator\n");
+	return(NULL);
+    }
+    if(!MD2_animator_grow(an,capacity)) { free(an); return(NULL); }
+    return(an);
+}
+
+/* the results of entity e for its current phase, the scalar form of MD2_animator_tick */
+
+void MD2_animator_frames (struct md2_animator * an, GLint e) {
+    GLint f,last;
+
+    last=an->Len[e]-1;
+    f=an->Phase[e];
+    if(f>last) f=last;
+    an->S[e]=an->Phase[e]-f;
+    an->SF[e]=an->First[e]+f;
+    if(f<last) an->EF[e]=an->SF[e]+1;
+    else an->EF[e]=an->Mode[e]==MD2N_ONCE?an->SF[e]:an->First[e];
+    an->Done[e]=an->Mode[e]==MD2N_ONCE && (an->Rate[e]<0?an->Phase[e]<=0:an->Phase[e]>=last);
+}
+
+/* plays keyframes first to first+len-1 of the model of entity e at fps keyframes per second
+   from the start, a looping entity interpolates from the last back to the first one. for
+   sequences that are not one of the usual ones, e.g. all frames of the model */
+
+int MD2_animator_range (struct md2_animator * an, GLint e, GLint first, GLint len, GLfloat fps, GLint mode) {
+    if(	e<0
+    ||	e>=an->nEntities
+    ||	first<0
+    ||	len<1
+    ||	first+len>an->Model[e]->nFrames
+    ||	fps<=0
+    ||	(mode!=MD2N_LOOP && mode!=MD2N_ONCE) ) {
+	fprintf(stderr,"Invalid range %d+%d at %g fps for entity %d\n",first,len,fps,e);
+	return(0);
+    }
+    an->Anim[e]=-1;
+    an->First[e]=first;
+    an->Len[e]=len;
+    an->Fps[e]=fps;
+    an->Mode[e]=mode;
+    an->Phase[e]=mode==MD2N_ONCE && an->Rate[e]<0?len-1:0;
+    MD2_animator_frames(an,e);
+    return(1);
+}
+
+/* starts one of the usual md2 animation sequences from the beginning, or from its end for
+   a negative rate */
+
+int MD2_animator_play (struct md2_animator * an, GLint e, GLint anim, GLint mode, GLfloat rate) {
+    if(anim<0 || anim>=MD2A_MAXANIMATIONS || e<0 || e>=an->nEntities || MD2A_END[anim]>=an->Model[e]->nFrames) {
+	fprintf(stderr,"Invalid animation %d for entity %d\n",anim,e);
+	return(0);
+    }
+    an->Rate[e]=rate;
+    if(!MD2_animator_range(an,e,MD2A_START[anim],MD2A_LEN[anim],MD2A_FPS[anim],mode)) return(0);
+    an->Anim[e]=anim;
+    return(1);
+}
+
+/* a new entity of model md2, not yet playing anything */
+
+GLint MD2_animator_slot (struct md2_animator * an, struct md2_model * md2, GLfloat rate) {
+    GLint e;
+
+    if(an->nEntities==an->Capacity && !MD2_animator_grow(an,2*an->Capacity)) return(-1);
+    e=an->nEntities++;
+    an->Model[e]=md2;
+    an->Rate[e]=rate;
+    return(e);
+}
+
+/* returns the index of the new entity or -1 */
+
+GLint MD2_animator_add (struct md2_animator * an, struct md2_model * md2, GLint anim, GLint mode, GLfloat rate) {
+    GLint e;
+
+    if((e=MD2_animator_slot(an,md2,rate))<0) return(-1);
+    if(!MD2_animator_play(an,e,anim,mode,rate)) { an->nEntities--; return(-1); }
+    return(e);
+}
+
+/* the same for a keyframe range as MD2_animator_range takes it */
+
+GLint MD2_animator_add_range (struct md2_animator * an, struct md2_model * md2, GLint first, GLint len, GLfloat fps, GLint mode, GLfloat rate) {
+    GLint e;
+
+    if((e=MD2_animator_slot(an,md2,rate))<0) return(-1);
+    if(!MD2_animator_range(an,e,first,len,fps,mode)) { an->nEntities--; return(-1); }
+    return(e);
+}
+
+/* the last entity takes the place of entity e, its index changes to e */
+
+int MD2_animator_remove (struct md2_animator * an, GLint e) {
+    GLint l;
+
+    if(e<0 || e>=an->nEntities) return(0);
+    l=--(an->nEntities);
+    an->Model[e]=an->Model[l];
+    an->Anim[e]=an->Anim[l];
+    an->First[e]=an->First[l];
+    an->Len[e]=an->Len[l];
+    an->Fps[e]=an->Fps[l];
+    an->Rate[e]=an->Rate[l];
+    an->Phase[e]=an->Phase[l];
+    an->Mode[e]=an->Mode[l];
+    an->SF[e]=an->SF[l];
+    an->EF[e]=an->EF[l];
+    an->S[e]=an->S[l];
+    an->Done[e]=an->Done[l];
+    return(1);
+}
+
+/* advances every entity by dt seconds. the loop has no branches and no calls, looping phases
+   are wrapped by truncation and once phases clamped, so it vectorizes like the pose kernels.
+   the arrays are parameters so the compiler can take restrict for granted. for a looping
+   entity the keyframes and s are those of MD2_anim_frames at time Phase/Len of the sequence */
+
+#pragma GCC push_options
+#pragma GCC optimize ("tree-vectorize","no-trapping-math")
+
+void MD2_animator_advance (GLint n, GLfloat dt, const GLint * restrict first, const GLint * restrict len,
+    const GLint * restrict mode, const GLfloat * restrict fps, const GLfloat * restrict rate, GLfloat * restrict phase,
+    GLint * restrict sf, GLint * restrict ef, GLfloat * restrict s, GLint * restrict done) {
+    GLint e,f,last,once;
+    GLfloat u,l,w,c;
+
+    for(e=0;e<n;e++) {
+	l=len[e];
+	last=len[e]-1;
+	once=mode[e]==MD2N_ONCE;
+	u=phase[e]+dt*rate[e]*fps[e];
+	w=u-(GLfloat)(GLint)(u/l)*l;
+	w=w<0?w+l:w;
+	c=u<0?0:u;
+	c=c>last?last:c;
+	u=once?c:w;
+	f=u;
+	f=f>last?last:f;
+	phase[e]=u;
+	s[e]=u-f;
+	sf[e]=first[e]+f;
+	ef[e]=f<last?sf[e]+1:(once?sf[e]:first[e]);
+	done[e]=once&(((rate[e]<0)&(u<=0))|((rate[e]>=0)&(u>=last)));
+    }
+}
+
+#pragma GCC pop_options
+
+void MD2_animator_tick (struct md2_animator * an, GLfloat dt) {
+    MD2_animator_advance(an->nEntities,dt,an->First,an->Len,an->Mode,an->Fps,an->Rate,an->Phase,an->SF,an->EF,an->S,an->Done);
+}
+
+/* fills count pose jobs from entity e on, the outputs of the jobs are left alone */
+
+int MD2_animator_jobs (struct md2_animator * an, GLint e, GLint count, struct md2_posejob * jobs) {
+    GLint c;
+
+    if(e<0 || count<0 || e+count>an->nEntities) return(0);
+    for(c=0;c<count;c++) {
+	jobs[c].md2=an->Model[e+c];
+	jobs[c].sf=an->SF[e+c];
+	jobs[c].ef=an->EF[e+c];
+	jobs[c].s=an->S[e+c];
+    }
+    return(1);
+}
+
+/* fills the frames of count instances from entity e on, the transforms are left alone. all
+   of them have to share the model for MD2_display_instanced */
+
+int MD2_animator_instances (struct md2_animator * an, GLint e, GLint count, struct md2_instance * inst) {
+    GLint c;
+
+    if(e<0 || count<0 || e+count>an->nEntities) return(0);
+    for(c=0;c<count;c++) {
+	inst[c].sf=an->SF[e+c];
+	inst[c].ef=an->EF[e+c];
+	inst[c].s=an->S[e+c];
+    }
+    return(1);
+}
+
+int MD2_animator_free (struct md2_animator * an) {
+    free(an->Block);
+    free(an);
+    return(1);
+}
+
 
 
 /* dump some informations about the model */
 
 int MD2_modelinfo (struct md2_model * md2, GLint level) {
     GLint c;
-    struct md2_vertexd *vf,*wf;
+    struct md2_vertexd vf,wf;
     
     fprintf(stderr,"ID                : 0x%x\n",md2->ID);
     fprintf(stderr,"Version           : %d\n",md2->Version);
@@ -657,17 +5947,31 @@ int MD2_modelinfo (struct md2_model * md2, GLint level) {
     fprintf(stderr,"Number of GLCmds  : %d\n",md2->nGLCommands);
     fprintf(stderr,"Number of Frames  : %d\n",md2->nFrames);
     if(level>1) {
+	if(md2->Paging) {
+	    pthread_mutex_lock(&(md2->Paging->Lock));
+	    fprintf(stderr,"Paged Frames      : %d sequences, %lu bytes resident, %d page ins, %d evictions\n",md2->Paging->nSeqs,
+		(unsigned long)md2->Paging->Resident,md2->Paging->PageIns,md2->Paging->Evictions);
+	    pthread_mutex_unlock(&(md2->Paging->Lock));
+	}
+	if(md2->Delta) {
+	    fprintf(stderr,"Compressed Frames : %d sequences, %lu bytes, error %f\n",md2->Delta->nSeqs,(unsigned long)md2->Delta->Bytes,md2->Delta->MaxError);
+	}
+	if(md2->Weld) {
+	    fprintf(stderr,"Welded Vertices   : %d of %d\n",md2->Weld->nVertices,md2->Weld->nRaw);
+	    fprintf(stderr,"ACMR (cache %2d)   : %.3f -> %.3f\n",MD2_CACHESIZE,md2->Weld->ACMRBefore,md2->Weld->ACMRAfter);
+	}
 	for(c=0;c<(md2->nTextures);c++) 
 	    fprintf(stderr,"Texture %3d       : %s\n",c,(md2->TexNames)+c);
 	if(level>2) {
 	    for(c=0;c<(md2->nTexCoords);c++) 
 		fprintf(stderr,"Texture Coo %6d   : %d,%d\n",c,((md2->UV)+c)->u,((md2->UV)+c)->v);
-	    if(level>3) {
+	    if(level>3 && MD2_page_acquire(md2,0)) {
 		for(c=0;c<md2->nVertices;c++) {
-		    vf=&(md2->Vertex[c]);
-		    wf=&(md2->VNormal[c]);
-		    fprintf(stdout,"vertex %f %f %f normal %f %f %f\n",vf->v[0],vf->v[1],vf->v[2],wf->v[0],wf->v[1],wf->v[2]);
+		    MD2_get_vertex(md2,0,c,&vf);
+		    MD2_get_vnormal(md2,0,c,&wf);
+		    fprintf(stdout,"vertex %f %f %f normal %f %f %f\n",vf.v[0],vf.v[1],vf.v[2],wf.v[0],wf.v[1],wf.v[2]);
 		}
+		MD2_page_release(md2,0);
 	    }
 	}
     }
@@ -679,14 +5983,17 @@ int MD2_modelinfo (struct md2_model * md2, GLint level) {
 /* free all model memory */
 
 int MD2_freemodel (struct md2_model * md2) {
-    free(md2->FNormal);
-    free(md2->VNormal);
-    free(md2->Vertex);
-    free(md2->Faces);
-    free(md2->GLCmds);
-    free(md2->UV);
-    free(md2->TexNames);
-    free(md2);
+    MD2_cache_unmap(md2);
+    MD2_gpu_free(md2);
+    MD2_buffer_free(md2);
+    MD2_weld_free(md2);
+    free(md2->Arrays);
+    free(md2->Pose);
+    MD2_ncache_free(md2);
+    MD2_freeframes(md2);
+    MD2_page_free(md2);
+    if(md2->Map) munmap(md2->Map,md2->MapSize);
+    MD2_arena_free(md2);
     return(1);
 }
 
@@ -697,3 +6004,507 @@ int MD2_freetexture (struct md2_texture * tex) {
     free(tex);
     return(1);
 }
+
+
+
+/* the shared asset registry. lookups and releases may come from any thread, loads of
+   different files run in parallel and a second lookup of a file being loaded waits for
+   that load. textures and models drawn through buffers or shaders own GL objects, acquire
+   and release those on the thread with the context since an eviction frees them there */
+
+struct md2_registry * MD2_registry_create (size_t budget) {
+    struct md2_registry *reg;
+
+    reg=calloc(1,sizeof(struct md2_registry));
+    if(!reg) {
+	fprintf(stderr,"Out of memory, registry\n");
+	return(NULL);
+    }
+    reg->Budget=budget;
+    pthread_mutex_init(&(reg->Lock),NULL);
+    pthread_cond_init(&(reg->Loaded),NULL);
+    return(reg);
+}
+
+/* resident estimate of a model, the sections of a cache file plus the file data and the
+   normal cache. GL objects are not counted */
+
+size_t MD2_model_bytes (struct md2_model * md2) {
+    struct md2_cacheheader h;
+    size_t bytes;
+    GLint c;
+
+    MD2_cache_header(md2,&h);
+    bytes=sizeof(struct md2_model)+sizeof(struct md2_weld);
+    for(c=0;c<MD2C_SECTIONS;c++) bytes+=MD2_cache_size(&h,c);
+    if(md2->Delta) bytes+=md2->Delta->Bytes-MD2_cache_size(&h,MD2C_VERTEX);
+    if(md2->Paging) {
+	for(c=MD2C_VERTEX;c<=MD2C_NORMALIDX;c++) bytes-=MD2_cache_size(&h,c);
+	pthread_mutex_lock(&(md2->Paging->Lock));
+	bytes+=md2->Paging->Resident;
+	pthread_mutex_unlock(&(md2->Paging->Lock));
+    }
+    bytes+=md2->nFaces*sizeof(struct md2_face)+md2->nGLCommands*sizeof(GLuint)
+	  +md2->nTexCoords*sizeof(struct md2_uv)+md2->nTextures*64;
+    if(md2->NCache) bytes+=md2->NCache->nSlots*md2->NCache->SlotSize;
+    return(bytes);
+}
+
+size_t MD2_texture_bytes (struct md2_texture * tex) {
+    return(sizeof(struct md2_texture)+(size_t)tex->w*tex->h*3);
+}
+
+GLuint MD2_registry_slot (void * asset) {
+    return(((size_t)asset>>4)%MD2R_BUCKETS);
+}
+
+void MD2_registry_unlru (struct md2_registry * reg, struct md2_asset * a) {
+    if(a->Older) a->Older->Newer=a->Newer; else reg->Oldest=a->Newer;
+    if(a->Newer) a->Newer->Older=a->Older; else reg->Newest=a->Older;
+    a->Older=a->Newer=NULL;
+}
+
+void MD2_registry_unlink (struct md2_registry * reg, struct md2_asset * a) {
+    struct md2_asset **p;
+
+    for(p=&(reg->Keys[a->Hash%MD2R_BUCKETS]);*p!=a;p=&((*p)->Next));
+    *p=a->Next;
+    if(!a->Asset) return;
+    for(p=&(reg->Assets[MD2_registry_slot(a->Asset)]);*p!=a;p=&((*p)->NextAsset));
+    *p=a->NextAsset;
+}
+
+void MD2_registry_drop (struct md2_registry * reg, struct md2_asset * a) {
+    if(a->Kind==MD2R_MODEL) MD2_freemodel(a->Asset); else MD2_freetexture(a->Asset);
+    reg->Bytes-=a->Bytes;
+    reg->nAssets--;
+    free(a->Path);
+    free(a);
+}
+
+/* frees unreferenced assets, oldest first, until the registry fits its budget. must be
+   called with the registry locked */
+
+void MD2_registry_evict (struct md2_registry * reg) {
+    struct md2_asset *a;
+
+    while(reg->Budget && reg->Bytes>reg->Budget && (a=reg->Oldest)) {
+	MD2_registry_unlru(reg,a);
+	MD2_registry_unlink(reg,a);
+	MD2_registry_drop(reg,a);
+	reg->Evictions++;
+    }
+}
+
+/* the asset of a key with one more reference, loading it on a miss. evict 0 leaves the
+   budget to the next call that may evict, for callers off the GL thread */
+
+void * MD2_registry_get (struct md2_registry * reg, GLint kind, GLubyte * fn, struct md2_loadopts * opts, GLint evict) {
+    struct md2_asset *a;
+    unsigned long long hash;
+    GLint precision,flags;
+    GLfloat maxerror;
+    void *asset;
+
+    precision=(kind==MD2R_MODEL && opts)?opts->precision:0;
+    flags=(kind==MD2R_MODEL && opts)?opts->flags:0;
+    maxerror=(flags&MD2L_DELTAFRAMES)?opts->maxerror:0;
+    hash=MD2_hash(fn,strlen(fn),MD2_HASHSEED);
+    hash=MD2_hash((GLubyte *)&kind,sizeof(kind),hash);
+    hash=MD2_hash((GLubyte *)&precision,sizeof(precision),hash);
+    hash=MD2_hash((GLubyte *)&flags,sizeof(flags),hash);
+    hash=MD2_hash((GLubyte *)&maxerror,sizeof(maxerror),hash);
+
+    pthread_mutex_lock(&(reg->Lock));
+    for(a=reg->Keys[hash%MD2R_BUCKETS];a;a=a->Next) {
+	if(a->Hash==hash && a->Kind==kind && a->Precision==precision && a->Flags==flags && a->MaxError==maxerror && !strcmp(a->Path,fn)) break;
+    }
+    if(a) {
+	reg->Hits++;
+	if(!a->Refs) MD2_registry_unlru(reg,a);
+	a->Refs++;
+	while(a->Loading) pthread_cond_wait(&(reg->Loaded),&(reg->Lock));
+	asset=a->Asset;
+	if(!asset && !--(a->Refs)) {
+	    free(a->Path); free(a);
+	}
+	pthread_mutex_unlock(&(reg->Lock));
+	return(asset);
+    }
+    reg->Misses++;
+    a=calloc(1,sizeof(struct md2_asset));
+    if(!a || !(a->Path=malloc(strlen(fn)+1))) {
+	pthread_mutex_unlock(&(reg->Lock));
+	fprintf(stderr,"Out of memory, registry\n");
+	free(a); return(NULL);
+    }
+    strcpy(a->Path,fn);
+    a->Hash=hash;
+    a->Kind=kind;
+    a->Precision=precision;
+    a->Flags=flags;
+    a->MaxError=maxerror;
+    a->Loading=1;
+    a->Refs=1;
+    a->Next=reg->Keys[hash%MD2R_BUCKETS];
+    reg->Keys[hash%MD2R_BUCKETS]=a;
+    pthread_mutex_unlock(&(reg->Lock));
+
+    if(kind==MD2R_MODEL) {
+	asset=opts?MD2_loadmodel_ex(fn,opts):MD2_loadmodel(fn);
+	if(asset) a->Bytes=MD2_model_bytes(asset);
+    } else {
+	asset=MD2_loadtexture(fn);
+	if(asset) a->Bytes=MD2_texture_bytes(asset);
+    }
+
+    pthread_mutex_lock(&(reg->Lock));
+    a->Loading=0;
+    if(asset) {
+	a->Asset=asset;
+	a->NextAsset=reg->Assets[MD2_registry_slot(asset)];
+	reg->Assets[MD2_registry_slot(asset)]=a;
+	reg->Bytes+=a->Bytes;
+	reg->nAssets++;
+	if(evict) MD2_registry_evict(reg);
+    } else {
+	MD2_registry_unlink(reg,a);
+	if(!--(a->Refs)) {
+	    free(a->Path); free(a);
+	}
+    }
+    pthread_cond_broadcast(&(reg->Loaded));
+    pthread_mutex_unlock(&(reg->Lock));
+    return(asset);
+}
+
+void * MD2_registry_acquire (struct md2_registry * reg, GLint kind, GLubyte * fn, struct md2_loadopts * opts) {
+    return(MD2_registry_get(reg,kind,fn,opts,1));
+}
+
+/* shared model of a file, loaded with opts (may be NULL) on first use. the same file with a
+   different precision or different flags is a different asset */
+
+struct md2_model * MD2_registry_model (struct md2_registry * reg, GLubyte * fn, struct md2_loadopts * opts) {
+    return(MD2_registry_acquire(reg,MD2R_MODEL,fn,opts));
+}
+
+struct md2_texture * MD2_registry_texture (struct md2_registry * reg, GLubyte * fn) {
+    return(MD2_registry_acquire(reg,MD2R_TEXTURE,fn,NULL));
+}
+
+/* gives back a model or texture of the registry, the last reference makes it evictable */
+
+int MD2_registry_put (struct md2_registry * reg, void * asset, GLint evict) {
+    struct md2_asset *a;
+
+    pthread_mutex_lock(&(reg->Lock));
+    for(a=reg->Assets[MD2_registry_slot(asset)];a && a->Asset!=asset;a=a->NextAsset);
+    if(!a || !a->Refs) {
+	pthread_mutex_unlock(&(reg->Lock));
+	fprintf(stderr,"Asset %p not held from registry\n",asset);
+	return(0);
+    }
+    if(!--(a->Refs)) {
+	a->Older=reg->Newest;
+	if(reg->Newest) reg->Newest->Newer=a; else reg->Oldest=a;
+	reg->Newest=a;
+	if(evict) MD2_registry_evict(reg);
+    }
+    pthread_mutex_unlock(&(reg->Lock));
+    return(1);
+}
+
+int MD2_registry_release (struct md2_registry * reg, void * asset) {
+    return(MD2_registry_put(reg,asset,1));
+}
+
+void MD2_registry_stats (struct md2_registry * reg, struct md2_registrystats * st) {
+    pthread_mutex_lock(&(reg->Lock));
+    st->assets=reg->nAssets;
+    st->hits=reg->Hits;
+    st->misses=reg->Misses;
+    st->evictions=reg->Evictions;
+    st->bytes=reg->Bytes;
+    pthread_mutex_unlock(&(reg->Lock));
+}
+
+/* frees the registry with all its assets, none of them may be in use or loading any more */
+
+int MD2_registry_free (struct md2_registry * reg) {
+    struct md2_asset *a;
+    GLint c;
+
+    for(c=0;c<MD2R_BUCKETS;c++) {
+	while((a=reg->Keys[c])) {
+	    reg->Keys[c]=a->Next;
+	    MD2_registry_drop(reg,a);
+	}
+    }
+    pthread_cond_destroy(&(reg->Loaded));
+    pthread_mutex_destroy(&(reg->Lock));
+    free(reg);
+    return(1);
+}
+
+
+
+/* asynchronous model loading. worker threads read and preprocess the models, in order of
+   priority, and hand them out through requests that are polled, waited for or completed
+   with a callback. no GL call is made, so models drawn buffered or with shaders get their
+   GL objects on first display as usual. with a registry the workers never evict, that
+   would free GL objects of other assets off the GL thread */
+
+/* the result of a request cancelled while loading. a model of its own was only just loaded
+   and has no GL objects yet, a registry reference is kept for MD2_modelloader_collect. must
+   be called with the loader locked */
+
+void MD2_modelloader_drop (struct md2_modelloader * ml, struct md2_model * md2) {
+    struct md2_modeldrop *d;
+
+    if(!md2) return;
+    if(!ml->Registry) {
+	MD2_freemodel(md2);
+    } else if((d=malloc(sizeof(struct md2_modeldrop)))) {
+	d->Model=md2;
+	d->Next=ml->Dropped;
+	ml->Dropped=d;
+    } else {
+	MD2_registry_put(ml->Registry,md2,0);
+    }
+}
+
+/* puts a request into the queue behind all of higher or the same priority. must be called
+   with the loader locked */
+
+void MD2_modelloader_queue (struct md2_modelloader * ml, struct md2_modelrequest * r) {
+    struct md2_modelrequest **p;
+
+    for(p=&(ml->Queue);*p && (*p)->Priority>=r->Priority;p=&((*p)->Next));
+    r->Next=*p;
+    *p=r;
+}
+
+/* takes a request out of the queue, returns 0 if it is not queued. must be called with the
+   loader locked */
+
+int MD2_modelloader_unqueue (struct md2_modelloader * ml, struct md2_modelrequest * r) {
+    struct md2_modelrequest **p;
+
+    for(p=&(ml->Queue);*p && *p!=r;p=&((*p)->Next));
+    if(!*p) return(0);
+    *p=r->Next;
+    r->Next=NULL;
+    return(1);
+}
+
+void * MD2_modelloader_worker (void * arg) {
+    struct md2_modelloader *ml;
+    struct md2_modelrequest *r;
+    struct md2_model *md2;
+    struct md2_loadopts *opts;
+
+    ml=arg;
+    pthread_mutex_lock(&(ml->Lock));
+    for(;;) {
+	while(!ml->Queue && !ml->Quit) pthread_cond_wait(&(ml->Wake),&(ml->Lock));
+	if(ml->Quit) break;
+	r=ml->Queue;
+	ml->Queue=r->Next;
+	r->Next=NULL;
+	r->State=MD2M_LOADING;
+	pthread_cond_broadcast(&(ml->Done));
+	pthread_mutex_unlock(&(ml->Lock));
+	opts=r->HasOpts?&(r->Opts):NULL;
+	if(ml->Registry) md2=MD2_registry_get(ml->Registry,MD2R_MODEL,r->Path,opts,0);
+	else md2=opts?MD2_loadmodel_ex(r->Path,opts):MD2_loadmodel(r->Path);
+	pthread_mutex_lock(&(ml->Lock));
+	r->Returned=1;
+	if(!r->Cancel) {
+	    pthread_mutex_unlock(&(ml->Lock));
+	    if(r->Callback) r->Callback(r,md2,r->Arg);
+	    pthread_mutex_lock(&(ml->Lock));
+	    r->Model=md2;
+	    r->State=md2?MD2M_READY:MD2M_FAILED;
+	} else {
+	    MD2_modelloader_drop(ml,md2);
+	    r->State=MD2M_CANCELLED;
+	}
+	pthread_cond_broadcast(&(ml->Done));
+    }
+    pthread_mutex_unlock(&(ml->Lock));
+    return(NULL);
+}
+
+/* threads load in parallel. with a registry the models are taken from and shared through
+   it, every ready request then holds one reference to give back with MD2_registry_release */
+
+struct md2_modelloader * MD2_modelloader_create (GLint threads, struct md2_registry * reg) {
+    struct md2_modelloader *ml;
+    GLint c;
+
+    ml=calloc(1,sizeof(struct md2_modelloader));
+    if(!ml) {
+	fprintf(stderr,"Out of memory, model loader\n");
+	return(NULL);
+    }
+    ml->nThreads=threads<1?1:threads;
+    ml->Registry=reg;
+    ml->Threads=malloc(ml->nThreads*sizeof(pthread_t));
+    if(!ml->Threads) {
+	fprintf(stderr,"Out of memory, model loader\n");
+	free(ml); return(NULL);
+    }
+    pthread_mutex_init(&(ml->Lock),NULL);
+    pthread_cond_init(&(ml->Wake),NULL);
+    pthread_cond_init(&(ml->Done),NULL);
+    for(c=0;c<(ml->nThreads);c++) {
+	if(pthread_create(&(ml->Threads[c]),NULL,MD2_modelloader_worker,ml)) {
+	    fprintf(stderr,"Cannot create model loader thread\n");
+	    ml->nThreads=c;
+	    break;
+	}
+    }
+    if(!ml->nThreads) {
+	pthread_cond_destroy(&(ml->Done)); pthread_cond_destroy(&(ml->Wake)); pthread_mutex_destroy(&(ml->Lock));
+	free(ml->Threads); free(ml); return(NULL);
+    }
+    return(ml);
+}
+
+/* queues a model file, from any thread. opts (may be NULL) is copied, a cachedir in it must
+   stay valid until the request is done. callback (may be NULL) is called on the worker with
+   the model, NULL if loading failed, before the request turns ready or failed; it must not
+   wait for or free the request. not called for cancelled requests */
+
+struct md2_modelrequest * MD2_modelloader_load (struct md2_modelloader * ml, GLubyte * fn, struct md2_loadopts * opts, GLint priority,
+	void (*callback)(struct md2_modelrequest *, struct md2_model *, void *), void * arg) {
+    struct md2_modelrequest *r;
+
+    r=calloc(1,sizeof(struct md2_modelrequest));
+    if(!r || !(r->Path=malloc(strlen(fn)+1))) {
+	fprintf(stderr,"Out of memory, model request\n");
+	free(r); return(NULL);
+    }
+    strcpy(r->Path,fn);
+    if(opts) {
+	r->Opts=*opts;
+	r->HasOpts=1;
+    }
+    r->Priority=priority;
+    r->Callback=callback;
+    r->Arg=arg;
+    r->State=MD2M_QUEUED;
+    pthread_mutex_lock(&(ml->Lock));
+    MD2_modelloader_queue(ml,r);
+    pthread_cond_signal(&(ml->Wake));
+    pthread_mutex_unlock(&(ml->Lock));
+    return(r);
+}
+
+/* moves a queued request to its new place, e.g. as the distance to the camera changes.
+   returns 0 if it is no longer queued */
+
+int MD2_modelrequest_priority (struct md2_modelloader * ml, struct md2_modelrequest * r, GLint priority) {
+    GLint queued;
+
+    pthread_mutex_lock(&(ml->Lock));
+    r->Priority=priority;
+    if((queued=MD2_modelloader_unqueue(ml,r))) MD2_modelloader_queue(ml,r);
+    pthread_mutex_unlock(&(ml->Lock));
+    return(queued);
+}
+
+/* a queued request is cancelled at once, one being loaded when its load returns, its model
+   is freed then. returns 0 if the request is already done */
+
+int MD2_modelrequest_cancel (struct md2_modelloader * ml, struct md2_modelrequest * r) {
+    GLint ok;
+
+    ok=1;
+    pthread_mutex_lock(&(ml->Lock));
+    if(MD2_modelloader_unqueue(ml,r)) {
+	r->State=MD2M_CANCELLED;
+	pthread_cond_broadcast(&(ml->Done));
+    } else if(r->State==MD2M_LOADING && !r->Returned) {
+	r->Cancel=1;
+    } else {
+	ok=0;
+    }
+    pthread_mutex_unlock(&(ml->Lock));
+    return(ok);
+}
+
+GLint MD2_modelrequest_state (struct md2_modelloader * ml, struct md2_modelrequest * r) {
+    GLint state;
+
+    pthread_mutex_lock(&(ml->Lock));
+    state=r->State;
+    pthread_mutex_unlock(&(ml->Lock));
+    return(state);
+}
+
+/* blocks until the request is done. returns the model, which belongs to the caller from
+   then on, or NULL if loading failed or was cancelled */
+
+struct md2_model * MD2_modelrequest_wait (struct md2_modelloader * ml, struct md2_modelrequest * r) {
+    struct md2_model *md2;
+
+    pthread_mutex_lock(&(ml->Lock));
+    while(r->State==MD2M_QUEUED || r->State==MD2M_LOADING) pthread_cond_wait(&(ml->Done),&(ml->Lock));
+    md2=r->Model;
+    pthread_mutex_unlock(&(ml->Lock));
+    return(md2);
+}
+
+/* frees a request that is done, its model is not touched */
+
+int MD2_modelrequest_free (struct md2_modelrequest * r) {
+    free(r->Path);
+    free(r);
+    return(1);
+}
+
+/* gives the registry models of requests cancelled while loading back to the registry,
+   which may evict then. call on the GL thread, e.g. once per frame. returns their number */
+
+int MD2_modelloader_collect (struct md2_modelloader * ml) {
+    struct md2_modeldrop *d,*next;
+    GLint n;
+
+    pthread_mutex_lock(&(ml->Lock));
+    d=ml->Dropped;
+    ml->Dropped=NULL;
+    pthread_mutex_unlock(&(ml->Lock));
+    for(n=0;d;d=next,n++) {
+	next=d->Next;
+	MD2_registry_release(ml->Registry,d->Model);
+	free(d);
+    }
+    return(n);
+}
+
+/* stops the workers after the loads in progress. requests still queued are cancelled, their
+   handles stay valid for MD2_modelrequest_free. with a registry call it on the GL thread */
+
+int MD2_modelloader_free (struct md2_modelloader * ml) {
+    struct md2_modelrequest *r;
+    GLint c;
+
+    pthread_mutex_lock(&(ml->Lock));
+    ml->Quit=1;
+    pthread_cond_broadcast(&(ml->Wake));
+    pthread_mutex_unlock(&(ml->Lock));
+    for(c=0;c<(ml->nThreads);c++) pthread_join(ml->Threads[c],NULL);
+    while((r=ml->Queue)) {
+	ml->Queue=r->Next;
+	r->Next=NULL;
+	r->State=MD2M_CANCELLED;
+    }
+    MD2_modelloader_collect(ml);
+    pthread_cond_destroy(&(ml->Done));
+    pthread_cond_destroy(&(ml->Wake));
+    pthread_mutex_destroy(&(ml->Lock));
+    free(ml->Threads); free(ml);
+    return(1);
+}
@@ -0,0 +1,141 @@
+/********************************************************************************
+    md2bench.c - a sample application for libmd2.c
+
+    Version 1.0
+
+    (c) 2005 Leander Seige, www.determinate.net/webdata/seg/snippets.html
+    contact: snippets@determinate.net
+
+    RELEASED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE (GPL) V3
+    see www.determinate.net/webdata/seg/COPYING for more
+
+    Read the included file README for more.
+ ********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "libmd2.c"
+
+/* evaluates poses with every instruction set level the cpu supports and every storage
+   precision, positions, vertex and face normals and bounding box each time. then the size
+   and decode cost of compressed positions at a few error bounds against float ones, and a
+   crowd of entities per tick with MD2_pose_batch on one thread per cpu. last the animation
+   state of a much larger crowd is advanced with MD2_animator_tick */
+
+#define ENTITIES	5000
+#define TICKS		20
+#define ANIMATED	100000
+
+const GLfloat BOUNDS[]={0.0f,0.05f,0.1f,0.25f};	/* 0: uncompressed float positions */
+
+double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return(ts.tv_sec+ts.tv_nsec/1e9);
+}
+
+int main(int argc, char **argv) {
+    struct md2_model * mymodel;
+    struct md2_loadopts opts;
+    struct md2_boundingbox bb,*bbs;
+    struct md2_threadpool *pool;
+    struct md2_posejob *jobs;
+    struct md2_batchstats st;
+    struct md2_animator *animator;
+    GLfloat *pose;
+    GLint precision,isa,max,n,count,size,tick,b;
+    double t;
+    size_t bytes;
+    const char *pname[]={"double","float","snorm16"};
+
+    if(argc<2 || argc>3) {
+	printf("Usage: md2bench <path/model.md2> [poses]\n");
+	exit(1);
+    }
+    count=argc==3?atoi(argv[2]):10000;
+    max=MD2_pose_isa(-1);
+    printf("precision  isa        poses/s     vertices/s\n");
+    for(precision=MD2P_DOUBLE;precision<=MD2P_SNORM16;precision++) {
+	memset(&opts,0,sizeof(opts));
+	opts.precision=precision;
+	if(!(mymodel=MD2_loadmodel_ex(argv[1],&opts))) exit(1);
+	pose=malloc(3*(2*mymodel->nVertices+mymodel->nFaces)*sizeof(GLfloat));
+	for(isa=MD2I_SCALAR;isa<=max;isa++) {
+	    MD2_pose_isa(isa);
+	    t=now();
+	    for(n=0;n<count;n++) {
+		MD2_pose(mymodel,n%mymodel->nFrames,(n+1)%mymodel->nFrames,0.5,
+		    pose,pose+3*mymodel->nVertices,pose+6*mymodel->nVertices,&bb);
+	    }
+	    t=now()-t;
+	    printf("%-10s %-10s %-11.0f %.0f\n",pname[precision],MD2I_NAME[isa],count/t,count*(double)mymodel->nVertices/t);
+	}
+	free(pose);
+	MD2_freemodel(mymodel);
+    }
+
+    MD2_pose_isa(-1);
+    printf("\nbound  positions  ratio  error     poses/s\n");
+    for(b=0;b<sizeof(BOUNDS)/sizeof(BOUNDS[0]);b++) {
+	memset(&opts,0,sizeof(opts));
+	opts.precision=MD2P_FLOAT;
+	opts.flags=MD2L_TABLENORMALS|(BOUNDS[b]>0?MD2L_DELTAFRAMES:0);
+	opts.maxerror=BOUNDS[b];
+	if(!(mymodel=MD2_loadmodel_ex(argv[1],&opts))) exit(1);
+	pose=malloc(3*mymodel->nVertices*sizeof(GLfloat));
+	t=now();
+	for(n=0;n<count;n++) MD2_pose(mymodel,n%mymodel->nFrames,(n+1)%mymodel->nFrames,0.5,pose,NULL,NULL,NULL);
+	t=now()-t;
+	bytes=mymodel->Delta?mymodel->Delta->Bytes:3*sizeof(GLfloat)*mymodel->nFrames*mymodel->nVertices;
+	printf("%-6.2f %-10lu %-6.1f %-9.4f %.0f\n",BOUNDS[b],(unsigned long)bytes,
+	    3.0*sizeof(GLfloat)*mymodel->nFrames*mymodel->nVertices/bytes,mymodel->Delta?mymodel->Delta->MaxError:0,count/t);
+	free(pose);
+	MD2_freemodel(mymodel);
+    }
+
+    memset(&opts,0,sizeof(opts));
+    opts.precision=MD2P_FLOAT;
+    if(!(mymodel=MD2_loadmodel_ex(argv[1],&opts))) exit(1);
+    if(!(pool=MD2_pool_create(0))) exit(1);
+    size=3*(2*mymodel->nVertices+mymodel->nFaces);
+    pose=malloc((size_t)ENTITIES*size*sizeof(GLfloat));
+    jobs=malloc(ENTITIES*sizeof(struct md2_posejob));
+    bbs=malloc(ENTITIES*sizeof(struct md2_boundingbox));
+    if(!pose || !jobs || !bbs) exit(1);
+    printf("\nbatch of %d entities, %d threads\n",ENTITIES,pool->nThreads+1);
+    printf("tick  ms       entities/s  tasks  steals\n");
+    for(tick=0;tick<TICKS;tick++) {
+	for(n=0;n<ENTITIES;n++) {
+	    jobs[n].md2=mymodel;
+	    jobs[n].sf=(n+tick)%mymodel->nFrames;
+	    jobs[n].ef=(n+tick+1)%mymodel->nFrames;
+	    jobs[n].s=(n%10)/10.0;
+	    jobs[n].pos=pose+(size_t)n*size;
+	    jobs[n].vnrm=jobs[n].pos+3*mymodel->nVertices;
+	    jobs[n].fnrm=jobs[n].pos+6*mymodel->nVertices;
+	    jobs[n].bb=&(bbs[n]);
+	}
+	MD2_pose_batch(pool,jobs,ENTITIES,&st);
+	printf("%-5d %-8.3f %-11.0f %-6d %d\n",tick,st.seconds*1000,ENTITIES/st.seconds,st.tasks,st.steals);
+    }
+    free(bbs); free(jobs); free(pose);
+    MD2_pool_free(pool);
+
+    /* sequences, modes, rates and phases mixed so neighbours differ */
+    if(!(animator=MD2_animator_create(ANIMATED))) exit(1);
+    for(n=0;n<ANIMATED;n++) {
+	if(MD2_animator_add(animator,mymodel,n%(MD2A_MAXANIMATIONS-1),n%3?MD2N_LOOP:MD2N_ONCE,0.5+(n%7)*0.25)<0) exit(1);
+	animator->Phase[n]=(n%11)%MD2A_LEN[n%(MD2A_MAXANIMATIONS-1)];
+    }
+    t=now();
+    for(n=0;n<count;n++) MD2_animator_tick(animator,1/60.0);
+    t=now()-t;
+    printf("\nanimator of %d entities\n",ANIMATED);
+    printf("ticks/s  ns/entity\n");
+    printf("%-8.0f %.2f\n",count/t,t*1e9/count/ANIMATED);
+    MD2_animator_free(animator);
+    MD2_freemodel(mymodel);
+    return(0);
+}
@@ -16,15 +16,43 @@
 #include <stdlib.h>
 #include "libmd2.c"
 
+/* with more than one model they are loaded together by MD2_loadmodels, which reports the
+   throughput and the latency per file */
+
 int main(int argc, char **argv) {
     struct md2_model * mymodel;
+    struct md2_model ** models;
+    struct md2_loadstats st;
+    GLubyte ** paths;
+    GLint n,c;
 
-    if(argc!=3) {
-	printf("Usage: md2info <path/model.md2> <level>\n");
+    if(argc<3) {
+	printf("Usage: md2info <path/model.md2> <level> [more models]\n");
 	exit(1);
     }
-    mymodel=MD2_loadmodel(argv[1]);
-    MD2_modelinfo(mymodel,atoi(argv[2]));
-    MD2_freemodel(mymodel);
+    if(argc==3) {
+	mymodel=MD2_loadmodel(argv[1]);
+	MD2_modelinfo(mymodel,atoi(argv[2]));
+	MD2_freemodel(mymodel);
+	return(0);
+    }
+    n=argc-2;
+    paths=malloc(n*sizeof(GLubyte *));
+    models=malloc(n*sizeof(struct md2_model *));
+    if(!paths || !models) exit(1);
+    paths[0]=argv[1];
+    for(c=1;c<n;c++) paths[c]=argv[c+2];
+    MD2_loadmodels(paths,n,NULL,models,&st);
+    for(c=0;c<n;c++) {
+	if(!models[c]) continue;
+	printf("%s\n",paths[c]);
+	MD2_modelinfo(models[c],atoi(argv[2]));
+	MD2_freemodel(models[c]);
+    }
+    printf("%d loaded, %d failed, %s, %lu bytes in %.3f s, %.1f MB/s\n",st.loaded,st.failed,
+	st.uring?"io_uring":"pread",(unsigned long)st.bytes,st.seconds,st.mbps);
+    printf("latency ms: min %.2f, median %.2f, 90%% %.2f, 99%% %.2f, max %.2f\n",st.latency[0]*1000,
+	st.latency[1]*1000,st.latency[2]*1000,st.latency[3]*1000,st.latency[4]*1000);
+    free(models); free(paths);
     return(0);
 }
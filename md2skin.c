@@ -0,0 +1,65 @@
+/********************************************************************************
+    md2skin.c - a sample application for libmd2.c
+
+    Version 1.0
+
+    (c) 2005 Leander Seige, www.determinate.net/webdata/seg/snippets.html
+    contact: snippets@determinate.net
+
+    RELEASED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE (GPL) V3
+    see www.determinate.net/webdata/seg/COPYING for more
+
+    Read the included file README for more.
+ ********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "libmd2.c"
+
+/* encodes a skin offline into a block compressed file for MD2_loadtexture_compressed. BC3 is
+   taken for images with an alpha channel unless the format is given */
+
+int main(int argc, char **argv) {
+    SDL_Surface *surf1,*surf2;
+    SDL_PixelFormat cform;
+    GLubyte *rgba;
+    GLint format,y;
+
+    if(argc<3 || argc>4 || (argc==4 && strcmp(argv[3],"bc1") && strcmp(argv[3],"bc3"))) {
+	printf("Usage: md2skin <image> <out.md2t> [bc1|bc3]\n");
+	exit(1);
+    }
+    if(!(surf1=IMG_Load(argv[1]))) {
+	fprintf(stderr,"Cannot load %s\n",argv[1]);
+	exit(1);
+    }
+    format=surf1->format->Amask?MD2B_BC3:MD2B_BC1;
+    if(argc==4) format=strcmp(argv[3],"bc1")?MD2B_BC3:MD2B_BC1;
+
+    /* rgba in byte order */
+    memset(&cform,0,sizeof(cform));
+    cform.BitsPerPixel=32;
+    cform.BytesPerPixel=4;
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+    cform.Rmask=0xFF000000; cform.Gmask=0x00FF0000; cform.Bmask=0x0000FF00; cform.Amask=0x000000FF;
+    cform.Rshift=24; cform.Gshift=16; cform.Bshift=8; cform.Ashift=0;
+#else
+    cform.Rmask=0x000000FF; cform.Gmask=0x0000FF00; cform.Bmask=0x00FF0000; cform.Amask=0xFF000000;
+    cform.Rshift=0; cform.Gshift=8; cform.Bshift=16; cform.Ashift=24;
+#endif
+    if(!(surf2=SDL_ConvertSurface(surf1,&cform,0))) {
+	fprintf(stderr,"Cannot convert %s\n",argv[1]);
+	exit(1);
+    }
+    if(!(rgba=malloc((size_t)surf2->w*surf2->h*4))) {
+	fprintf(stderr,"Out of memory\n");
+	exit(1);
+    }
+    for(y=0;y<surf2->h;y++) memcpy(rgba+(size_t)y*surf2->w*4,(GLubyte *)surf2->pixels+(size_t)y*surf2->pitch,surf2->w*4);
+    if(!MD2_bc_encodefile(rgba,surf2->w,surf2->h,format,argv[2])) exit(1);
+    printf("%s: %dx%d %s\n",argv[2],surf2->w,surf2->h,format==MD2B_BC1?"BC1":"BC3");
+    free(rgba);
+    SDL_FreeSurface(surf2);
+    SDL_FreeSurface(surf1);
+    return(0);
+}
@@ -82,6 +82,8 @@ void printinfo() {
     printf("Keys:   'T' - toggle texturing \n");
     printf("        'B' - toggle boundingbox \n");
     printf("        'R' - toggle rotation \n");
+    printf("        'V' - toggle vertex buffer rendering \n");
+    printf("        'S' - toggle vertex shader interpolation \n");
     printf("  Cursor up - Gamma + \n");
     printf("       down - Gamma - \n");
     printf("        'L' - toggle looping\n");
@@ -95,8 +97,9 @@ int main (int argc, char** argv)
 {
     struct md2_model *mymodel;
     struct md2_texture *mytex;
-    int displaymode,animation,rotate,show_bb,show_texture,quit,looping,sf,ef;
-    double scale,gamma;
+    struct md2_animator *animator;
+    int displaymode,animation,rotate,show_bb,show_texture,quit,looping,buffered,shader;
+    double gamma;
     double spin=0.0;
     struct md2_boundingbox bb;
 	
@@ -142,12 +145,20 @@ int main (int argc, char** argv)
     glShadeModel(GL_SMOOTH);
     glEnable(GL_DEPTH_TEST);
 
-    displaymode=MD2D_FACENORMALS; animation=MD2A_STAND; rotate=0; sf=0; ef=1;
-    show_bb=0; show_texture=1; scale=0; gamma=1.6; quit=0; looping=0; 
+    displaymode=MD2D_FACENORMALS; animation=MD2A_STAND; rotate=0;
+    show_bb=0; show_texture=1; gamma=1.6; quit=0; looping=0; buffered=0; shader=0; 
 
     mymodel=MD2_loadmodel(argv[1]);
     mytex=MD2_loadtexture(argv[2]);
 
+    /* one entity, looping over all frames at 7.5 per second or playing the current sequence */
+    if(!(animator=MD2_animator_create(1))) exit(1);
+    if(MD2_animator_add(animator,mymodel,animation,MD2N_LOOP,1)<0) {
+	/* not the usual sequences, loop over the frames there are */
+	if(MD2_animator_add_range(animator,mymodel,0,mymodel->nFrames,7.5,MD2N_LOOP,1)<0) exit(1);
+	looping=1;
+    }
+
     glViewport(0,0,SCREENW,SCREENH);             
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
@@ -199,15 +210,8 @@ int main (int argc, char** argv)
 		glDisable(GL_TEXTURE_RECTANGLE_NV);
 	    }
 	}
-	if(looping) {
-	    MD2_display(mymodel,mytex,sf,ef,scale,displaymode,&bb);
-	    scale+=.3;
-	    if(scale>1.0) { scale-=1.0; sf++; ef=sf+1; sf%=mymodel->nFrames; ef%=mymodel->nFrames; }
-	} else {
-	    MD2_anim_display(mymodel,mytex,animation,scale/MD2A_TIME[animation],displaymode,&bb);
-	    scale+=.04;
-	    if(scale>MD2A_TIME[animation]) scale-=MD2A_TIME[animation];
-	}
+	MD2_display(mymodel,mytex,animator->SF[0],animator->EF[0],animator->S[0],displaymode|buffered|shader,&bb);
+	MD2_animator_tick(animator,.04);
 	if(show_bb) { 
 	    glDisable(GL_TEXTURE_RECTANGLE_NV); 
 	    glEnable(GL_LINE_STIPPLE); 
@@ -229,6 +233,14 @@ int main (int argc, char** argv)
 			case SDLK_b:
 			    show_bb=1-show_bb;
 			    break;
+			case SDLK_v:
+			    buffered=MD2D_BUFFERED-buffered;
+			    printf("%svertex buffer\n",buffered?"":"no ");
+			    break;
+			case SDLK_s:
+			    shader=MD2D_SHADER-shader;
+			    printf("%svertex shader\n",shader?"":"no ");
+			    break;
 			case SDLK_r:
 			    rotate=1-rotate;
 			    break;
@@ -243,14 +255,20 @@ int main (int argc, char** argv)
 			    break;
 			case SDLK_l:
 			    looping=1-looping;
-			    scale=0; sf=0; ef=1;
+			    if(looping) MD2_animator_range(animator,0,0,mymodel->nFrames,7.5,MD2N_LOOP);
+			    else if(!MD2_animator_play(animator,0,animation,MD2N_LOOP,1)) looping=1;
 			    printf("%sloop\n",looping?"":"no ");
 			    break;
 			case SDLK_RETURN:
 			    animation++; animation%=MD2A_MAXANIMATIONS-1;
+			    if(!looping) MD2_animator_play(animator,0,animation,MD2N_LOOP,1);
 			    break;
 			case SDLK_SPACE:
 			    if(displaymode==MD2D_VERTEXNORMALS) {
+				printf("switch to tablenormals\n");
+				displaymode=MD2D_TABLENORMALS;
+			    }
+			    else if(displaymode==MD2D_TABLENORMALS) {
 				printf("switch to wireframe\n");
 				displaymode=MD2D_WIREFRAME;
 			    }